@@ -1,8 +1,13 @@
 #include "austere_cache.h"
 #include "common/env.h"
 #include "common/config.h"
+#include "io/buffer_pool.h"
 
 #include "manage/dirtylist.h"
+#include "manage/sequential_detector.h"
+#include "manage/read_ahead.h"
+#include "manage/write_coalescer.h"
+#include "metadata/admission_filter.h"
 #include "metadata/cachededup/cdarc_fpindex.h"
  
 
@@ -19,17 +24,57 @@
 namespace cache {
     AustereCache::AustereCache()
     {
-      IOModule::getInstance().addCacheDevice(Config::getInstance().getCacheDeviceName());
-      IOModule::getInstance().addPrimaryDevice(Config::getInstance().getPrimaryDeviceName());
+      if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+#ifdef ACDC
+        if (Config::getInstance().isMultiThreadingEnabled()) {
+          std::cout << "The log-structured layout does not support multi-threading, use the fixed layout" << std::endl;
+          Config::getInstance().enableLogStructuredLayout(false);
+        } else if (Config::getInstance().isRecoveryEnabled()) {
+          std::cout << "Recovery is not supported by the log-structured layout, start with an empty cache" << std::endl;
+          Config::getInstance().enableRecovery(false);
+        }
+#else
+        std::cout << "The log-structured layout is not supported by this cache variant" << std::endl;
+        Config::getInstance().enableLogStructuredLayout(false);
+#endif
+      }
+#if defined(CACHE_DEDUP)
+      if (Config::getInstance().getMetadataDeviceName() != nullptr) {
+        std::cout << "This cache variant keeps no metadata on the cache device, ignore the metadata device" << std::endl;
+        Config::getInstance().setMetadataDeviceName(nullptr);
+      }
+#endif
+      for (uint32_t deviceId = 0; deviceId < Config::getInstance().getnCacheDevices(); ++deviceId) {
+        IOModule::getInstance().addCacheDevice(Config::getInstance().getCacheDeviceName(deviceId));
+      }
+      if (Config::getInstance().getMetadataDeviceName() != nullptr) {
+        IOModule::getInstance().addMetadataDevice(Config::getInstance().getMetadataDeviceName());
+      }
+      if (Config::getInstance().getnVolumes() > Stats::kMaxVolumes) {
+        std::cout << "At most " << Stats::kMaxVolumes << " volumes are supported!" << std::endl;
+        exit(-1);
+      }
+      for (uint32_t volumeId = 0; volumeId < Config::getInstance().getnVolumes(); ++volumeId) {
+        IOModule::getInstance().addPrimaryDevice(Config::getInstance().getPrimaryDeviceName(volumeId));
+      }
+      if (Config::getInstance().isRecoveryEnabled()) {
+#ifdef ACDC
+        MetadataModule::getInstance().recover();
+#else
+        std::cout << "Recovery is not supported by this cache variant, start with an empty cache" << std::endl;
+#endif
+      }
     }
 
     AustereCache::~AustereCache() {
-      Stats::getInstance().dump();
-      Stats::getInstance().release();
-      Config::getInstance().release();
+      flushCoalesced();
+      // Write back the remaining dirty data first so that it is accounted
       if (Config::getInstance().getCacheMode() == tWriteBack) {
         DirtyList::getInstance().shutdown();
       }
+      Stats::getInstance().dump();
+      Stats::getInstance().release();
+      Config::getInstance().release();
 #ifdef CDARC
       CDARCFPIndex::getInstance().clearObsolete();
 #endif
@@ -40,29 +85,265 @@ namespace cache {
       std::cout << std::fixed << "VM: " << vm << "; RSS: " << rss << std::endl;
     }
 
-    void AustereCache::read(uint64_t addr, void *buf, uint32_t len)
+    void AustereCache::read(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len)
+    {
+      ChunkOrdering::Ticket ticket = issue(volumeId, addr, len);
+      read(ticket, buf);
+    }
+
+    void AustereCache::write(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len)
+    {
+      ChunkOrdering::Ticket ticket = issue(volumeId, addr, len);
+      write(ticket, buf);
+    }
+
+    void AustereCache::read(ChunkOrdering::Ticket &ticket, void *buf)
+    {
+      ordering_.wait(ticket);
+      readChunks(getVolumeId(ticket.getLba()), getVolumeAddress(ticket.getLba()), buf, ticket.getLen());
+      ordering_.release(ticket);
+    }
+
+    void AustereCache::write(ChunkOrdering::Ticket &ticket, void *buf)
+    {
+      ordering_.wait(ticket);
+      writeChunks(getVolumeId(ticket.getLba()), getVolumeAddress(ticket.getLba()), buf, ticket.getLen());
+      ordering_.release(ticket);
+    }
+
+    void AustereCache::readChunks(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len)
     {
       Stats::getInstance().setCurrentRequestType(0);
-      Chunker chunker = ChunkModule::getInstance().createChunker(addr, buf, len);
+      bool bypass = SequentialDetector::getInstance().isSequential(volumeId, addr, len);
+      Chunker chunker = ChunkModule::getInstance().createChunker(toLba(volumeId, addr), buf, len);
+      uint64_t chunkSize = Config::getInstance().getChunkSize();
+
+      Stats::getInstance().add_bytes_requested(len);
 
       alignas(512) Chunk chunk;
       while (chunker.next(chunk)) {
-        internalRead(chunk);
+        AdmissionFilter::getInstance().recordAccess(chunk.addr_ & ~(chunkSize - 1));
+        uint8_t *userBuf = chunk.buf_;
+        BufferPool::Buffer bounceBuf;
+        if (Config::getInstance().isDirectIOEnabled() && !BufferPool::isAligned(chunk.buf_)) {
+          // Direct I/O cannot read into the buffer of the caller
+          bounceBuf = BufferPool::getInstance().acquire();
+          chunk.buf_ = bounceBuf.get();
+        }
+        if (chunk.len_ != chunkSize || !WriteCoalescer::getInstance().isEmpty()) {
+          readPartial(chunk, !bypass);
+        } else {
+          internalRead(chunk, !bypass);
+        }
+        if (bounceBuf.get() != nullptr) {
+          memcpy(userBuf, bounceBuf.get(), chunk.len_);
+          Stats::getInstance().add_copy(chunk.len_);
+        }
+        if (bypass) {
+          Stats::getInstance().add_read_bypassed(chunk.lookupResult_ == HIT, chunk.len_);
+        }
+        Stats::getInstance().add_volume_read(volumeId, chunk.lookupResult_ == HIT);
         chunk.fpBucketLock_.reset();
         chunk.lbaBucketLock_.reset();
       }
     }
 
-    void AustereCache::write(uint64_t addr, void *buf, uint32_t len)
+    void AustereCache::writeChunks(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len)
     {
       Stats::getInstance().setCurrentRequestType(1);
-      Chunker chunker = ChunkModule::getInstance().createChunker(addr, buf, len);
+      bool bypass = SequentialDetector::getInstance().isSequential(volumeId, addr, len);
+      Chunker chunker = ChunkModule::getInstance().createChunker(toLba(volumeId, addr), buf, len);
+      uint64_t chunkSize = Config::getInstance().getChunkSize();
       alignas(512) Chunk c;
+      Stats::getInstance().add_bytes_requested(len);
 
       while ( chunker.next(c) ) {
-        internalWrite(c);
+        AdmissionFilter::getInstance().recordAccess(c.addr_ & ~(chunkSize - 1));
+        BufferPool::Buffer bounceBuf;
+        if (Config::getInstance().isDirectIOEnabled() && !BufferPool::isAligned(c.buf_)) {
+          // Direct I/O cannot write from the buffer of the caller
+          bounceBuf = BufferPool::getInstance().acquire();
+          memcpy(bounceBuf.get(), c.buf_, c.len_);
+          Stats::getInstance().add_copy(c.len_);
+          c.buf_ = bounceBuf.get();
+        }
+        if (c.len_ != chunkSize) {
+          // Also goes through the cache when sequential
+          writePartial(c);
+        } else if (!WriteCoalescer::getInstance().isEmpty()) {
+          std::lock_guard<std::mutex> l(WriteCoalescer::getInstance().getChunkLock(c.addr_));
+          // Buffered sectors of the chunk are overwritten
+          WriteCoalescer::getInstance().erase(c.addr_);
+          writeFull(c, bypass);
+        } else {
+          writeFull(c, bypass);
+        }
+        Stats::getInstance().add_volume_write(volumeId, c.dedupResult_ == DUP_CONTENT);
         c.fpBucketLock_.reset();
         c.lbaBucketLock_.reset();
       }
     }
+
+    void AustereCache::writeFull(Chunk &chunk, bool bypass)
+    {
+      if (!bypass || !bypassWrite(chunk)) {
+        internalWrite(chunk);
+      }
+      ReadAhead::getInstance().invalidate(chunk.addr_);
+    }
+
+    void AustereCache::readPartial(Chunk &chunk, bool admit)
+    {
+      WriteCoalescer &coalescer = WriteCoalescer::getInstance();
+      uint32_t chunkSize = Config::getInstance().getChunkSize();
+      uint64_t lba = chunk.addr_ & ~(uint64_t)(chunkSize - 1);
+      uint32_t offset = chunk.addr_ - lba;
+      bool isPartial = chunk.len_ != chunkSize;
+
+      std::unique_lock<std::mutex> chunkLock(coalescer.getChunkLock(lba));
+      WriteCoalescer::Entry *entry = coalescer.find(lba);
+      if (entry == nullptr) {
+        // Nothing to overlay, and no write to the chunk runs alongside
+        chunkLock.unlock();
+      }
+      if (entry == nullptr && !isPartial) {
+        internalRead(chunk, admit);
+        return;
+      }
+      if (entry != nullptr && coalescer.covers(*entry, offset, chunk.len_)) {
+        memcpy(chunk.buf_, entry->data_.get() + offset, chunk.len_);
+        Stats::getInstance().add_copy(chunk.len_);
+        chunk.lookupResult_ = HIT;
+        if (isPartial) {
+          Stats::getInstance().add_partial_read(true);
+        }
+        return;
+      }
+
+      // Read the whole chunk and take the requested part of it
+      BufferPool::Buffer buffer = BufferPool::getInstance().acquire();
+      uint8_t *data = buffer.get();
+      alignas(512) Chunk full;
+      Chunker chunker = ChunkModule::getInstance().createChunker(lba, data, chunkSize);
+      chunker.next(full);
+      internalRead(full, admit);
+      full.fpBucketLock_.reset();
+      full.lbaBucketLock_.reset();
+      if (entry != nullptr) {
+        coalescer.overlay(*entry, data);
+        Stats::getInstance().add_copy(entry->nValidSectors_ * WriteCoalescer::kSectorSize);
+      }
+      memcpy(chunk.buf_, data + offset, chunk.len_);
+      Stats::getInstance().add_copy(chunk.len_);
+      chunk.lookupResult_ = full.lookupResult_;
+      if (isPartial) {
+        Stats::getInstance().add_partial_read(false);
+      }
+    }
+
+    void AustereCache::writePartial(Chunk &chunk)
+    {
+      WriteCoalescer &coalescer = WriteCoalescer::getInstance();
+      uint32_t chunkSize = Config::getInstance().getChunkSize();
+      uint64_t lba = chunk.addr_ & ~(uint64_t)(chunkSize - 1);
+      uint32_t offset = chunk.addr_ - lba;
+
+      Stats::getInstance().add_partial_write();
+      std::unique_lock<std::mutex> chunkLock(coalescer.getChunkLock(lba));
+      WriteCoalescer::Entry *entry = coalescer.find(lba);
+      uint64_t victimLba;
+      if (entry == nullptr && coalescer.isFull() && coalescer.getVictim(victimLba)) {
+        // The victim is guarded by its own chunk lock, which may be this one
+        chunkLock.unlock();
+        {
+          std::lock_guard<std::mutex> victimLock(coalescer.getChunkLock(victimLba));
+          flushCoalesced(victimLba);
+        }
+        chunkLock.lock();
+        entry = coalescer.find(lba);
+      }
+      if (entry == nullptr) {
+        entry = coalescer.insert(lba);
+      }
+      if (coalescer.needsFill(*entry, offset, chunk.len_)) {
+        // The write does not start or end on a sector boundary
+        fillCoalesced(*entry);
+      }
+      coalescer.merge(*entry, offset, chunk.buf_, chunk.len_);
+      Stats::getInstance().add_copy(chunk.len_);
+      if (coalescer.isComplete(*entry) || coalescer.isOverCapacity()) {
+        flushCoalesced(lba);
+      }
+    }
+    bool AustereCache::bypassWrite(Chunk &chunk)
+    {
+      {
+        // A cached copy of the lba would become stale
+        alignas(512) Chunk probe(chunk);
+        DeduplicationModule::lookup(probe);
+        if (probe.hitLBAIndex_) {
+          Stats::getInstance().add_sequential_write_cached();
+          return false;
+        }
+      }
+      if (Config::getInstance().getCacheMode() == tWriteBack) {
+        // Also drops a dirty or staged older version of the lba
+        DirtyList::getInstance().writeThrough(chunk.addr_, chunk.buf_, chunk.len_);
+      } else {
+        IOModule::getInstance().write(PRIMARY_DEVICE, chunk.addr_, chunk.buf_, chunk.len_);
+      }
+      Stats::getInstance().add_write_bypassed(chunk.len_);
+      return true;
+    }
+
+    void AustereCache::fillCoalesced(WriteCoalescer::Entry &entry)
+    {
+      uint32_t chunkSize = Config::getInstance().getChunkSize();
+      BufferPool::Buffer buffer = BufferPool::getInstance().acquire();
+      uint8_t *data = buffer.get();
+      alignas(512) Chunk full;
+      Chunker chunker = ChunkModule::getInstance().createChunker(entry.lba_, data, chunkSize);
+      chunker.next(full);
+      internalRead(full, false);
+      full.fpBucketLock_.reset();
+      full.lbaBucketLock_.reset();
+      Stats::getInstance().add_copy(chunkSize - entry.nValidSectors_ * WriteCoalescer::kSectorSize);
+      WriteCoalescer::getInstance().fill(entry, data);
+    }
+
+    void AustereCache::flushCoalesced(uint64_t lba)
+    {
+      WriteCoalescer &coalescer = WriteCoalescer::getInstance();
+      WriteCoalescer::Entry *entry = coalescer.find(lba);
+      if (entry == nullptr) {
+        // Flushed by another thread already
+        return;
+      }
+      if (!coalescer.isComplete(*entry)) {
+        fillCoalesced(*entry);
+      }
+      Stats::getInstance().add_coalesced_chunk(entry->isFilled_);
+
+      alignas(512) Chunk full;
+      Chunker chunker = ChunkModule::getInstance().createChunker(lba,
+          entry->data_.get(), Config::getInstance().getChunkSize());
+      chunker.next(full);
+      // A fingerprint the trace gave for the lba is not the one of this data
+      Config::getInstance().eraseFingerprint(lba);
+      internalWrite(full);
+      full.fpBucketLock_.reset();
+      full.lbaBucketLock_.reset();
+      ReadAhead::getInstance().invalidate(lba);
+      coalescer.erase(lba);
+    }
+
+    void AustereCache::flushCoalesced()
+    {
+      WriteCoalescer &coalescer = WriteCoalescer::getInstance();
+      uint64_t lba;
+      while (coalescer.getVictim(lba)) {
+        std::lock_guard<std::mutex> chunkLock(coalescer.getChunkLock(lba));
+        flushCoalesced(lba);
+      }
+    }
 }
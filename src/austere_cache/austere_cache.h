@@ -6,6 +6,8 @@
 #include "deduplication/deduplication_module.h"
 #include "compression/compression_module.h"
 #include "manage/manage_module.h"
+#include "manage/chunk_ordering.h"
+#include "manage/write_coalescer.h"
 #include "utils/thread_pool.h"
 #include <set>
 #include <string>
@@ -21,8 +23,24 @@ class AustereCache {
  public:
   AustereCache();
   ~AustereCache();
-  void read(uint64_t addr, void *buf, uint32_t len);
-  void write(uint64_t addr, void *buf, uint32_t len);
+  // Requests to a volume of the primary storage; all volumes share the cache
+  // and are deduplicated against each other
+  void read(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len);
+  void write(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len);
+  // Requests to volume 0
+  void read(uint64_t addr, void *buf, uint32_t len) { read(0, addr, buf, len); }
+  void write(uint64_t addr, void *buf, uint32_t len) { write(0, addr, buf, len); }
+  // Requests to a chunk run one at a time, in the order they are issued
+  // (see ChunkOrdering); read and write above issue theirs when called. A
+  // client can issue its requests in order and run them from any thread.
+  ChunkOrdering::Ticket issue(uint32_t volumeId, uint64_t addr, uint32_t len)
+  {
+    return ordering_.issue(toLba(volumeId, addr), len);
+  }
+  // Wait for the turn of an issued request, e.g., to prepare its data
+  void wait(ChunkOrdering::Ticket &ticket) { ordering_.wait(ticket); }
+  void read(ChunkOrdering::Ticket &ticket, void *buf);
+  void write(ChunkOrdering::Ticket &ticket, void *buf);
   inline void resetStatistics() { stats_->reset(); }
   inline void dumpStatistics() { stats_->dump(); }
   void dumpMemoryUsage(double& vm_usage, double& resident_set)
@@ -63,9 +81,28 @@ class AustereCache {
   }
 
  private:
-  void internalRead(Chunk &chunk);
+  // Requests whose turn has come
+  void readChunks(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len);
+  void writeChunks(uint32_t volumeId, uint64_t addr, void *buf, uint32_t len);
+  // Without admit, a missed chunk is read from the primary device only
+  void internalRead(Chunk &chunk, bool admit = true);
   void internalWrite(Chunk &chunk);
+  // Chunks partially written, or with sectors in the WriteCoalescer
+  void readPartial(Chunk &chunk, bool admit);
+  void writePartial(Chunk &chunk);
+  void writeFull(Chunk &chunk, bool bypass);
+  // Complete a chunk of the WriteCoalescer with its current data
+  void fillCoalesced(WriteCoalescer::Entry &entry);
+  // Complete a chunk of the WriteCoalescer and write it to the cache; the
+  // caller holds the lock of the chunk in the WriteCoalescer
+  void flushCoalesced(uint64_t lba);
+  // Write all the chunks of the WriteCoalescer at shutdown
+  void flushCoalesced();
+  // Write a chunk of a sequential stream to the primary device, return
+  // false if the chunk must go through the cache instead
+  bool bypassWrite(Chunk &chunk);
 
+  ChunkOrdering ordering_;
   // Statistics
   Stats* stats_;
 };
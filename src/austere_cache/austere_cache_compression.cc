@@ -1,16 +1,19 @@
 #include <manage/dirtylist.h>
 #include "austere_cache.h"
+#include "metadata/admission_filter.h"
+#include "io/buffer_pool.h"
 
 #if defined(ACDC) || defined(CDARC)
 namespace cache {
 // ACDC or CDARC
 // (CDARC needs also compression but no compress level optimization)
 // Will deal with it in compression module
-    void AustereCache::internalRead(Chunk &chunk) {
+    void AustereCache::internalRead(Chunk &chunk, bool admit) {
       // construct compressed buffer for chunk chunk
       // When the cache is hit, compressedBuf stores the data retrieved from ssd
-      alignas(512) uint8_t compressedBuf[Config::getInstance().getChunkSize()];
-      chunk.compressedBuf_ = compressedBuf;
+      // if compressed; uncompressed data is read into chunk.buf_ directly
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      chunk.compressedBuf_ = compressedBuf.get();
 
       // look up index
       DeduplicationModule::lookup(chunk);
@@ -25,6 +28,19 @@ namespace cache {
         CompressionModule::decompress(chunk);
       }
 
+      if (chunk.lookupResult_ == NOT_HIT && !admit) {
+        // Sequential data and the old data of partially written chunks
+        // are not admitted into the cache
+        return;
+      }
+      if (chunk.lookupResult_ == NOT_HIT && AdmissionFilter::getInstance().isEnabled()) {
+        // Rarely accessed blocks are not worth the cache space and the work
+        bool isAdmitted = AdmissionFilter::getInstance().isAdmitted(chunk.addr_);
+        Stats::getInstance().add_read_miss_admission(isAdmitted, chunk.len_);
+        if (!isAdmitted) {
+          return;
+        }
+      }
       if (chunk.lookupResult_ == NOT_HIT) {
         Stats::getInstance().add_total_bytes_written_to_ssd(chunk.len_);
         // dedup the data, the same procedure as in the write
@@ -45,8 +61,8 @@ namespace cache {
 
     void AustereCache::internalWrite(Chunk &chunk) {
       chunk.lookupResult_ = LOOKUP_UNKNOWN;
-      alignas(512) uint8_t tempBuf[Config::getInstance().getChunkSize()];
-      chunk.compressedBuf_ = tempBuf;
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      chunk.compressedBuf_ = compressedBuf.get();
 
       Stats::getInstance().add_total_bytes_written_to_ssd(chunk.len_);
       {
@@ -55,15 +71,30 @@ namespace cache {
         if (chunk.dedupResult_ == NOT_DUP) {
           CompressionModule::compress(chunk);
         }
+        // Decided before the metadata is persisted, which records it
+        bool isOverDirtyQuota = Config::getInstance().getCacheMode() == tWriteBack
+          && DirtyList::getInstance().isOverDirtyQuota(chunk.addr_);
+        chunk.isDirty_ = Config::getInstance().getCacheMode() == tWriteBack && !isOverDirtyQuota;
         ManageModule::getInstance().updateMetadata(chunk);
+        ManageModule::getInstance().write(chunk);
+        // The lba becomes dirty only after its data is in the cache,
+        // otherwise a flusher may write back what was there before.
+        if (isOverDirtyQuota) {
+          // The volume holds too much dirty data
+          DirtyList::getInstance().writeThrough(chunk.addr_, chunk.buf_, chunk.len_);
+          Stats::getInstance().add_volume_write_through(getVolumeId(chunk.addr_));
+        } else if (chunk.isDirty_) {
 #ifdef CACHE_DEDUP
-        if (Config::getInstance().getCacheMode() == tWriteBack) {
           DirtyList::getInstance().addLatestUpdate(chunk.addr_,
               ((uint64_t)chunk.weuId_ << 32u) | chunk.weuOffset_,
               chunk.compressedLen_);
-        }
+#else
+          DirtyList::getInstance().addLatestUpdate(chunk.addr_,
+              chunk.cachedataLocation_,
+              (chunk.nSubchunks_) *
+              Config::getInstance().getSubchunkSize());
 #endif
-        ManageModule::getInstance().write(chunk);
+        }
         Stats::getInstance().add_write_stat(chunk);
       }
     }
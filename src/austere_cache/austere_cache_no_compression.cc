@@ -1,13 +1,27 @@
 #include <manage/dirtylist.h>
 #include "austere_cache.h"
+#include "metadata/admission_filter.h"
 
 #if defined(CACHE_DEDUP) && (defined(DLRU) || defined(DARC) || defined(BUCKETDLRU))
 namespace cache {
-  void AustereCache::internalRead(Chunk &chunk)
+  void AustereCache::internalRead(Chunk &chunk, bool admit)
   {
     DeduplicationModule::lookup(chunk);
     Stats::getInstance().addReadLookupStatistics(chunk);
     ManageModule::getInstance().read(chunk);
+    if (chunk.lookupResult_ == NOT_HIT && !admit) {
+      // Sequential data and the old data of partially written chunks
+      // are not admitted into the cache
+      return;
+    }
+    if (chunk.lookupResult_ == NOT_HIT && AdmissionFilter::getInstance().isEnabled()) {
+      // Rarely accessed blocks are not worth the cache space and the work
+      bool isAdmitted = AdmissionFilter::getInstance().isAdmitted(chunk.addr_);
+      Stats::getInstance().add_read_miss_admission(isAdmitted, chunk.len_);
+      if (!isAdmitted) {
+        return;
+      }
+    }
 
     if (chunk.lookupResult_ == NOT_HIT) {
       Stats::getInstance().add_total_bytes_written_to_ssd(chunk.len_);
@@ -33,7 +47,12 @@ namespace cache {
     ManageModule::getInstance().write(chunk);
 
     if (Config::getInstance().getCacheMode() == tWriteBack) {
-      DirtyList::getInstance().addLatestUpdate(chunk.addr_, chunk.cachedataLocation_, chunk.len_);
+      if (DirtyList::getInstance().isOverDirtyQuota(chunk.addr_)) {
+        DirtyList::getInstance().writeThrough(chunk.addr_, chunk.buf_, chunk.len_);
+        Stats::getInstance().add_volume_write_through(getVolumeId(chunk.addr_));
+      } else {
+        DirtyList::getInstance().addLatestUpdate(chunk.addr_, chunk.cachedataLocation_, chunk.len_);
+      }
     }
     Stats::getInstance().add_write_stat(chunk);
   }
@@ -0,0 +1,88 @@
+/* File: benchmark/buffer_pool_benchmark.cc
+ * Description:
+ *   Throughput and hit ratios of BufferPool against posix_memalign.
+ *
+ *   Usage: buffer_pool_benchmark [nThreads] [chunkSize] [nBuffersHeld]
+ *   Each thread repeatedly acquires nBuffersHeld chunk buffers, writes the
+ *   first byte of each, and releases them, as a request of the data path
+ *   does with its temporaries.
+ */
+#include "io/buffer_pool.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumRoundsPerThread = 1000000;
+
+  template <typename Round>
+  double measure(uint32_t nThreads, Round round)
+  {
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t threadId = 0; threadId < nThreads; ++threadId) {
+      threads.emplace_back([&round]() {
+        for (uint32_t i = 0; i < kNumRoundsPerThread; ++i) {
+          round();
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    return 1.0 * nThreads * kNumRoundsPerThread / us;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t nThreads = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t chunkSize = argc > 2 ? atoi(argv[2]) : Config::getInstance().getChunkSize();
+  uint32_t nBuffersHeld = argc > 3 ? atoi(argv[3]) : 2;
+  Config::getInstance().setChunkSize(chunkSize);
+  std::cout << "Threads: " << nThreads << ", chunk size: " << chunkSize
+            << ", buffers held: " << nBuffersHeld << std::endl;
+
+  double mallocRate = measure(nThreads, [&]() {
+    std::vector<uint8_t *> buffers(nBuffersHeld);
+    for (auto &buf : buffers) {
+      if (posix_memalign(reinterpret_cast<void **>(&buf), BufferPool::kAlignment, chunkSize) != 0) {
+        std::cout << "Cannot allocate memory!" << std::endl;
+        exit(-1);
+      }
+      *(volatile uint8_t *)buf = 1;
+    }
+    for (auto buf : buffers) {
+      free(buf);
+    }
+  });
+
+  double poolRate = measure(nThreads, [&]() {
+    std::vector<BufferPool::Buffer> buffers(nBuffersHeld);
+    for (auto &buffer : buffers) {
+      buffer = BufferPool::getInstance().acquire();
+      *(volatile uint8_t *)buffer.get() = 1;
+    }
+  });
+
+  Stats &stats = Stats::getInstance();
+  uint64_t nBuffersAcquired = stats._n_buffers_acquired;
+  std::cout << std::fixed << std::setprecision(2)
+            << "posix_memalign rounds per us: " << mallocRate << std::endl
+            << "BufferPool rounds per us: " << poolRate << std::endl
+            << "    Num buffers acquired: " << nBuffersAcquired << std::endl
+            << "    Thread cache hit ratio: " << stats._n_buffers_from_thread_caches * 100.0 / nBuffersAcquired << "%" << std::endl
+            << "    Pool hit ratio: " << (stats._n_buffers_from_thread_caches + stats._n_buffers_from_pool) * 100.0 / nBuffersAcquired << "%" << std::endl
+            << "    Num slabs (huge pages reserved): " << stats._n_buffer_slabs << " (" << stats._n_buffer_slabs_hugetlb << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,181 @@
+/* File: benchmark/chunking_benchmark.cc
+ * Description:
+ *   Throughput and deduplication ratio of fixed-size chunking against
+ *   content-defined chunking (ContentDefinedChunker).
+ *
+ *   Usage: chunking_benchmark [avgChunkSize] [file]
+ *   Without a file, the data is a random buffer followed by a copy of it
+ *   with small insertions and deletions, as in files edited in place. The
+ *   traces replayed by run carry one fingerprint per block and no content,
+ *   so the deduplication ratio can only be measured on real data given as
+ *   a file (e.g., two versions of a disk image concatenated).
+ */
+#include "chunking/chunk_module.h"
+#include "common/config.h"
+
+#include <isa-l_crypto.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint64_t kSyntheticSize = 32 * 1024 * 1024ull;
+  const uint32_t kNumEdits = 1024;
+  // Chunking is repeated until this many bytes are processed
+  const uint64_t kBytesToChunk = 2 * 1024 * 1024 * 1024ull;
+
+  std::vector<uint8_t> generateData()
+  {
+    std::mt19937_64 rng(17);
+    std::vector<uint8_t> base(kSyntheticSize);
+    for (uint64_t i = 0; i < base.size(); i += 8) {
+      uint64_t v = rng();
+      memcpy(&base[i], &v, 8);
+    }
+    // The edited copy inserts or deletes a few bytes at random places
+    std::vector<uint8_t> edited;
+    edited.reserve(base.size() + kNumEdits * 64);
+    std::vector<uint64_t> positions;
+    for (uint32_t i = 0; i < kNumEdits; ++i) {
+      positions.push_back(rng() % base.size());
+    }
+    std::sort(positions.begin(), positions.end());
+    uint64_t last = 0;
+    for (uint64_t pos : positions) {
+      if (pos < last) {
+        // Within the bytes just deleted
+        continue;
+      }
+      edited.insert(edited.end(), base.begin() + last, base.begin() + pos);
+      if (rng() % 2 == 0) {
+        for (uint32_t i = rng() % 64 + 1; i > 0; --i) {
+          edited.push_back(rng());
+        }
+        last = pos;
+      } else {
+        last = std::min(pos + rng() % 64 + 1, (uint64_t)base.size());
+      }
+    }
+    edited.insert(edited.end(), base.begin() + last, base.end());
+
+    std::vector<uint8_t> data(base);
+    data.insert(data.end(), edited.begin(), edited.end());
+    return data;
+  }
+
+  std::vector<uint8_t> readFile(const char *fileName)
+  {
+    FILE *f = fopen(fileName, "rb");
+    if (f == nullptr) {
+      std::cout << "Cannot open " << fileName << std::endl;
+      exit(-1);
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return data;
+  }
+
+  // Chunk boundaries of the whole data, offsets of the chunk ends
+  std::vector<uint32_t> chunkFixed(const std::vector<uint8_t> &data, uint32_t chunkSize)
+  {
+    std::vector<uint32_t> ends;
+    for (uint64_t offset = 0; offset < data.size(); offset += chunkSize) {
+      ends.push_back(std::min(offset + chunkSize, (uint64_t)data.size()));
+    }
+    return ends;
+  }
+
+  std::vector<uint32_t> chunkContentDefined(const std::vector<uint8_t> &data, uint32_t avgSize)
+  {
+    std::vector<uint32_t> ends;
+    ContentDefinedChunker chunker = ChunkModule::getInstance().createContentDefinedChunker(
+        data.data(), data.size(), avgSize);
+    uint32_t offset, len;
+    while (chunker.next(offset, len)) {
+      ends.push_back(offset + len);
+    }
+    return ends;
+  }
+
+  double dedupRatio(const std::vector<uint8_t> &data, const std::vector<uint32_t> &ends)
+  {
+    std::unordered_set<std::string> fingerprints;
+    uint64_t nDupBytes = 0;
+    uint32_t begin = 0;
+    for (uint32_t end : ends) {
+      struct mh_sha1_ctx ctx;
+      uint8_t fingerprint[20];
+      mh_sha1_init(&ctx);
+      mh_sha1_update(&ctx, data.data() + begin, end - begin);
+      mh_sha1_finalize(&ctx, fingerprint);
+      if (!fingerprints.emplace((char*)fingerprint, sizeof(fingerprint)).second) {
+        nDupBytes += end - begin;
+      }
+      begin = end;
+    }
+    return nDupBytes * 100.0 / data.size();
+  }
+
+  template <typename ChunkFunction>
+  double throughput(const std::vector<uint8_t> &data, ChunkFunction chunk, uint64_t &nChunks)
+  {
+    uint64_t nBytes = 0;
+    nChunks = 0;
+    auto begin = std::chrono::steady_clock::now();
+    while (nBytes < kBytesToChunk) {
+      nChunks += chunk().size();
+      nBytes += data.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    return nBytes / us;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t avgSize = argc > 1 ? atoi(argv[1]) : Config::getInstance().getSubchunkSize();
+  std::vector<uint8_t> data = argc > 2 ? readFile(argv[2]) : generateData();
+  if (data.empty() || data.size() > UINT32_MAX) {
+    std::cout << "The data must be from 1 byte to 4 GiB" << std::endl;
+    exit(-1);
+  }
+  std::cout << "Data: " << (argc > 2 ? argv[2] : "synthetic, edited copy of random data")
+            << ", " << data.size() / 1024 << " KiB" << std::endl
+            << "Average chunk size: " << avgSize << std::endl;
+
+  uint64_t nChunks;
+  std::vector<uint32_t> fixedEnds = chunkFixed(data, avgSize);
+  double fixedThroughput = throughput(data, [&]() { return chunkFixed(data, avgSize); }, nChunks);
+  std::vector<uint32_t> cdcEnds = chunkContentDefined(data, avgSize);
+  double cdcThroughput = throughput(data, [&]() { return chunkContentDefined(data, avgSize); }, nChunks);
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "Fixed-size chunking: " << std::endl
+            << "    Throughput (MBytes/s): " << fixedThroughput << std::endl
+            << "    Num chunks: " << fixedEnds.size() << std::endl
+            << "    Dup ratio: " << dedupRatio(data, fixedEnds) << "%" << std::endl
+            << "Content-defined chunking: " << std::endl
+            << "    Throughput (MBytes/s): " << cdcThroughput << std::endl
+            << "    Num chunks: " << cdcEnds.size() << std::endl
+            << "    Avg chunk size: " << data.size() / (double)cdcEnds.size() << std::endl
+            << "    Dup ratio: " << dedupRatio(data, cdcEnds) << "%" << std::endl;
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* File: benchmark/index_benchmark.cc
+ * Description:
+ *   Latency of random LBAIndex and FPIndex lookups with the index on the
+ *   heap against the index on huge pages (see IndexMemory).
+ *
+ *   Usage: index_benchmark [workingSetSizeGiB] [cacheDeviceSizeGiB] [indexPageSize] [numaPolicy]
+ *   numaPolicy is None, Interleave or Partition. The LBA index is filled by
+ *   updates of random lbas, then both indexes are looked up at random, so
+ *   that nearly every lookup touches a bucket that is not in the caches.
+ */
+#include "metadata/index.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumLookups = 4000000;
+
+  struct Result {
+    double nsPerLbaUpdate_;
+    double nsPerLbaLookup_;
+    double nsPerFpLookup_;
+    uint64_t nHits_;
+  };
+
+  std::vector<uint64_t> generateHashes(uint32_t nBuckets, uint32_t nBitsPerKey, uint32_t n, uint32_t seed)
+  {
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> hashes(n);
+    for (auto &hash : hashes) {
+      hash = rng() % ((uint64_t)nBuckets << nBitsPerKey);
+    }
+    return hashes;
+  }
+
+  template <typename Operation>
+  double measure(const std::vector<uint64_t> &hashes, Operation operation)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t hash : hashes) {
+      operation(hash);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() * 1.0 / hashes.size();
+  }
+
+  Result run()
+  {
+    Config &config = Config::getInstance();
+    Result result{};
+    std::shared_ptr<FPIndex> fpIndex = std::make_shared<FPIndex>();
+    std::unique_ptr<LBAIndex> lbaIndex = std::make_unique<LBAIndex>(fpIndex);
+
+    std::vector<uint64_t> lbaHashes = generateHashes(config.getnLbaBuckets(),
+        config.getnBitsPerLbaSignature(), kNumLookups, 1);
+    std::vector<uint64_t> fpHashes = generateHashes(config.getnFpBuckets(),
+        config.getnBitsPerFpSignature(), kNumLookups, 2);
+
+    result.nsPerLbaUpdate_ = measure(lbaHashes, [&](uint64_t lbaHash) {
+      lbaIndex->update(lbaHash, lbaHash);
+    });
+    uint64_t fpHash;
+    result.nsPerLbaLookup_ = measure(lbaHashes, [&](uint64_t lbaHash) {
+      result.nHits_ += lbaIndex->lookup(lbaHash, fpHash);
+    });
+    uint32_t nSubchunks;
+    uint64_t cachedataLocation, metadataLocation;
+    result.nsPerFpLookup_ = measure(fpHashes, [&](uint64_t hash) {
+      result.nHits_ += fpIndex->lookup(hash, nSubchunks, cachedataLocation, metadataLocation);
+    });
+    return result;
+  }
+
+  void print(const char *name, const Result &result)
+  {
+    std::cout << std::fixed << std::setprecision(2) << name << ": " << std::endl
+              << "    LBA index update (ns): " << result.nsPerLbaUpdate_ << std::endl
+              << "    LBA index lookup (ns): " << result.nsPerLbaLookup_ << std::endl
+              << "    FP index lookup (ns): " << result.nsPerFpLookup_ << std::endl
+              << "    Num hits: " << result.nHits_ << std::endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Config &config = Config::getInstance();
+  config.setWorkingSetSize((argc > 1 ? atoll(argv[1]) : 256) * 1024 * 1024 * 1024ull);
+  config.setCacheDeviceSize((argc > 2 ? atoll(argv[2]) : 64) * 1024 * 1024 * 1024ull);
+  uint64_t pageSize = argc > 3 ? atoll(argv[3]) : 2 * 1024 * 1024ull;
+  IndexNumaPolicyEnum numaPolicy = tIndexNumaNone;
+  if (argc > 4 && strcmp(argv[4], "Interleave") == 0) {
+    numaPolicy = tIndexNumaInterleave;
+  } else if (argc > 4 && strcmp(argv[4], "Partition") == 0) {
+    numaPolicy = tIndexNumaPartition;
+  }
+  // Every lba has its own slot, and evictions do not touch the reference counts
+  config.setLBAAmplifier(0);
+  config.setCachePolicyForFPIndex(tLRU);
+  std::cout << "LBA buckets: " << config.getnLbaBuckets()
+            << ", FP buckets: " << config.getnFpBuckets()
+            << ", NUMA nodes: " << IndexMemory::getnNodes() << std::endl;
+
+  Result heap = run();
+  config.setIndexPageSize(pageSize);
+  config.setIndexNumaPolicy(numaPolicy);
+  Result hugePages = run();
+
+  print("Heap", heap);
+  print("Index pages", hugePages);
+  std::cout << "    Index page size: " << pageSize << std::endl
+            << "    Num bytes mapped (huge pages reserved): " << Stats::getInstance()._n_index_bytes
+            << " (" << Stats::getInstance()._n_index_bytes_hugetlb << ")" << std::endl;
+  return 0;
+}
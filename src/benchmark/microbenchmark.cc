@@ -0,0 +1,392 @@
+/* File: benchmark/microbenchmark.cc
+ * Description:
+ *   Microbenchmarks of the stages of the data path, each measured alone in
+ *   ns per operation: bitmap bit fields, LBA and FP bucket lookups and
+ *   updates, allocation and promotion of each cache policy, the sketch
+ *   reference counter, fingerprinting, LBA hashing, and LZ4.
+ *
+ *   Usage: microbenchmark [--benchmark_filter=substring]
+ *            [--benchmark_out=file.json] [--benchmark_min_time=seconds]
+ *   A benchmark is run with enough operations to last the minimum time,
+ *   then repeated; the median of the repetitions is reported. The JSON
+ *   output lists the benchmarks in a fixed order with fixed fields, so
+ *   that two runs can be compared for regressions.
+ *
+ *   Buckets are standalone, with the slot and signature widths the indexes
+ *   would have for the configuration, and are kept full so that updates
+ *   and allocations evict as in a warm cache. An allocation is followed by
+ *   refilling the slots it returns.
+ */
+#include "metadata/bitmap.h"
+#include "metadata/bucket.h"
+#include "metadata/reference_counter.h"
+#include "metadata/cache_policies/lru.h"
+#include "metadata/cache_policies/bucket_aware_lru.h"
+#include "metadata/cache_policies/least_reference_count.h"
+#include "common/common.h"
+#include "common/config.h"
+
+#include "lz4.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumRepetitions = 5;
+  // Operations cycle through this many precomputed arguments
+  const uint32_t kNumArguments = 4096;
+
+  // Keep a value computed by the benchmark from being optimized out
+  template <typename T>
+  inline void doNotOptimize(const T &value)
+  {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  struct Benchmark {
+    std::string name_;
+    std::function<void(uint64_t nOps)> run_;
+  };
+
+  struct Result {
+    std::string name_;
+    uint64_t nOps_;
+    double nsPerOp_, nsPerOpMin_, nsPerOpMax_;
+  };
+
+  double measure(const Benchmark &benchmark, uint64_t nOps)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    benchmark.run_(nOps);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count();
+  }
+
+  Result run(const Benchmark &benchmark, double minTime)
+  {
+    // Grow the number of operations until a run lasts the minimum time
+    uint64_t nOps = 1;
+    while (true) {
+      double ns = measure(benchmark, nOps);
+      if (ns >= minTime * 1e9 || nOps >= (1ull << 40)) {
+        break;
+      }
+      double factor = ns > 0 ? minTime * 1e9 * 1.2 / ns : 100;
+      nOps = std::max<uint64_t>(nOps * 2, nOps * std::min(factor, 100.0));
+    }
+
+    std::vector<double> nsPerOps;
+    for (uint32_t i = 0; i < kNumRepetitions; ++i) {
+      nsPerOps.push_back(measure(benchmark, nOps) / nOps);
+    }
+    std::sort(nsPerOps.begin(), nsPerOps.end());
+    return {benchmark.name_, nOps, nsPerOps[kNumRepetitions / 2], nsPerOps.front(), nsPerOps.back()};
+  }
+
+  std::vector<uint32_t> randomArguments(uint32_t bound, uint32_t seed)
+  {
+    std::mt19937 rng(seed);
+    std::vector<uint32_t> arguments(kNumArguments);
+    for (auto &argument : arguments) {
+      argument = rng() % bound;
+    }
+    return arguments;
+  }
+
+  // A bucket over its own memory, full of distinct keys
+  template <typename BucketType>
+  struct StandaloneBucket {
+    StandaloneBucket(uint32_t nBitsPerKey, uint32_t nBitsPerValue, uint32_t nSlots,
+        std::unique_ptr<CachePolicy> cachePolicy) :
+      data_((nBitsPerKey + nBitsPerValue) * nSlots / 8 + 8),
+      valid_(nSlots / 8 + 8),
+      cachePolicy_(std::move(cachePolicy))
+    {
+      bucket_ = std::make_unique<BucketType>(nBitsPerKey, nBitsPerValue, nSlots,
+          data_.data(), valid_.data(), cachePolicy_.get(), 0);
+      for (uint32_t slotId = 0; slotId < nSlots; ++slotId) {
+        fill(slotId, slotId);
+        // Every slot is on the list of the LRU policy
+        bucket_->cachePolicyExecutor_->promote(slotId, 1);
+      }
+    }
+
+    void fill(uint32_t slotId, uint32_t key)
+    {
+      // Bitmap fields are not masked on store
+      bucket_->setKey(slotId, key & ((1u << bucket_->nBitsPerKey_) - 1));
+      bucket_->setValue(slotId, key & ((1u << std::min(bucket_->nBitsPerValue_, 31u)) - 1));
+      bucket_->setValid(slotId);
+    }
+
+    std::vector<uint8_t> data_, valid_;
+    std::unique_ptr<CachePolicy> cachePolicy_;
+    std::unique_ptr<BucketType> bucket_;
+  };
+
+  std::unique_ptr<CachePolicy> createCachePolicy(const std::string &name)
+  {
+    if (name == "lru") {
+      return std::make_unique<LRU>(1);
+    } else if (name == "bucket_aware_lru") {
+      return std::make_unique<BucketAwareLRU>();
+    }
+    return std::make_unique<LeastReferenceCount>();
+  }
+
+  void addBitmapBenchmarks(std::vector<Benchmark> &benchmarks)
+  {
+    // Fields of the width of a signature at any bit offset
+    const uint32_t nBitsPerField = Config::getInstance().getnBitsPerFpSignature();
+    auto data = std::make_shared<std::vector<uint8_t>>(64 * 1024 + 8);
+    auto offsets = std::make_shared<std::vector<uint32_t>>(
+        randomArguments(64 * 1024 * 8 - 32, 1));
+    benchmarks.push_back({"bitmap/getBits", [=](uint64_t nOps) {
+      Bitmap::Manipulator bitmap(data->data());
+      for (uint64_t i = 0; i < nOps; ++i) {
+        uint32_t b = (*offsets)[i % kNumArguments];
+        doNotOptimize(bitmap.getBits(b, b + nBitsPerField));
+      }
+    }});
+    benchmarks.push_back({"bitmap/storeBits", [=](uint64_t nOps) {
+      Bitmap::Manipulator bitmap(data->data());
+      for (uint64_t i = 0; i < nOps; ++i) {
+        uint32_t b = (*offsets)[i % kNumArguments];
+        bitmap.storeBits(b, b + nBitsPerField, i & ((1u << nBitsPerField) - 1));
+      }
+      doNotOptimize(data->front());
+    }});
+  }
+
+  void addBucketBenchmarks(std::vector<Benchmark> &benchmarks)
+  {
+    Config &config = Config::getInstance();
+    const uint32_t nLbaSlots = config.getnLBASlotsPerBucket();
+    const uint32_t nFpSlots = config.getnFPSlotsPerBucket();
+    // The policies the indexes take with the compact cache policy (ACDC)
+    auto lbaBucket = std::make_shared<StandaloneBucket<LBABucket>>(
+        config.getnBitsPerLbaSignature(), config.getnBitsPerFpSignature() + config.getnBitsPerFpBucketId(),
+        nLbaSlots, createCachePolicy("bucket_aware_lru"));
+    auto fpBucket = std::make_shared<StandaloneBucket<FPBucket>>(
+        config.getnBitsPerFpSignature(), 4, nFpSlots, createCachePolicy("least_reference_count"));
+    // Half of the signatures looked up are in the bucket
+    auto lbaSignatures = std::make_shared<std::vector<uint32_t>>(randomArguments(nLbaSlots * 2, 2));
+    auto fpSignatures = std::make_shared<std::vector<uint32_t>>(randomArguments(nFpSlots * 2, 3));
+    auto nSubchunks = std::make_shared<std::vector<uint32_t>>(randomArguments(4, 4));
+
+    benchmarks.push_back({"lba_bucket/lookup", [=](uint64_t nOps) {
+      uint64_t fpHash;
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(lbaBucket->bucket_->lookup((*lbaSignatures)[i % kNumArguments], fpHash));
+      }
+    }});
+    benchmarks.push_back({"lba_bucket/update", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        uint32_t signature = (*lbaSignatures)[i % kNumArguments];
+        doNotOptimize(lbaBucket->bucket_->update(signature, signature + i % 2, nullptr));
+      }
+    }});
+    benchmarks.push_back({"fp_bucket/lookup", [=](uint64_t nOps) {
+      uint32_t nSlotsOccupied;
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(fpBucket->bucket_->lookup((*fpSignatures)[i % kNumArguments], nSlotsOccupied));
+      }
+    }});
+    benchmarks.push_back({"fp_bucket/update", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(fpBucket->bucket_->update((*fpSignatures)[i % kNumArguments],
+              (*nSubchunks)[i % kNumArguments] + 1));
+      }
+    }});
+  }
+
+  void addCachePolicyBenchmarks(std::vector<Benchmark> &benchmarks)
+  {
+    Config &config = Config::getInstance();
+    const uint32_t nSlots = config.getnFPSlotsPerBucket();
+    for (std::string name : {"lru", "bucket_aware_lru", "least_reference_count"}) {
+      auto bucket = std::make_shared<StandaloneBucket<FPBucket>>(
+          config.getnBitsPerFpSignature(), 4, nSlots, createCachePolicy(name));
+      auto slotIds = std::make_shared<std::vector<uint32_t>>(randomArguments(nSlots, 5));
+      benchmarks.push_back({"cache_policy/" + name + "/allocate", [=](uint64_t nOps) {
+        for (uint64_t i = 0; i < nOps; ++i) {
+          uint32_t slotId = bucket->bucket_->cachePolicyExecutor_->allocate(1, 0);
+          bucket->fill(slotId, nSlots + i % nSlots);
+        }
+      }});
+      benchmarks.push_back({"cache_policy/" + name + "/promote", [=](uint64_t nOps) {
+        for (uint64_t i = 0; i < nOps; ++i) {
+          bucket->bucket_->cachePolicyExecutor_->promote((*slotIds)[i % kNumArguments], 1);
+        }
+      }});
+    }
+  }
+
+  void addSketchBenchmarks(std::vector<Benchmark> &benchmarks)
+  {
+    auto keys = std::make_shared<std::vector<uint64_t>>(kNumArguments);
+    std::mt19937_64 rng(6);
+    for (auto &key : *keys) {
+      key = rng();
+    }
+    // Each key is referenced once, so that queries find counts. A reference
+    // is measured with the dereference undoing it, so that the counts and
+    // their overflow map do not grow with the number of operations
+    for (uint64_t key : *keys) {
+      SketchReferenceCounter::getInstance().reference(key);
+    }
+    benchmarks.push_back({"sketch/query", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(SketchReferenceCounter::getInstance().query((*keys)[i % kNumArguments]));
+      }
+    }});
+    benchmarks.push_back({"sketch/reference_dereference", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        uint64_t key = (*keys)[i % kNumArguments];
+        SketchReferenceCounter::getInstance().reference(key);
+        SketchReferenceCounter::getInstance().dereference(key);
+      }
+    }});
+  }
+
+  void addChunkBenchmarks(std::vector<Benchmark> &benchmarks)
+  {
+    const uint32_t chunkSize = Config::getInstance().getChunkSize();
+    // Half random and half repeated bytes, about as compressible as the
+    // data of the synthetic traces
+    auto data = std::make_shared<std::vector<uint8_t>>(chunkSize);
+    std::mt19937 rng(7);
+    for (uint32_t i = 0; i < chunkSize; ++i) {
+      (*data)[i] = i < chunkSize / 2 ? rng() : (*data)[i % 64];
+    }
+    auto compressed = std::make_shared<std::vector<char>>(LZ4_compressBound(chunkSize));
+    auto decompressed = std::make_shared<std::vector<char>>(chunkSize);
+    int compressedLen = LZ4_compress_default((const char *)data->data(), compressed->data(),
+        chunkSize, compressed->size());
+
+    benchmarks.push_back({"chunk/computeFingerprint", [=](uint64_t nOps) {
+      Chunk chunk;
+      chunk.addr_ = 0;
+      chunk.len_ = chunkSize;
+      chunk.buf_ = data->data();
+      for (uint64_t i = 0; i < nOps; ++i) {
+        chunk.computeFingerprint();
+        doNotOptimize(chunk.fingerprint_[0]);
+      }
+    }});
+    benchmarks.push_back({"chunk/computeLBAHash", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(Chunk::computeLBAHash(i * chunkSize));
+      }
+    }});
+    benchmarks.push_back({"lz4/compress", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(LZ4_compress_default((const char *)data->data(), compressed->data(),
+              chunkSize, compressed->size()));
+      }
+    }});
+    benchmarks.push_back({"lz4/decompress", [=](uint64_t nOps) {
+      for (uint64_t i = 0; i < nOps; ++i) {
+        doNotOptimize(LZ4_decompress_safe(compressed->data(), decompressed->data(),
+              compressedLen, chunkSize));
+      }
+    }});
+  }
+
+  const char *getVariant()
+  {
+#if defined(DLRU)
+    return "DLRU";
+#elif defined(DARC)
+    return "DARC";
+#elif defined(CDARC)
+    return "CDARC";
+#elif defined(BUCKETDLRU)
+    return "BUCKETDLRU";
+#else
+    return "ACDC";
+#endif
+  }
+
+  void writeJson(FILE *f, const std::vector<Result> &results)
+  {
+    Config &config = Config::getInstance();
+    fprintf(f, "{\n  \"context\": {\n");
+    fprintf(f, "    \"variant\": \"%s\",\n", getVariant());
+    fprintf(f, "    \"chunk_size\": %u,\n", config.getChunkSize());
+    fprintf(f, "    \"lba_slots_per_bucket\": %u,\n", config.getnLBASlotsPerBucket());
+    fprintf(f, "    \"fp_slots_per_bucket\": %u,\n", config.getnFPSlotsPerBucket());
+    fprintf(f, "    \"repetitions\": %u\n  },\n  \"benchmarks\": [\n", kNumRepetitions);
+    for (uint32_t i = 0; i < results.size(); ++i) {
+      const Result &result = results[i];
+      fprintf(f, "    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.3f, "
+          "\"ns_per_op_min\": %.3f, \"ns_per_op_max\": %.3f}%s\n",
+          result.name_.c_str(), result.nOps_, result.nsPerOp_,
+          result.nsPerOpMin_, result.nsPerOpMax_, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter, outFileName;
+  double minTime = 0.5;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+      filter = argv[i] + 19;
+    } else if (strncmp(argv[i], "--benchmark_out=", 16) == 0) {
+      outFileName = argv[i] + 16;
+    } else if (strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+      minTime = atof(argv[i] + 21);
+    } else {
+      printf("Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  Config &config = Config::getInstance();
+  // Fingerprints are computed from the data, and evictions write nothing back
+  config.enableTraceReplay(false);
+  config.setCacheMode(tWriteThrough);
+
+  std::vector<Benchmark> benchmarks;
+  addBitmapBenchmarks(benchmarks);
+  addBucketBenchmarks(benchmarks);
+  addCachePolicyBenchmarks(benchmarks);
+  addSketchBenchmarks(benchmarks);
+  addChunkBenchmarks(benchmarks);
+
+  std::vector<Result> results;
+  printf("%-44s %14s %12s %12s %12s\n", "Benchmark", "Iterations", "ns/op", "min", "max");
+  for (const Benchmark &benchmark : benchmarks) {
+    if (benchmark.name_.find(filter) == std::string::npos) {
+      continue;
+    }
+    results.push_back(run(benchmark, minTime));
+    const Result &result = results.back();
+    printf("%-44s %14lu %12.2f %12.2f %12.2f\n", result.name_.c_str(), result.nOps_,
+        result.nsPerOp_, result.nsPerOpMin_, result.nsPerOpMax_);
+  }
+
+  if (!outFileName.empty()) {
+    FILE *f = fopen(outFileName.c_str(), "w");
+    if (f == nullptr) {
+      printf("Cannot open %s\n", outFileName.c_str());
+      return 1;
+    }
+    writeJson(f, results);
+    fclose(f);
+  }
+  return 0;
+}
@@ -1,12 +1,18 @@
 #include <fstream>
+#include <iterator>
+#include <string>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include "utils/utils.h"
 #include "utils/gen_zipf.h"
 #include "utils/cJSON.h"
+#include "utils/partitioned_workers.h"
 #include "austere_cache/austere_cache.h"
+#include "benchmark/workload.h"
+#include "io/buffer_pool.h"
 #include "metadata/cachededup/cdarc_fpindex.h"
 #include "metadata/cachededup/darc_fpindex.h"
 
@@ -22,32 +28,101 @@
 #include <set>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 #include <malloc.h>
 
-struct Request {
-  Request() { 
-    address_ = 0;
-    length_ = 0;
-    isRead_ = 0;
-    compressionLength_ = 0;
-  }
+namespace cache {
 
-  uint64_t address_;
-  int length_;
-  bool isRead_;
-  uint32_t compressionLength_;
-  char sha1_[42];
-};
+  // How requests of the trace are sent to the cache
+  enum LoadModeEnum {
+    tLoadReplay,     // As fast as the threads can take them
+    tLoadClosedLoop, // Keeping a number of requests outstanding
+    tLoadOpenLoop    // At Poisson arrivals of a target rate
+  };
 
-namespace cache {
+  // Latencies in ns counted in buckets of 1/32 of a power of two, so that
+  // a run of any length takes the same memory; a percentile is off by at
+  // most 1/32. Threads add to it concurrently.
+  class LatencyHistogram {
+    public:
+      LatencyHistogram() : nSamples_(0), sum_(0), max_(0) {
+        for (auto &count : counts_) {
+          count.store(0, std::memory_order_relaxed);
+        }
+      }
+
+      void add(uint64_t ns) {
+        counts_[getBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        nSamples_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+      }
+
+      uint64_t getnSamples() { return nSamples_.load(); }
+      double getMean() { return nSamples_ == 0 ? 0 : (double)sum_ / nSamples_; }
+      uint64_t getMax() { return max_.load(); }
+
+      // Lower bound of the bucket holding the p-quantile
+      uint64_t getPercentile(double p) {
+        uint64_t rank = std::max<uint64_t>(std::ceil(p * nSamples_), 1), n = 0;
+        for (uint32_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+          n += counts_[bucket].load(std::memory_order_relaxed);
+          if (n >= rank) {
+            return getValue(bucket);
+          }
+        }
+        return getMax();
+      }
+
+    private:
+      static const uint32_t kNumSubBucketBits = 5;
+      static const uint32_t kNumSubBuckets = 1u << kNumSubBucketBits;
+      static const uint32_t kNumBuckets = (64 - kNumSubBucketBits + 1) * kNumSubBuckets;
+
+      // Values below 2 * kNumSubBuckets have a bucket each
+      static uint32_t getBucket(uint64_t ns) {
+        if (ns < 2 * kNumSubBuckets) {
+          return ns;
+        }
+        uint32_t shift = 63 - __builtin_clzll(ns) - kNumSubBucketBits;
+        return (shift + 1) * kNumSubBuckets + (ns >> shift) - kNumSubBuckets;
+      }
+
+      static uint64_t getValue(uint32_t bucket) {
+        if (bucket < 2 * kNumSubBuckets) {
+          return bucket;
+        }
+        uint32_t shift = bucket / kNumSubBuckets - 1;
+        return (uint64_t)(bucket % kNumSubBuckets + kNumSubBuckets) << shift;
+      }
+
+      std::atomic<uint64_t> counts_[kNumBuckets];
+      std::atomic<uint64_t> nSamples_, sum_, max_;
+  };
 
   class RunSystem {
     public:
+      // A request on its way through the cache
+      struct InFlight {
+        uint64_t id_;
+        Request req_;
+        ChunkOrdering::Ticket ticket_;
+        std::chrono::steady_clock::time_point arrival_;
+      };
+
       RunSystem() {
         genzipf::rand_val(2);
+        loadMode_ = tLoadReplay;
+        nWarmupRequests_ = 0;
+        isSynthetic_ = false;
+        nextReq_ = 0;
         compressedChunks_ = nullptr;
         originalChunks_ = nullptr;
+        config_ = nullptr;
       }
 
       void clear() {
@@ -73,6 +148,8 @@ namespace cache {
       }
 
       ~RunSystem() {
+        AustereCache_.reset();
+        cJSON_Delete(config_);
       }
 
 
@@ -82,20 +159,19 @@ namespace cache {
         Config::getInstance().setPrimaryDeviceSize(300LL * 1024 * 1024 * 1024);
         chunkSize_ = 32768;
 
-        char source[2000 + 1];
-        FILE *fp = fopen(argv[1], "r");
-        if (fp != NULL) {
-          size_t newLen = fread(source, sizeof(char), 1001, fp);
-          if ( ferror( fp ) != 0 ) {
-            fputs("Error reading file", stderr);
-          } else {
-            source[newLen++] = '\0'; /* Just to be safe. */
-          }
-
-          fclose(fp);
+        // Read the whole configuration, whatever its size
+        std::ifstream file(argv[1]);
+        if (!file) {
+          std::cout << "Cannot open configuration " << argv[1] << "!" << std::endl;
+          exit(-1);
         }
+        std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-        cJSON *config = cJSON_Parse(source);
+        cJSON *config = cJSON_Parse(source.c_str());
+        if (config == nullptr || config->child == nullptr || config->child->next == nullptr) {
+          std::cout << "Cannot parse configuration " << argv[1] << "!" << std::endl;
+          exit(-1);
+        }
         for (cJSON *param = config->child->next->child; param != nullptr; param = param->next) {
           char *name = param->string;
           char *valuestring = param->valuestring;
@@ -104,8 +180,56 @@ namespace cache {
           // 1. Disk related configurations
           if (strcmp(name, "primaryDeviceName") == 0) {
             Config::getInstance().setPrimaryDeviceName(valuestring);
+          } else if (strcmp(name, "primaryDeviceNames") == 0) { // One volume per primary device
+            cJSON *deviceName = param->child;
+            Config::getInstance().setPrimaryDeviceName(deviceName->valuestring);
+            for (deviceName = deviceName->next; deviceName != nullptr; deviceName = deviceName->next) {
+              Config::getInstance().addPrimaryDeviceName(deviceName->valuestring);
+            }
+          } else if (strcmp(name, "volumeDirtyQuota") == 0) {
+            Config::getInstance().setVolumeDirtyQuota(valuell);
+          } else if (strcmp(name, "volumeTenants") == 0) { // Tenant of each volume
+            std::vector<uint32_t> tenants;
+            for (cJSON *tenant = param->child; tenant != nullptr; tenant = tenant->next) {
+              tenants.push_back((uint32_t)tenant->valuedouble);
+            }
+            Config::getInstance().setVolumeTenants(tenants);
+          } else if (strcmp(name, "tenantShares") == 0) { // Percent of the FP index space per tenant
+            std::vector<uint32_t> shares;
+            for (cJSON *share = param->child; share != nullptr; share = share->next) {
+              shares.push_back((uint32_t)share->valuedouble);
+            }
+            Config::getInstance().setTenantShares(shares);
+          } else if (strcmp(name, "tenantReservations") == 0) {
+            std::vector<uint32_t> reservations;
+            for (cJSON *reservation = param->child; reservation != nullptr; reservation = reservation->next) {
+              reservations.push_back((uint32_t)reservation->valuedouble);
+            }
+            Config::getInstance().setTenantReservations(reservations);
+          } else if (strcmp(name, "sequentialCutoff") == 0) { // Sequential streams of this many bytes bypass the cache
+            Config::getInstance().setSequentialCutoff(valuell);
+          } else if (strcmp(name, "nSequentialStreams") == 0) {
+            Config::getInstance().setnSequentialStreams(valuell);
+          } else if (strcmp(name, "admissionThreshold") == 0) { // Admit read misses from this access frequency on
+            Config::getInstance().setAdmissionThreshold(valuell);
+          } else if (strcmp(name, "readAheadChunks") == 0) { // Read ahead of sequential read misses
+            Config::getInstance().setReadAheadChunks(valuell);
+          } else if (strcmp(name, "readAheadBufferSize") == 0) {
+            Config::getInstance().setReadAheadBufferSize(valuell);
+          } else if (strcmp(name, "writeCoalescingBufferSize") == 0) { // Merge of writes smaller than a chunk
+            Config::getInstance().setWriteCoalescingBufferSize(valuell);
           } else if (strcmp(name, "cacheDeviceName") == 0) {
             Config::getInstance().setCacheDeviceName(valuestring);
+          } else if (strcmp(name, "cacheDeviceNames") == 0) { // Stripe the cache over several devices
+            cJSON *deviceName = param->child;
+            Config::getInstance().setCacheDeviceName(deviceName->valuestring);
+            for (deviceName = deviceName->next; deviceName != nullptr; deviceName = deviceName->next) {
+              Config::getInstance().addCacheDeviceName(deviceName->valuestring);
+            }
+          } else if (strcmp(name, "metadataDeviceName") == 0) {
+            Config::getInstance().setMetadataDeviceName(valuestring);
+          } else if (strcmp(name, "cacheStripeSize") == 0) {
+            Config::getInstance().setCacheStripeSize(valuell);
           } else if (strcmp(name, "primaryDeviceSize") == 0) {
             Config::getInstance().setPrimaryDeviceSize(valuell);
           } else if (strcmp(name, "cacheDeviceSize") == 0) {
@@ -128,6 +252,16 @@ namespace cache {
             Config::getInstance().setnBitsPerLbaSignature(valuell);
           } else if (strcmp(name, "lbaAmplifier") == 0) {
             Config::getInstance().setLBAAmplifier(valuell);
+          } else if (strcmp(name, "indexPageSize") == 0) { // Huge pages for the indexes and sketches
+            Config::getInstance().setIndexPageSize(valuell);
+          } else if (strcmp(name, "indexNumaPolicy") == 0) { // Placement of the index over NUMA nodes
+            if (strcmp(valuestring, "Interleave") == 0) {
+              Config::getInstance().setIndexNumaPolicy(IndexNumaPolicyEnum::tIndexNumaInterleave);
+            } else if (strcmp(valuestring, "Partition") == 0) {
+              Config::getInstance().setIndexNumaPolicy(IndexNumaPolicyEnum::tIndexNumaPartition);
+            } else if (strcmp(valuestring, "None") == 0) {
+              Config::getInstance().setIndexNumaPolicy(IndexNumaPolicyEnum::tIndexNumaNone);
+            }
           // Configurations for Techniques (Design)
           } else if (strcmp(name, "syntheticCompression") == 0) { // Compression
             Config::getInstance().enableSynthenticCompression(valuell);
@@ -140,14 +274,32 @@ namespace cache {
             Config::getInstance().enableMultiThreading(valuell);
           } else if (strcmp(name, "nThreads") == 0) {
             Config::getInstance().setnThreads(valuell);
+          } else if (strcmp(name, "sharedNothing") == 0) { // Threads owning partitions of the LBA index
+            Config::getInstance().enableSharedNothing(valuell);
           } else if (strcmp(name, "weuSize") == 0) { // Write Buffer
             Config::getInstance().setWeuSize(valuell);
+          } else if (strcmp(name, "recovery") == 0) { // Crash Recovery
+            Config::getInstance().enableRecovery(valuell);
+          } else if (strcmp(name, "logStructuredLayout") == 0) { // Append cached data to a log (ACDC)
+            Config::getInstance().enableLogStructuredLayout(valuell);
+          } else if (strcmp(name, "segmentSize") == 0) {
+            Config::getInstance().setSegmentSize(valuell);
+          } else if (strcmp(name, "logOverProvisioning") == 0) { // Percentage of extra log segments
+            Config::getInstance().setLogOverProvisioning(valuell);
           } else if (strcmp(name, "cacheMode") == 0) { // Write Back and Write Through
             if (strcmp(valuestring, "WriteThrough") == 0) {
               Config::getInstance().setCacheMode(CacheModeEnum::tWriteThrough);
             } else if (strcmp(valuestring, "WriteBack") == 0) {
               Config::getInstance().setCacheMode(CacheModeEnum::tWriteBack);
             }
+          } else if (strcmp(name, "nFlushThreads") == 0) {
+            Config::getInstance().setnFlushThreads(valuell);
+          } else if (strcmp(name, "dirtyHighWatermark") == 0) {
+            Config::getInstance().setDirtyHighWatermark(valuell);
+          } else if (strcmp(name, "dirtyLowWatermark") == 0) {
+            Config::getInstance().setDirtyLowWatermark(valuell);
+          } else if (strcmp(name, "stagingBufferSize") == 0) {
+            Config::getInstance().setStagingBufferSize(valuell);
           // Configurations related to trace replay
           } else if (strcmp(name, "directIO") == 0) {
             Config::getInstance().enableDirectIO(valuell);
@@ -155,6 +307,56 @@ namespace cache {
             Config::getInstance().enableTraceReplay(valuell);
           } else if (strcmp(name, "fakeIO") == 0) {
             Config::getInstance().enableFakeIO(valuell);
+          // Configurations of the load generator
+          } else if (strcmp(name, "loadMode") == 0) {
+            if (strcmp(valuestring, "ClosedLoop") == 0) {
+              loadMode_ = tLoadClosedLoop;
+            } else if (strcmp(valuestring, "OpenLoop") == 0) {
+              loadMode_ = tLoadOpenLoop;
+            } else if (strcmp(valuestring, "Replay") == 0) {
+              loadMode_ = tLoadReplay;
+            }
+          } else if (strcmp(name, "queueDepth") == 0 // Outstanding requests (closed loop)
+              || strcmp(name, "targetIops") == 0) { // Mean arrival rate (open loop)
+            // A number, or a list of them to sweep
+            loadLevels_.clear();
+            if (cJSON_IsArray(param)) {
+              for (cJSON *level = param->child; level != nullptr; level = level->next) {
+                loadLevels_.push_back((uint64_t)level->valuedouble);
+              }
+            } else {
+              loadLevels_.push_back(valuell);
+            }
+          } else if (strcmp(name, "warmupRequests") == 0) { // Left out of the latencies and throughput
+            nWarmupRequests_ = valuell;
+          // Configurations of the synthetic workload, generated instead of read from the trace
+          } else if (strcmp(name, "syntheticWorkload") == 0) {
+            isSynthetic_ = true;
+            if (strcmp(valuestring, "HotCold") == 0) {
+              workloadParameters_.pattern_ = tWorkloadHotCold;
+            } else if (strcmp(valuestring, "Sequential") == 0) {
+              workloadParameters_.pattern_ = tWorkloadSequential;
+            } else if (strcmp(valuestring, "Zipf") == 0) {
+              workloadParameters_.pattern_ = tWorkloadZipf;
+            } else if (strcmp(valuestring, "Uniform") == 0) {
+              workloadParameters_.pattern_ = tWorkloadUniform;
+            }
+          } else if (strcmp(name, "syntheticRequests") == 0) {
+            workloadParameters_.nRequests_ = valuell;
+          } else if (strcmp(name, "syntheticRunLength") == 0) { // Chunks accessed in a row
+            workloadParameters_.runLength_ = valuell;
+          } else if (strcmp(name, "readWriteRatio") == 0) { // Reads per write
+            workloadParameters_.readWriteRatio_ = param->valuedouble;
+          } else if (strcmp(name, "ioDupRatio") == 0) {
+            workloadParameters_.ioDupRatio_ = param->valuedouble;
+          } else if (strcmp(name, "hotRatio") == 0) {
+            workloadParameters_.hotRatio_ = param->valuedouble;
+          } else if (strcmp(name, "zipfAlpha") == 0) {
+            workloadParameters_.zipfAlpha_ = param->valuedouble;
+          } else if (strcmp(name, "syntheticCompressibility") == 0) { // Mean compressibility
+            workloadParameters_.compressibility_ = param->valuedouble;
+          } else if (strcmp(name, "syntheticSeed") == 0) {
+            workloadParameters_.seed_ = valuell;
           }
         }
 
@@ -165,21 +367,37 @@ namespace cache {
         printf("cache device size: %" PRId64 " MiB\n", Config::getInstance().getCacheDeviceSize() / 1024 / 1024);
         printf("primary device size: %" PRId64 " GiB\n", Config::getInstance().getPrimaryDeviceSize() / 1024 / 1024 / 1024);
         printf("woring set size: %" PRId64 " MiB\n", Config::getInstance().getWorkingSetSize() / 1024 / 1024);
-        AustereCache_ = std::make_unique<AustereCache>();
-        
+        // Under a load, each level runs on a cache of its own (see runLevel)
+        if (loadMode_ == tLoadReplay) {
+          AustereCache_ = std::make_unique<AustereCache>();
+        }
 
-        assert(readFIUTrace(config->child->valuestring) == 0);
-        cJSON_Delete(config);
+        if (isSynthetic_) {
+          workloadParameters_.workingSetSize_ = Config::getInstance().getWorkingSetSize();
+          workloadParameters_.primaryDeviceSize_ = Config::getInstance().getPrimaryDeviceSize();
+          workloadParameters_.chunkSize_ = chunkSize_;
+          workload_ = std::make_unique<SyntheticWorkload>(workloadParameters_);
+          printf("synthetic workload: %" PRIu64 " requests\n", workload_->getnRequests());
+        } else {
+          assert(readFIUTrace(config->child->valuestring) == 0);
+        }
+        // Config points to the device names in it, and the caches of the
+        // load levels are created after parsing
+        config_ = config;
       }
 
 
       /**
-       * Duplicate 40 bytes to chunkSize_ 
+       * Duplicate the hex string of the fingerprint (40 bytes) to chunkSize_
        */
-      void memoryRepeat(char* chunkData, char* fingerprint) {
+      void memoryRepeat(char* chunkData, const uint8_t* fingerprint) {
+        static const char kHexDigits[] = "0123456789abcdef";
         int offset = 40;
         int size = 40;
-        memcpy(chunkData, fingerprint, 40);
+        for (int i = 0; i < 20; ++i) {
+          chunkData[2 * i] = kHexDigits[fingerprint[i] >> 4];
+          chunkData[2 * i + 1] = kHexDigits[fingerprint[i] & 0xf];
+        }
         for ( ; offset + size < chunkSize_; size <<= 1, offset <<= 1) {
           memcpy(chunkData + offset, chunkData, size);
         } 
@@ -192,51 +410,73 @@ namespace cache {
       int readFIUTrace(char* fileName) {
         FILE *f = fopen(fileName, "r");
         char op[2];
-        const int chunkSize = Config::getInstance().getChunkSize();
+        char sha1[42];
 
-        int chunk_id, length;
         assert(f != nullptr);
         Request req;
         static uint64_t cnt = 0;
 
-        double compressibility;
-
-        while (fscanf(f, "%lu %d %s %s %lf", &req.address_, &req.length_, op, req.sha1_, &compressibility) != -1) {
+        // An optional last field gives the volume of the request
+        char line[256];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+          if (sscanf(line, "%lu %d %1s %41s %lf %u", &req.address_, &req.length_, op, sha1, &req.compressibility_, &req.volumeId_) < 5) {
+            continue;
+          }
+          convertStr2Sha1(sha1, (char *)req.fingerprint_);
+          if (req.volumeId_ >= Config::getInstance().getnVolumes()) {
+            printf("Request to volume %u, but only %u volumes!\n", req.volumeId_, Config::getInstance().getnVolumes());
+            exit(-1);
+          }
           cnt++;
 
           if (Config::getInstance().isSynthenticCompressionEnabled()) {
-            int clen = (double)chunkSize / compressibility; 
-            if (clen >= chunkSize) clen = chunkSize;
-            req.compressionLength_ = clen;
-            while (req.compressionLength_ < chunkSize) {
-              if (compressedChunks_[req.compressionLength_] != nullptr) {
-                // Compression length matched
-                break;
-              }
-              req.compressionLength_ += 1;  // Find the next compression length
-            }
+            setCompressionLength(req);
           }
 
           req.isRead_ = (op[0] == 'r' || op[0] == 'R');
 
           reqs_.emplace_back(req);
+          req.volumeId_ = 0;
         }
         printf("%s: Go through %lu operations, selected %lu\n", fileName, cnt, reqs_.size());
 
         fclose(f);
+        return 0;
       }
 
-      void sendRequest(Request &req) {
+      /**
+       * Length of the generated compressed chunk closest above the
+       * compressibility of the request
+       */
+      void setCompressionLength(Request &req) {
+        const int chunkSize = Config::getInstance().getChunkSize();
+        int clen = (double)chunkSize / req.compressibility_;
+        if (clen >= chunkSize) clen = chunkSize;
+        req.compressionLength_ = clen;
+        while (req.compressionLength_ < chunkSize) {
+          if (compressedChunks_[req.compressionLength_] != nullptr) {
+            // Compression length matched
+            break;
+          }
+          req.compressionLength_ += 1;  // Find the next compression length
+        }
+      }
+
+      void sendRequest(Request &req, ChunkOrdering::Ticket &ticket) {
         uint64_t begin;
         int len;
-        char sha1[43];
-        alignas(512) char rwdata[chunkSize_];
+        BufferPool::Buffer buffer = BufferPool::getInstance().acquire();
+        char *rwdata = (char *)buffer.get();
         begin = req.address_;
         len = req.length_;
 
-        std::string s = std::string(req.sha1_);
-        convertStr2Sha1(req.sha1_, sha1);
-        Config::getInstance().setFingerprint(req.address_, sha1);
+        // The trace fingerprint of an lba is for the request whose turn it is
+        AustereCache_->wait(ticket);
+        // The fingerprint of a partial chunk write does not describe the
+        // chunk it is merged into, let the cache compute that one
+        if (len == chunkSize_ && begin % chunkSize_ == 0) {
+          Config::getInstance().setFingerprint(toLba(req.volumeId_, req.address_), (char *)req.fingerprint_);
+        }
 
         if (Config::getInstance().isSynthenticCompressionEnabled()) {
           if (Config::getInstance().isFakeIOEnabled() || !req.isRead_) {
@@ -244,14 +484,14 @@ namespace cache {
           }
         } else {
           if (Config::getInstance().isFakeIOEnabled() || !req.isRead_) {
-            memoryRepeat(rwdata, req.sha1_);
+            memoryRepeat(rwdata, req.fingerprint_);
           }
         }
 
         if (req.isRead_) {
-          AustereCache_->read(begin, rwdata, len);
+          AustereCache_->read(ticket, rwdata);
         } else {
-          AustereCache_->write(begin, rwdata, len);
+          AustereCache_->write(ticket, rwdata);
         }
       }
 
@@ -266,12 +506,63 @@ namespace cache {
           if (s[i] <= '9') sha1[i/2] += ((s[i] - '0') << 4);
           else if (s[i] <= 'F') sha1[i/2] += ((s[i] - 'A' + 10) << 4);
           else if (s[i] <= 'f') sha1[i/2] += ((s[i] - 'a' + 10) << 4);
-          if (s[i+1] <= '9') sha1[i/2] += s[i+1]; 
+          if (s[i+1] <= '9') sha1[i/2] += s[i+1] - '0';
           else if (s[i+1] <= 'F') sha1[i/2] += s[i+1] - 'A' + 10; 
           else if (s[i+1] <= 'f') sha1[i/2] += s[i+1] - 'a' + 10; 
         }
       }
 
+      /**
+       * The next request of the trace or of the synthetic workload,
+       * nullptr after the last one
+       */
+      InFlight *takeNext() {
+        std::unique_ptr<InFlight> inFlight = std::make_unique<InFlight>();
+        if (workload_ != nullptr) {
+          if (!workload_->next(inFlight->req_)) {
+            return nullptr;
+          }
+          if (Config::getInstance().isSynthenticCompressionEnabled()) {
+            setCompressionLength(inFlight->req_);
+          }
+        } else {
+          if (nextReq_ == reqs_.size()) {
+            return nullptr;
+          }
+          inFlight->req_ = reqs_[nextReq_];
+        }
+        inFlight->id_ = nextReq_++;
+        inFlight->arrival_ = std::chrono::steady_clock::now();
+        return inFlight.release();
+      }
+
+      // Start again from the first request
+      void rewind() {
+        if (workload_ != nullptr) {
+          workload_->reset();
+        }
+        nextReq_ = 0;
+      }
+
+      // Take the turn of the request on its chunks
+      void issue(InFlight *inFlight) {
+        const Request &req = inFlight->req_;
+        inFlight->ticket_ = AustereCache_->issue(req.volumeId_, req.address_, req.length_);
+      }
+
+      /**
+       * Send the request and free it, returns its latency in ns from its
+       * arrival
+       */
+      uint64_t serve(InFlight *inFlight) {
+        if (inFlight->id_ % 100000 == 0) printf("req %" PRIu64 "\n", inFlight->id_);
+        sendRequest(inFlight->req_, inFlight->ticket_);
+        uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - inFlight->arrival_).count();
+        delete inFlight;
+        return latency;
+      }
+
       void work(std::atomic<uint64_t> &total_bytes)
       {
         int nThreads = 1;
@@ -280,32 +571,299 @@ namespace cache {
           nThreads = Config::getInstance().getMaxNumGlobalThreads();
         }
 
+        if (loadMode_ != tLoadReplay) {
+          workLoaded(nThreads, total_bytes);
+          return;
+        }
+
+        if (Config::getInstance().isMultiThreadingEnabled()
+            && Config::getInstance().isSharedNothingEnabled()) {
+          workPartitioned(nThreads, total_bytes);
+          return;
+        }
+
         AThreadPool *threadPool = new AThreadPool(nThreads);
-        char sha1[23];
-        for (uint32_t i = 0; i < reqs_.size(); ++i) {
-          threadPool->doJob([this, i]() {
-              {
-                std::unique_lock<std::mutex> l(mutex_);
-                while (accessSet_.find(reqs_[i].address_) != accessSet_.end()) {
-                  condVar_.wait(l);
-                }
-                accessSet_.insert(reqs_[i].address_);
-              }
-              if (i % 100000 == 0) printf("req %u\n", i); // , num of unique fingerprint = %d\n", i, sets.size());
-              sendRequest(reqs_[i]);
-              {
-                std::unique_lock<std::mutex> l(mutex_);
-                accessSet_.erase(reqs_[i].address_);
-                condVar_.notify_all();
-              }
+        // Requests are issued in the order of the trace and run in that order
+        // per chunk, whichever threads take them
+        uint32_t batchSize = kBatchSizePerThread * nThreads;
+        for (bool hasNext = true; hasNext; ) {
+          // Requests are submitted in batches to take fewer locks
+          auto batch = std::make_shared<std::vector<InFlight *>>();
+          while (batch->size() < batchSize) {
+            InFlight *inFlight = takeNext();
+            if (inFlight == nullptr) {
+              hasNext = false;
+              break;
+            }
+            issue(inFlight);
+            batch->push_back(inFlight);
+          }
+          if (batch->empty()) {
+            break;
+          }
+          threadPool->doJobs(batch->size(), [this, batch](uint64_t j) {
+              serve((*batch)[j]);
           });
-          total_bytes += chunkSize;
+          total_bytes += (uint64_t)chunkSize * batch->size();
         }
-        condVar_.notify_all();
         delete threadPool;
         sync();
       }
 
+      /**
+       * Worker owning the LBA index bucket of the chunk at addr, the buckets
+       * are split into contiguous ranges as the index is over NUMA nodes
+       * (see IndexMemory)
+       */
+      uint32_t getChunkOwner(uint32_t volumeId, uint64_t addr, uint32_t nWorkers) {
+        uint64_t lbaHash = Chunk::computeLBAHash(toLba(volumeId, addr / chunkSize_ * chunkSize_));
+        uint64_t bucketId = lbaHash >> Config::getInstance().getnBitsPerLbaSignature();
+        return bucketId * nWorkers / Config::getInstance().getnLbaBuckets();
+      }
+
+      /**
+       * Worker owning all the chunks a request covers, nWorkers if they
+       * have different owners
+       */
+      uint32_t getOwner(const Request &req, uint32_t nWorkers) {
+        uint32_t owner = getChunkOwner(req.volumeId_, req.address_, nWorkers);
+        uint64_t begin = req.address_ / chunkSize_ * chunkSize_;
+        for (uint64_t addr = begin + chunkSize_; addr < req.address_ + req.length_; addr += chunkSize_) {
+          if (getChunkOwner(req.volumeId_, addr, nWorkers) != owner) {
+            return nWorkers;
+          }
+        }
+        return owner;
+      }
+
+      /**
+       * Take the turn of a request over the chunks of several workers, once
+       * those workers have handled the requests before it, so that it comes
+       * after them on its chunks and before the requests submitted later
+       */
+      void issueShared(PartitionedWorkers<InFlight *> &workers, InFlight *inFlight) {
+        const Request &req = inFlight->req_;
+        uint32_t nWorkers = workers.getnWorkers();
+        uint64_t begin = req.address_ / chunkSize_ * chunkSize_;
+        for (uint64_t addr = begin; addr < req.address_ + req.length_; addr += chunkSize_) {
+          workers.drain(getChunkOwner(req.volumeId_, addr, nWorkers));
+        }
+        issue(inFlight);
+      }
+
+      /**
+       * Shared-nothing replay: requests to a chunk are handled in order by
+       * its owner, so no request waits for another one to the same chunk.
+       * Requests over the chunks of several owners are sent by the dispatcher.
+       */
+      void workPartitioned(uint32_t nThreads, std::atomic<uint64_t> &total_bytes)
+      {
+        uint32_t chunkSize = Config::getInstance().getChunkSize();
+        std::vector<uint64_t> nReqsPerWorker(nThreads, 0);
+        uint64_t nSharedReqs = 0;
+        {
+          PartitionedWorkers<InFlight *> workers(nThreads, [this](InFlight *&inFlight) {
+              issue(inFlight);
+              serve(inFlight);
+          });
+          for (InFlight *inFlight = takeNext(); inFlight != nullptr; inFlight = takeNext()) {
+            uint32_t owner = getOwner(inFlight->req_, nThreads);
+            if (owner == nThreads) {
+              issueShared(workers, inFlight);
+              serve(inFlight);
+              ++nSharedReqs;
+            } else {
+              workers.submit(owner, inFlight);
+              ++nReqsPerWorker[owner];
+            }
+            total_bytes += chunkSize;
+          }
+        }
+        sync();
+        uint64_t nReqsMax = *std::max_element(nReqsPerWorker.begin(), nReqsPerWorker.end());
+        printf("Shared-nothing workers: %u, max / mean requests per worker: %.2f, requests sent by the dispatcher: %" PRIu64 "\n",
+            nThreads, nextReq_ == 0 ? 0 : nReqsMax * nThreads / (double)nextReq_, nSharedReqs);
+      }
+
+      struct LoadResult {
+        // Requests taken, and requests measured (after the warmup)
+        uint64_t nTaken_;
+        uint64_t nRequests_;
+        double seconds_;
+        // Latencies in us
+        double mean_, p50_, p90_, p99_, p999_, max_;
+      };
+
+      /**
+       * Replay the trace once per load level (queue depth or target IOPS)
+       * and print the latency against the throughput reached at each level
+       */
+      void workLoaded(uint32_t nThreads, std::atomic<uint64_t> &total_bytes)
+      {
+        uint32_t chunkSize = Config::getInstance().getChunkSize();
+        bool isClosedLoop = loadMode_ == tLoadClosedLoop;
+        if (loadLevels_.empty()) {
+          loadLevels_.push_back(isClosedLoop ? nThreads : 1000);
+        }
+
+        std::vector<LoadResult> results;
+        for (uint64_t level : loadLevels_) {
+          results.push_back(runLevel(nThreads, std::max<uint64_t>(level, 1)));
+          total_bytes += (uint64_t)chunkSize * results.back().nTaken_;
+        }
+
+        printf("Load curve (%s, %u threads, first %" PRIu64 " requests of each run left out):\n",
+            isClosedLoop ? "closed loop" : "open loop", nThreads, nWarmupRequests_);
+        printf("%12s %10s %10s %10s %10s %10s %10s %10s %10s\n", isClosedLoop ? "queue depth" : "target IOPS",
+            "IOPS", "MB/s", "mean(us)", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)");
+        for (uint32_t i = 0; i < results.size(); ++i) {
+          const LoadResult &result = results[i];
+          double iops = result.seconds_ > 0 ? result.nRequests_ / result.seconds_ : 0;
+          printf("%12" PRIu64 " %10.0f %10.2f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", loadLevels_[i],
+              iops, iops * chunkSize / (1024 * 1024), result.mean_, result.p50_,
+              result.p90_, result.p99_, result.p999_, result.max_);
+        }
+      }
+
+      /**
+       * Run one level in a child process that starts with an empty cache and
+       * zeroed statistics, so that no level runs on the cache warmed up by
+       * the levels before it. The child dumps the statistics of its level.
+       */
+      LoadResult runLevel(uint32_t nThreads, uint64_t level)
+      {
+        int fds[2];
+        if (pipe(fds) != 0) {
+          std::cout << "Cannot create a pipe!" << std::endl;
+          exit(-1);
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+          std::cout << "Cannot fork the run of load level " << level << "!" << std::endl;
+          exit(-1);
+        }
+        if (pid == 0) {
+          close(fds[0]);
+          Stats::getInstance().reset();
+          AustereCache_ = std::make_unique<AustereCache>();
+          LoadResult result = runLoad(nThreads, level);
+          printf("Statistics of load level %" PRIu64 ":\n", level);
+          // Writes back the dirty data and dumps the statistics
+          AustereCache_.reset();
+          bool isWritten = write(fds[1], &result, sizeof(result)) == sizeof(result);
+          _exit(isWritten ? 0 : 1);
+        }
+
+        close(fds[1]);
+        LoadResult result{};
+        bool isRead = read(fds[0], &result, sizeof(result)) == sizeof(result);
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!isRead || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          std::cout << "The run of load level " << level << " failed!" << std::endl;
+          exit(-1);
+        }
+        return result;
+      }
+
+      /**
+       * One run of the requests under a closed or an open loop. A latency
+       * is taken from the arrival of the request, so that requests delayed
+       * by a saturated cache in the open loop are not left out of it.
+       */
+      LoadResult runLoad(uint32_t nThreads, uint64_t level)
+      {
+        using Clock = std::chrono::steady_clock;
+        bool isClosedLoop = loadMode_ == tLoadClosedLoop;
+        LatencyHistogram latencies;
+        uint64_t nOutstanding = 0;
+        std::mutex mutex;
+        std::condition_variable condVar;
+
+        auto complete = [&](InFlight *inFlight) {
+          bool isMeasured = inFlight->id_ >= nWarmupRequests_;
+          uint64_t latency = serve(inFlight);
+          if (isMeasured) {
+            latencies.add(latency);
+          }
+          if (isClosedLoop) {
+            std::lock_guard<std::mutex> l(mutex);
+            --nOutstanding;
+            condVar.notify_one();
+          }
+        };
+
+        // Requests of a chunk are issued in the order of the trace, by the
+        // dispatcher or by the worker owning the chunk. Without workers, or
+        // over the chunks of several workers, they run in the pool.
+        // Room for all the requests outstanding, only the loop holds them back
+        uint64_t nJobsPerThread = isClosedLoop ? level / nThreads + 1 : kMaxOpenLoopJobsPerThread;
+        std::unique_ptr<AThreadPool> threadPool =
+          std::make_unique<AThreadPool>(nThreads, std::max<uint64_t>(nJobsPerThread, 64));
+        std::unique_ptr<PartitionedWorkers<InFlight *>> workers;
+        if (Config::getInstance().isMultiThreadingEnabled()
+            && Config::getInstance().isSharedNothingEnabled()) {
+          workers = std::make_unique<PartitionedWorkers<InFlight *>>(nThreads, [&](InFlight *&inFlight) {
+              issue(inFlight);
+              complete(inFlight);
+          });
+        }
+
+        rewind();
+        std::mt19937_64 rng(level);
+        std::exponential_distribution<double> interArrival(level);
+        Clock::time_point begin = Clock::now(), arrival = begin, measureBegin = begin;
+        for (InFlight *inFlight = takeNext(); inFlight != nullptr; inFlight = takeNext()) {
+          if (isClosedLoop) {
+            std::unique_lock<std::mutex> l(mutex);
+            condVar.wait(l, [&]() { return nOutstanding < level; });
+            ++nOutstanding;
+            arrival = Clock::now();
+          } else {
+            arrival += std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(interArrival(rng)));
+            std::this_thread::sleep_until(arrival);
+          }
+          inFlight->arrival_ = arrival;
+          if (inFlight->id_ == nWarmupRequests_) {
+            measureBegin = arrival;
+          }
+
+          uint32_t owner = workers != nullptr ? getOwner(inFlight->req_, nThreads) : nThreads;
+          if (owner < nThreads) {
+            workers->submit(owner, inFlight);
+          } else {
+            if (workers != nullptr) {
+              issueShared(*workers, inFlight);
+            } else {
+              issue(inFlight);
+            }
+            threadPool->doJob([&complete, inFlight]() { complete(inFlight); });
+          }
+        }
+        // Wait for the last requests
+        workers.reset();
+        threadPool.reset();
+        Clock::time_point end = Clock::now();
+        sync();
+
+        LoadResult result{};
+        result.nTaken_ = nextReq_;
+        result.nRequests_ = latencies.getnSamples();
+        if (result.nRequests_ == 0) {
+          return result;
+        }
+        result.seconds_ = std::chrono::duration<double>(end - measureBegin).count();
+        result.mean_ = latencies.getMean() / 1000.0;
+        result.p50_ = latencies.getPercentile(0.5) / 1000.0;
+        result.p90_ = latencies.getPercentile(0.9) / 1000.0;
+        result.p99_ = latencies.getPercentile(0.99) / 1000.0;
+        result.p999_ = latencies.getPercentile(0.999) / 1000.0;
+        result.max_ = latencies.getMax() / 1000.0;
+        return result;
+      }
+
     void generateCompression() {
       uint32_t chunkSize = Config::getInstance().getChunkSize();
       int tmp = posix_memalign(reinterpret_cast<void **>(&compressedChunks_), 512, sizeof(char*) * (1 + chunkSize));
@@ -318,7 +876,9 @@ namespace cache {
         std::cout << "Cannot allocate memory!" << std::endl;
         exit(-1);
       }
-      char originalChunk[chunkSize], compressedChunk[chunkSize];
+      BufferPool::Buffer originalBuf = BufferPool::getInstance().acquire();
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      char *originalChunk = (char *)originalBuf.get(), *compressedChunk = (char *)compressedBuf.get();
       memset(originalChunk, 1, sizeof(char) * chunkSize);
       memset(compressedChunk, 1, sizeof(char) * chunkSize);
       for (uint32_t i = 0; i <= chunkSize; ++i) {
@@ -355,6 +915,9 @@ namespace cache {
     }
 
     private: 
+      static const uint32_t kBatchSizePerThread = 8;
+      static const uint64_t kMaxOpenLoopJobsPerThread = 65536;
+
       uint64_t workingSetSize_;
       uint32_t chunkSize_;
 
@@ -362,10 +925,20 @@ namespace cache {
       char** compressedChunks_;
       char** originalChunks_;
       std::unique_ptr<AustereCache> AustereCache_;
+      // The parsed configuration
+      cJSON *config_;
       std::vector<Request> reqs_;
-      std::set<uint64_t> accessSet_;
-      std::mutex mutex_;
-      std::condition_variable condVar_;
+      // Generates the requests instead of reqs_ if set
+      std::unique_ptr<SyntheticWorkload> workload_;
+      SyntheticWorkload::Parameters workloadParameters_;
+      bool isSynthetic_;
+      // Requests taken so far
+      uint64_t nextReq_;
+
+      LoadModeEnum loadMode_;
+      // Queue depths or target IOPS, one run of the trace each
+      std::vector<uint64_t> loadLevels_;
+      uint64_t nWarmupRequests_;
   };
 
 }
@@ -0,0 +1,74 @@
+/* File: benchmark/thread_pool_benchmark.cc
+ * Description:
+ *   Job throughput of AThreadPool.
+ *
+ *   Usage: thread_pool_benchmark [nThreads] [jobNs]
+ *   One thread submits short jobs that spin for jobNs nanoseconds, one at a
+ *   time with doJob and in batches with doJobs, as run submits the requests
+ *   of a trace.
+ */
+#include "utils/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumJobs = 2000000;
+  const uint32_t kBatchSize = 256;
+
+  std::atomic<uint64_t> nJobsDone(0);
+
+  void spin(uint32_t ns)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - begin < std::chrono::nanoseconds(ns)) {}
+    nJobsDone.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  template <typename Submit>
+  double measure(uint32_t nThreads, Submit submit)
+  {
+    nJobsDone = 0;
+    auto begin = std::chrono::steady_clock::now();
+    {
+      AThreadPool threadPool(nThreads);
+      submit(threadPool);
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (nJobsDone != kNumJobs) {
+      std::cout << "Lost jobs: " << kNumJobs - nJobsDone << std::endl;
+      exit(-1);
+    }
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    return kNumJobs / us;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t nThreads = argc > 1 ? atoi(argv[1]) : 8;
+  uint32_t jobNs = argc > 2 ? atoi(argv[2]) : 0;
+  std::cout << "Threads: " << nThreads << ", job length (ns): " << jobNs << std::endl;
+
+  double singleRate = measure(nThreads, [&](AThreadPool &threadPool) {
+    for (uint32_t i = 0; i < kNumJobs; ++i) {
+      threadPool.doJob([jobNs]() { spin(jobNs); });
+    }
+  });
+  double batchRate = measure(nThreads, [&](AThreadPool &threadPool) {
+    for (uint32_t i = 0; i < kNumJobs; i += kBatchSize) {
+      threadPool.doJobs(std::min(kBatchSize, kNumJobs - i), [jobNs](uint64_t) { spin(jobNs); });
+    }
+  });
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "doJob jobs per us: " << singleRate << std::endl
+            << "doJobs jobs per us: " << batchRate << std::endl;
+  return 0;
+}
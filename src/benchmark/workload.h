@@ -0,0 +1,235 @@
+/* File: benchmark/workload.h
+ * Description:
+ *   Requests replayed by run, and SyntheticWorkload, which generates them in
+ *   the process with the access patterns of traces/syn_trace_gen.cc instead
+ *   of reading them from a trace file.
+ *
+ *   1. A pattern picks a run of chunks of the working set: Uniform,
+ *      HotCold (a share of 1 - hotRatio of the chunks gets hotRatio of the
+ *      accesses), Sequential (runs of 8 chunks), or Zipf of zipfAlpha over
+ *      the runs.
+ *   2. A write gives the chunk new content, or with probability ioDupRatio
+ *      the content of a chunk written before. A content has a fingerprint
+ *      and a compressibility drawn from N(compressibility, 0.25) as the
+ *      generated traces do. The primary device is not filled beforehand
+ *      as for the generated traces, so a chunk never written has a content
+ *      of its own (zeros) that no write duplicates.
+ *   3. Only the content of each chunk of the working set is kept, so that a
+ *      run is not bounded by the size of a trace file.
+ */
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct Request {
+  Request() {
+    address_ = 0;
+    length_ = 0;
+    isRead_ = 0;
+    compressionLength_ = 0;
+    volumeId_ = 0;
+  }
+
+  uint32_t volumeId_;
+  uint64_t address_;
+  int length_;
+  bool isRead_;
+  uint32_t compressionLength_;
+  // Compressibility of the data, for synthetic compression
+  double compressibility_;
+  // SHA1 of the data
+  uint8_t fingerprint_[20];
+};
+
+namespace cache {
+
+  enum WorkloadPatternEnum {
+    tWorkloadUniform,
+    tWorkloadHotCold,
+    tWorkloadSequential,
+    tWorkloadZipf
+  };
+
+  class SyntheticWorkload {
+    public:
+      struct Parameters {
+        WorkloadPatternEnum pattern_ = tWorkloadUniform;
+        uint64_t nRequests_ = 1000000;
+        uint64_t workingSetSize_ = 256 * 1024 * 1024ull;
+        uint64_t primaryDeviceSize_ = 1024 * 1024 * 1024ull;
+        uint32_t chunkSize_ = 32768;
+        // Chunks accessed in a row, 0 for the default of the pattern
+        uint32_t runLength_ = 0;
+        // Reads per write
+        double readWriteRatio_ = 1.0;
+        // Share of the new contents written that duplicate an earlier one
+        double ioDupRatio_ = 0.5;
+        double hotRatio_ = 0.9;
+        double zipfAlpha_ = 1.0;
+        double compressibility_ = 2.0;
+        uint64_t seed_ = 1;
+      };
+
+      SyntheticWorkload(const Parameters &parameters) : parameters_(parameters)
+      {
+        if (parameters_.runLength_ == 0) {
+          parameters_.runLength_ = parameters_.pattern_ == tWorkloadSequential ? 8 : 1;
+        }
+        nChunks_ = std::max<uint64_t>(parameters_.workingSetSize_ / parameters_.chunkSize_, 1);
+        nRuns_ = std::max<uint64_t>(nChunks_ / parameters_.runLength_, 1);
+        nChunks_ = nRuns_ * parameters_.runLength_;
+        // Runs are spread evenly over the primary device
+        runStride_ = std::max<uint64_t>(parameters_.primaryDeviceSize_ / parameters_.chunkSize_ / nChunks_, 1)
+          * parameters_.runLength_;
+        if (parameters_.pattern_ == tWorkloadZipf) {
+          // genzipf::zipf sums the n probabilities at every call, they are
+          // summed once here
+          zipfCdf_.resize(nRuns_);
+          double sum = 0;
+          for (uint64_t i = 0; i < nRuns_; ++i) {
+            sum += 1.0 / pow((double)(i + 1), parameters_.zipfAlpha_);
+            zipfCdf_[i] = sum;
+          }
+          for (auto &p : zipfCdf_) {
+            p /= sum;
+          }
+        }
+        reset();
+      }
+
+      uint64_t getnRequests() { return parameters_.nRequests_; }
+
+      // Start again from the first request and an unwritten working set
+      void reset()
+      {
+        rng_.seed(parameters_.seed_);
+        contents_.assign(nChunks_, Content());
+        writtenChunks_.clear();
+        nextContentId_ = 1;
+        nRequests_ = 0;
+        runChunk_ = 0;
+        nLeftInRun_ = 0;
+        if (parameters_.pattern_ == tWorkloadZipf) {
+          // The most popular runs are not next to each other
+          zipfRuns_.resize(nRuns_);
+          for (uint64_t i = 0; i < nRuns_; ++i) {
+            zipfRuns_[i] = i;
+          }
+          std::shuffle(zipfRuns_.begin(), zipfRuns_.end(), rng_);
+        }
+      }
+
+      bool next(Request &req)
+      {
+        if (nRequests_ == parameters_.nRequests_) {
+          return false;
+        }
+        ++nRequests_;
+        // A run of chunks is all reads or all writes
+        if (nLeftInRun_ == 0) {
+          runChunk_ = pickRun() * parameters_.runLength_;
+          nLeftInRun_ = parameters_.runLength_;
+          isRead_ = uniform_(rng_) < parameters_.readWriteRatio_ / (1 + parameters_.readWriteRatio_);
+        }
+        uint64_t chunk = runChunk_++;
+        --nLeftInRun_;
+
+        Content &content = contents_[chunk];
+        if (!isRead_) {
+          if (content.id_ == 0) {
+            writtenChunks_.push_back(chunk);
+          }
+          content = newContent(chunk);
+        }
+
+        req.volumeId_ = 0;
+        req.address_ = (chunk / parameters_.runLength_ * runStride_
+            + chunk % parameters_.runLength_) * parameters_.chunkSize_;
+        req.length_ = parameters_.chunkSize_;
+        req.isRead_ = isRead_;
+        req.compressionLength_ = 0;
+        req.compressibility_ = content.compressibility_;
+        computeFingerprint(content.id_, req.fingerprint_);
+        return true;
+      }
+
+    private:
+      struct Content {
+        uint64_t id_ = 0;
+        double compressibility_ = 1;
+      };
+
+      uint64_t pickRun()
+      {
+        uint64_t hotRuns = std::max<uint64_t>(nRuns_ * (1 - parameters_.hotRatio_), 1);
+        switch (parameters_.pattern_) {
+          case tWorkloadHotCold:
+            if (hotRuns >= nRuns_ || uniform_(rng_) < parameters_.hotRatio_) {
+              return rng_() % hotRuns;
+            }
+            return hotRuns + rng_() % (nRuns_ - hotRuns);
+          case tWorkloadZipf:
+            return zipfRuns_[std::lower_bound(zipfCdf_.begin(), zipfCdf_.end() - 1, uniform_(rng_))
+              - zipfCdf_.begin()];
+          default:
+            return rng_() % nRuns_;
+        }
+      }
+
+      Content newContent(uint64_t chunk)
+      {
+        // Duplicate the content of a chunk written before
+        if (writtenChunks_.size() > 1 && uniform_(rng_) < parameters_.ioDupRatio_) {
+          uint64_t source = writtenChunks_[rng_() % writtenChunks_.size()];
+          if (source != chunk) {
+            return contents_[source];
+          }
+        }
+        Content content;
+        content.id_ = nextContentId_++;
+        content.compressibility_ = std::max(1.0,
+            std::normal_distribution<double>(parameters_.compressibility_, 0.25)(rng_));
+        return content;
+      }
+
+      // Distinct contents get distinct fingerprints, as splitmix64 is a
+      // bijection of the id
+      static void computeFingerprint(uint64_t id, uint8_t *fingerprint)
+      {
+        uint64_t words[3];
+        for (uint32_t i = 0; i < 3; ++i) {
+          // splitmix64
+          uint64_t z = id + (i + 1) * 0x9e3779b97f4a7c15ull;
+          z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+          z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+          words[i] = z ^ (z >> 31);
+        }
+        memcpy(fingerprint, words, 20);
+      }
+
+      Parameters parameters_;
+      uint64_t nChunks_, nRuns_, runStride_;
+      std::vector<double> zipfCdf_;
+      std::vector<uint64_t> zipfRuns_;
+
+      std::mt19937_64 rng_;
+      std::uniform_real_distribution<double> uniform_;
+      // Content of each chunk of the working set, id 0 if never written
+      std::vector<Content> contents_;
+      std::vector<uint64_t> writtenChunks_;
+      uint64_t nextContentId_;
+      uint64_t nRequests_;
+      uint64_t runChunk_;
+      uint32_t nLeftInRun_;
+      bool isRead_;
+  };
+
+}
+
+#endif //__WORKLOAD_H__
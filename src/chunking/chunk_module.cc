@@ -11,6 +11,7 @@ namespace cache {
 
   void Chunk::computeFingerprint() {
     BEGIN_TIMER();
+    // Partial chunks are merged into whole chunks before (see WriteCoalescer)
     assert(len_ == Config::getInstance().getChunkSize());
     assert(addr_ % Config::getInstance().getChunkSize() == 0);
 
@@ -22,7 +23,13 @@ namespace cache {
         mh_sha1_update(&ctx, buf_, len_);
         mh_sha1_finalize(&ctx, fingerprint_);
       }
-      Config::getInstance().getFingerprint(addr_, (char*)fingerprint_);
+      if (!Config::getInstance().getFingerprint(addr_, (char*)fingerprint_)
+          && Config::getInstance().isFakeIOEnabled()) {
+        // A chunk merged from partial writes has no fingerprint in the trace
+        mh_sha1_init(&ctx);
+        mh_sha1_update(&ctx, buf_, len_);
+        mh_sha1_finalize(&ctx, fingerprint_);
+      }
     } else {
       mh_sha1_init(&ctx);
       mh_sha1_update(&ctx, buf_, len_);
@@ -63,8 +70,8 @@ namespace cache {
     if (len_ == 0) return false;
 
     uint64_t next_addr =
-      ((addr_ & ~(chunkSize_ - 1)) + chunkSize_) < (addr_ + len_) ?
-      ((addr_ & ~(chunkSize_ - 1)) + chunkSize_) : (addr_ + len_);
+      ((addr_ & ~(uint64_t)(chunkSize_ - 1)) + chunkSize_) < (addr_ + len_) ?
+      ((addr_ & ~(uint64_t)(chunkSize_ - 1)) + chunkSize_) : (addr_ + len_);
 
     c.addr_ = addr_;
     c.len_ = next_addr - addr_;
@@ -78,6 +85,7 @@ namespace cache {
     c.dedupResult_ = DEDUP_UNKNOWN;
     c.lookupResult_ = LOOKUP_UNKNOWN;
     c.verficationResult_ = VERIFICATION_UNKNOWN;
+    c.isDirty_ = false;
     c.nSubchunks_ = 0;
     c.lbaHash_ = Chunk::computeLBAHash(c.addr_);
 
@@ -98,8 +106,8 @@ namespace cache {
 
 
     uint64_t next_addr =
-      ((addr_ & ~(chunkSize_ - 1)) + chunkSize_) < (addr_ + len_) ?
-      ((addr_ & ~(chunkSize_ - 1)) + chunkSize_) : (addr_ + len_);
+      ((addr_ & ~(uint64_t)(chunkSize_ - 1)) + chunkSize_) < (addr_ + len_) ?
+      ((addr_ & ~(uint64_t)(chunkSize_ - 1)) + chunkSize_) : (addr_ + len_);
 
     addr = addr_;
     len = next_addr - addr_;
@@ -112,6 +120,91 @@ namespace cache {
     return true;
   }
 
+  namespace {
+    struct GearTable {
+      // gear_[b] is the random value added for byte b, gearShifted_[b] is
+      // gear_[b] << 1 for the first byte of a two-byte step
+      uint64_t gear_[256];
+      uint64_t gearShifted_[256];
+      GearTable() {
+        // splitmix64, fixed seed so that cut points are reproducible
+        uint64_t x = 0x2545f4914f6cdd1dull;
+        for (uint32_t i = 0; i < 256; ++i) {
+          uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+          z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9ull;
+          z = (z ^ (z >> 27u)) * 0x94d049bb133111ebull;
+          gear_[i] = z ^ (z >> 31u);
+          gearShifted_[i] = gear_[i] << 1u;
+        }
+      }
+    };
+    const GearTable &getGearTable() {
+      static GearTable table;
+      return table;
+    }
+  }
+
+  ContentDefinedChunker::ContentDefinedChunker(const void *buf, uint32_t len,
+      uint32_t minSize, uint32_t avgSize, uint32_t maxSize) :
+    buf_((const uint8_t*)buf), len_(len), offset_(0),
+    minSize_(minSize), avgSize_(avgSize), maxSize_(maxSize)
+  {
+    uint32_t nBits = 0;
+    while ((1u << (nBits + 1)) <= avgSize_) ++nBits;
+    // Normalization level 2
+    maskS_ = spreadMask(nBits + 2);
+    maskL_ = spreadMask(nBits - 2);
+  }
+
+  uint64_t ContentDefinedChunker::spreadMask(uint32_t nBits)
+  {
+    // A bit of the hash depends on as many of the last bytes as its
+    // position, only use the upper 48 bits
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < nBits; ++i) {
+      mask |= 1ull << (63u - i * 48u / nBits);
+    }
+    return mask;
+  }
+
+  uint32_t ContentDefinedChunker::findCutPoint(const uint8_t *buf, uint32_t len)
+  {
+    const GearTable &table = getGearTable();
+    if (len <= minSize_) return len;
+    if (len > maxSize_) len = maxSize_;
+    uint32_t normalSize = avgSize_ < len ? avgSize_ : len;
+    // The first byte of a step is shifted twice and checked against the
+    // mask shifted once
+    uint64_t maskSShifted = maskS_ << 1u, maskLShifted = maskL_ << 1u;
+    uint64_t fp = 0;
+    uint32_t i = minSize_ & ~1u;
+
+    for ( ; i + 1 < normalSize; i += 2) {
+      fp = (fp << 2u) + table.gearShifted_[buf[i]];
+      if (!(fp & maskSShifted)) return i + 1;
+      fp += table.gear_[buf[i + 1]];
+      if (!(fp & maskS_)) return i + 2;
+    }
+    for ( ; i + 1 < len; i += 2) {
+      fp = (fp << 2u) + table.gearShifted_[buf[i]];
+      if (!(fp & maskLShifted)) return i + 1;
+      fp += table.gear_[buf[i + 1]];
+      if (!(fp & maskL_)) return i + 2;
+    }
+    return len;
+  }
+
+  bool ContentDefinedChunker::next(uint32_t &offset, uint32_t &len)
+  {
+    if (offset_ == len_) return false;
+
+    offset = offset_;
+    len = findCutPoint(buf_ + offset_, len_ - offset_);
+    offset_ += len;
+
+    return true;
+  }
+
   /**
    * A factory of class "Chunker". Used to create a Chunker class
    */
@@ -122,6 +215,12 @@ namespace cache {
     return chunker;
   }
 
+  ContentDefinedChunker ChunkModule::createContentDefinedChunker(const void *buf, uint32_t len, uint32_t avgSize)
+  {
+    ContentDefinedChunker chunker(buf, len, avgSize / 4, avgSize, avgSize * 8);
+    return chunker;
+  }
+
   ChunkModule& ChunkModule::getInstance() {
     static ChunkModule instance;
     return instance;
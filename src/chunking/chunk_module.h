@@ -20,6 +20,34 @@ namespace cache {
     uint32_t chunkSize_;
   };
 
+  /**
+   * Content-defined chunking (FastCDC) of a buffer
+   *   Cut points are where a Gear rolling hash of the data matches a mask,
+   *   so that they move along with the data when bytes are inserted or
+   *   removed. A mask with more bits is used before the average chunk size
+   *   and one with fewer bits after it (normalized chunking), and chunks are
+   *   kept within [minSize, maxSize]. The hash rolls two bytes per step.
+   */
+  class ContentDefinedChunker {
+   public:
+    ContentDefinedChunker(const void *buf, uint32_t len,
+        uint32_t minSize, uint32_t avgSize, uint32_t maxSize);
+    // obtain the offset and length of the next chunk
+    bool next(uint32_t &offset, uint32_t &len);
+   protected:
+    uint32_t findCutPoint(const uint8_t *buf, uint32_t len);
+    static uint64_t spreadMask(uint32_t nBits);
+
+    const uint8_t *buf_;
+    uint32_t len_;
+    uint32_t offset_;
+    uint32_t minSize_;
+    uint32_t avgSize_;
+    uint32_t maxSize_;
+    uint64_t maskS_;
+    uint64_t maskL_;
+  };
+
   /**
    * A factory of class "Chunker"
    */
@@ -29,6 +57,8 @@ namespace cache {
     public:
       static ChunkModule& getInstance();
       Chunker createChunker(uint64_t addr, void *buf, uint32_t len);
+      // Chunks of avgSize bytes on average, from avgSize / 4 to avgSize * 8
+      ContentDefinedChunker createContentDefinedChunker(const void *buf, uint32_t len, uint32_t avgSize);
   };
 }
 
@@ -20,14 +20,25 @@ namespace cache {
  *        metadata is fetched from SSD to verify if the chunk is duplicate or not.
  */
 struct Metadata {
-  uint64_t LBAs_[MAX_NUM_LBAS_PER_CACHED_CHUNK]; // 4 * 32
+  uint64_t LBAs_[MAX_NUM_LBAS_PER_CACHED_CHUNK]; // 8 * 29
+  // Version at which each lba was mapped to this chunk. An lba listed by
+  // several records belongs to the one with the newest version of it.
+  uint64_t lbaVersions_[MAX_NUM_LBAS_PER_CACHED_CHUNK]; // 8 * 29
+  // (Write-back) bit i is set if LBAs_[i] is not written back yet
+  uint64_t dirtyLbas_;
+  // Stamp of the latest write of this record (monotonically increasing).
+  // Recovery uses it to tell a live record from a stale one in the same slots.
+  uint64_t version_;
   uint8_t  fingerprint_[20];
-  uint32_t nextEvict_;
-  uint32_t numLBAs_;
+  uint16_t nextEvict_;
+  uint16_t numLBAs_;
   // If the data is compressed, the compressed_len is valid, otherwise, it is 0.
   // For CDARC - it is 32768 if it is not compressed
   uint32_t compressedLen_;
+  // XXH32 of the record computed with checksum_ = 0
+  uint32_t checksum_;
 };
+static_assert(sizeof(Metadata) == 512, "on-ssd metadata must fill exactly one sector");
 
 enum DedupResult {
   DUP_CONTENT, NOT_DUP, DEDUP_UNKNOWN
@@ -45,6 +56,17 @@ enum DeviceType {
   PRIMARY_DEVICE, CACHE_DEVICE, IN_MEM_BUFFER, JOURNAL
 };
 
+/*
+ * Several primary volumes share one cache. Internally, the block at address
+ * addr of volume volumeId is identified by the lba (volumeId << 48) | addr,
+ * so that the LBA index, the dirty list and the on-ssd metadata tell the
+ * volumes apart while the FP index deduplicates across them.
+ */
+const uint32_t kVolumeIdShift = 48;
+inline uint64_t toLba(uint32_t volumeId, uint64_t addr) { return ((uint64_t)volumeId << kVolumeIdShift) | addr; }
+inline uint32_t getVolumeId(uint64_t lba) { return lba >> kVolumeIdShift; }
+inline uint64_t getVolumeAddress(uint64_t lba) { return lba & ((1ull << kVolumeIdShift) - 1); }
+
 /*
  * The basic read/write/evict unit.
  * An object of class Chunk is passed along the data path of a single request.
@@ -94,6 +116,8 @@ struct Chunk {
     DedupResult dedupResult_;
     LookupResult lookupResult_;
     VerificationResult verficationResult_;
+    // (Write-back) the write leaves the lba dirty in the cache
+    bool isDirty_;
 
     // For multithreading, indexing update must be serialized
     // Bucket-level locks are used to guarantee the consistency of index
@@ -117,6 +141,7 @@ struct Chunk {
       hitFPIndex_ = false;
       verficationResult_ = VERIFICATION_UNKNOWN;
       lookupResult_ = LOOKUP_UNKNOWN;
+      isDirty_ = false;
 
       lbaHash_ = Chunk::computeLBAHash(addr_);
     }
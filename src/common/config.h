@@ -8,6 +8,7 @@
 #include <map>
 #include <mutex>
 #include <cassert>
+#include <vector>
 namespace cache {
     struct Fingerprint {
       Fingerprint() {
@@ -40,6 +41,10 @@ namespace cache {
         tWriteThrough, tWriteBack
     };
 
+    enum IndexNumaPolicyEnum {
+        tIndexNumaNone, tIndexNumaInterleave, tIndexNumaPartition
+    };
+
     class Config
     {
     public:
@@ -108,11 +113,68 @@ namespace cache {
 
         uint32_t getMaxNumGlobalThreads() { return maxNumGlobalThreads_; }
 
-        char *getCacheDeviceName() { return cacheDeviceName_; }
-        char *getPrimaryDeviceName() { return primaryDeviceName_; }
+        // Cache data (and metadata) are striped over all cache devices
+        uint32_t getnCacheDevices() { return cacheDeviceNames_.size(); }
+        char *getCacheDeviceName(uint32_t deviceId = 0) { return cacheDeviceNames_[deviceId]; }
+        char *getMetadataDeviceName() { return metadataDeviceName_; }
+        // Defaults to the cache data extent of one FP bucket
+        uint32_t getCacheStripeSize() {
+          return cacheStripeSize_ != 0 ? cacheStripeSize_ : nSlotsPerFpBucket_ * subchunkSize_;
+        }
+        // One primary device per volume
+        uint32_t getnVolumes() { return primaryDeviceNames_.size(); }
+        char *getPrimaryDeviceName(uint32_t volumeId = 0) { return primaryDeviceNames_[volumeId]; }
+        uint64_t getVolumeDirtyQuota() { return volumeDirtyQuota_; }
+        // Tenants sharing the FP index, a tenant has one or more volumes
+        uint32_t getTenantOfVolume(uint32_t volumeId) {
+          return volumeId < volumeTenants_.size() ? volumeTenants_[volumeId] : volumeId;
+        }
+        uint32_t getnTenants() {
+          uint32_t nTenants = 0;
+          for (uint32_t volumeId = 0; volumeId < getnVolumes(); ++volumeId) {
+            nTenants = std::max(nTenants, getTenantOfVolume(volumeId) + 1);
+          }
+          return nTenants;
+        }
+        uint32_t getTenantShare(uint32_t tenantId) {
+          return tenantId < tenantShares_.size() ? tenantShares_[tenantId] : 100;
+        }
+        uint32_t getTenantReservation(uint32_t tenantId) {
+          return tenantId < tenantReservations_.size() ? tenantReservations_[tenantId] : 0;
+        }
+        // Sequential streams longer than the cutoff bypass the cache
+        uint64_t getSequentialCutoff() { return sequentialCutoff_; }
+        uint32_t getnSequentialStreams() { return nSequentialStreams_; }
+        uint32_t getAdmissionThreshold() { return admissionThreshold_; }
+        uint32_t getReadAheadChunks() { return readAheadChunks_; }
+        uint64_t getReadAheadBufferSize() { return readAheadBufferSize_; }
+        uint64_t getWriteCoalescingBufferSize() { return writeCoalescingBufferSize_; }
+
+        // Memory of the indexes and sketches
+        uint64_t getIndexPageSize() { return indexPageSize_; }
+        IndexNumaPolicyEnum getIndexNumaPolicy() { return indexNumaPolicy_; }
 
         uint32_t getWeuSize() { return weuSize_; }
 
+        // Write-back flushing
+        uint32_t getnFlushThreads() { return nFlushThreads_; }
+        uint64_t getDirtyHighWatermark() {
+          return dirtyHighWatermark_ != 0 ? dirtyHighWatermark_ : cacheDeviceSize_ / 2;
+        }
+        uint64_t getDirtyLowWatermark() {
+          return dirtyLowWatermark_ != 0 ? dirtyLowWatermark_ : getDirtyHighWatermark() / 2;
+        }
+        uint64_t getStagingBufferSize() { return stagingBufferSize_; }
+
+        // Log-structured cache data layout (ACDC)
+        uint32_t getSegmentSize() { return segmentSize_; }
+        uint32_t getLogOverProvisioning() { return logOverProvisioning_; }
+        // The log spans the cache data area plus the over-provisioned segments
+        uint32_t getnLogSegments() {
+          uint32_t nSegments = cacheDeviceSize_ / segmentSize_;
+          return nSegments + std::max(nSegments * logOverProvisioning_ / 100, 2u);
+        }
+
         // setters
         void setFingerprintLength(uint32_t ca_length) { fingerprintLen_ = ca_length; }
         void setPrimaryDeviceSize(uint64_t primary_device_size) { primaryDeviceSize_ = primary_device_size; }
@@ -135,28 +197,57 @@ namespace cache {
         void setChunkSize(uint32_t v) { chunkSize_ = v; }
         void setnThreads(uint32_t v) { maxNumGlobalThreads_ = v; }
 
-        void setCacheDeviceName(char *cache_device_name) { cacheDeviceName_ = cache_device_name; }
-        void setPrimaryDeviceName(char *primary_device_name) { primaryDeviceName_ = primary_device_name; }
+        void setCacheDeviceName(char *cache_device_name) { cacheDeviceNames_.assign(1, cache_device_name); }
+        void addCacheDeviceName(char *cache_device_name) { cacheDeviceNames_.push_back(cache_device_name); }
+        void setMetadataDeviceName(char *metadata_device_name) { metadataDeviceName_ = metadata_device_name; }
+        void setCacheStripeSize(uint32_t v) { cacheStripeSize_ = v; }
+        void setPrimaryDeviceName(char *primary_device_name) { primaryDeviceNames_.assign(1, primary_device_name); }
+        void addPrimaryDeviceName(char *primary_device_name) { primaryDeviceNames_.push_back(primary_device_name); }
+        void setVolumeDirtyQuota(uint64_t v) { volumeDirtyQuota_ = v; }
+        void setVolumeTenants(const std::vector<uint32_t> &v) { volumeTenants_ = v; }
+        void setTenantShares(const std::vector<uint32_t> &v) { tenantShares_ = v; }
+        void setTenantReservations(const std::vector<uint32_t> &v) { tenantReservations_ = v; }
+        void setSequentialCutoff(uint64_t v) { sequentialCutoff_ = v; }
+        void setnSequentialStreams(uint32_t v) { nSequentialStreams_ = v; }
+        void setAdmissionThreshold(uint32_t v) { admissionThreshold_ = v; }
+        void setReadAheadChunks(uint32_t v) { readAheadChunks_ = v; }
+        void setReadAheadBufferSize(uint64_t v) { readAheadBufferSize_ = v; }
+        void setWriteCoalescingBufferSize(uint64_t v) { writeCoalescingBufferSize_ = v; }
+        void setIndexPageSize(uint64_t v) { indexPageSize_ = v; }
+        void setIndexNumaPolicy(IndexNumaPolicyEnum v) { indexNumaPolicy_ = v; }
 
         void setWeuSize(uint32_t v) { weuSize_ = v; }
 
+        void setnFlushThreads(uint32_t v) { nFlushThreads_ = v; }
+        void setDirtyHighWatermark(uint64_t v) { dirtyHighWatermark_ = v; }
+        void setDirtyLowWatermark(uint64_t v) { dirtyLowWatermark_ = v; }
+        void setStagingBufferSize(uint64_t v) { stagingBufferSize_ = v; }
+        void setSegmentSize(uint32_t v) { segmentSize_ = v; }
+        void setLogOverProvisioning(uint32_t v) { logOverProvisioning_ = v; }
+
         // Functionality enabler
         void enableMultiThreading(bool v) { enableMultiThreading_ = v; }
+        void enableSharedNothing(bool v) { enableSharedNothing_ = v; }
         void enableDirectIO(bool v) { enableDirectIO_ = v; }
         void enableFakeIO(bool v) { enableFakeIO_ = v; }
         void enableSynthenticCompression(bool v) { enableSynthenticCompression_ = v; }
         void enableTraceReplay(bool v) { enableTraceReplay_ = v; }
         void enableSketchRF(bool v) { enableSketchRF_ = v; }
         void enableCompactCachePolicy(bool v) { enableCompactCachePolicy_ = v; }
+        void enableRecovery(bool v) { enableRecovery_ = v; }
+        void enableLogStructuredLayout(bool v) { enableLogStructuredLayout_ = v; }
         void setCacheMode(CacheModeEnum v) { cacheMode_ = v; }
 
         bool isMultiThreadingEnabled() { return enableMultiThreading_; }
+        bool isSharedNothingEnabled() { return enableSharedNothing_; }
         bool isDirectIOEnabled() { return enableDirectIO_; }
         bool isFakeIOEnabled() { return enableFakeIO_; }
         bool isTraceReplayEnabled() { return enableTraceReplay_; }
         bool isSynthenticCompressionEnabled() { return enableSynthenticCompression_; }
         bool isSketchRFEnabled() { return enableSketchRF_; }
         bool isCompactCachePolicyEnabled() { return enableCompactCachePolicy_; }
+        bool isRecoveryEnabled() { return enableRecovery_; }
+        bool isLogStructuredLayoutEnabled() { return enableLogStructuredLayout_; }
         CacheModeEnum getCacheMode() { return cacheMode_; }
 
         void setFingerprint(uint64_t lba, char *fingerprint) {
@@ -165,12 +256,19 @@ namespace cache {
           lba2Fingerprints_[lba] = fp;
         }
 
-        void getFingerprint(uint64_t lba, char *fingerprint) {
+        bool getFingerprint(uint64_t lba, char *fingerprint) {
           std::lock_guard<std::mutex> lock(mutex_);
           if (lba2Fingerprints_.find(lba) != lba2Fingerprints_.end()) {
             memcpy(fingerprint, lba2Fingerprints_[lba].v_, sizeof(char) * fingerprintLen_);
             lba2Fingerprints_.erase(lba);
+            return true;
           }
+          return false;
+        }
+
+        void eraseFingerprint(uint64_t lba) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          lba2Fingerprints_.erase(lba);
         }
 
     private:
@@ -222,10 +320,19 @@ namespace cache {
         // Multi threading related
         uint32_t maxNumGlobalThreads_ = 8;
         bool     enableMultiThreading_;
+        // Route every request to the thread owning the LBA index buckets of
+        // its chunk, through a lock-free ring per thread, instead of sharing
+        // one job queue (multi-threading only). See PartitionedWorkers.
+        bool     enableSharedNothing_ = false;
 
         // io related
-        char *primaryDeviceName_;
-        char *cacheDeviceName_;
+        // Each primary device is a volume, all of primaryDeviceSize_
+        std::vector<char *> primaryDeviceNames_;
+        // Several cache devices share the cache (device size is the total);
+        // the on-ssd metadata can be placed on a separate device.
+        std::vector<char *> cacheDeviceNames_;
+        char *metadataDeviceName_ = nullptr;
+        uint32_t cacheStripeSize_ = 0;
         uint64_t primaryDeviceSize_;
         uint64_t workingSetSize_;
         uint64_t cacheDeviceSize_;
@@ -239,8 +346,75 @@ namespace cache {
         bool enableTraceReplay_ = true;
         CacheModeEnum cacheMode_ = tWriteThrough;
 
+        // Write-back flushing related
+        // Dirty bytes are counted as the bytes to be written to the primary
+        // device (i.e., chunk size per dirty LBA). Flushers start at the high
+        // watermark and stop at the low one; unset (0), they are half of the
+        // cache device size and half of the high watermark.
+        uint32_t nFlushThreads_ = 1;
+        uint64_t dirtyHighWatermark_ = 0;
+        uint64_t dirtyLowWatermark_ = 0;
+        // Dirty chunks evicted from the cache are copied into a staging buffer
+        // of this size and written back in the background. When it is full
+        // (or the size is 0), evictions write back synchronously.
+        uint64_t stagingBufferSize_ = 32 * 1024 * 1024ull;
+        // A volume with this many dirty bytes (0 for no limit) has its
+        // further writes written through, so that one volume cannot fill
+        // the cache with dirty data.
+        uint64_t volumeDirtyQuota_ = 0;
+
+        // Tenant of each volume (default: its volume id), and per tenant the
+        // share (default 100) and the reservation (default 0) of the FP
+        // slots, in percent. Only the ACDC FP index with the compact cache
+        // policy honours them, as soft eviction priorities (see
+        // TenantManager). The LRU fallback and the CacheDedup builds (DLRU,
+        // DARC, CDARC, BUCKETDLRU) ignore them.
+        std::vector<uint32_t> volumeTenants_;
+        std::vector<uint32_t> tenantShares_;
+        std::vector<uint32_t> tenantReservations_;
+
+        // Requests continuing a sequential stream of at least this many bytes
+        // (0 to disable) go to the primary device without being admitted into
+        // the cache; nSequentialStreams_ streams are tracked at a time.
+        uint64_t sequentialCutoff_ = 0;
+        uint32_t nSequentialStreams_ = 16;
+
+        // A read miss is admitted into the cache only once the estimated
+        // access frequency of its lba reaches this threshold (0 admits every
+        // miss, 2 admits blocks at their second access). See AdmissionFilter.
+        uint32_t admissionThreshold_ = 0;
+
+        // Sequential read misses read up to this many following chunks from
+        // the primary device at once (0 to disable), kept in a buffer of
+        // readAheadBufferSize_ bytes until they are read. See ReadAhead.
+        uint32_t readAheadChunks_ = 0;
+        uint64_t readAheadBufferSize_ = 4 * 1024 * 1024ull;
+
+        // Writes smaller than a chunk are merged in a buffer of this many
+        // bytes until they cover whole chunks; the remaining chunks are
+        // completed by read-modify-write (0 to do so right away). See
+        // WriteCoalescer.
+        uint64_t writeCoalescingBufferSize_ = 1024 * 1024ull;
+
+        // Back the index buckets and sketches with pages of this size (2 MiB
+        // or 1 GiB, 0 for the heap), and interleave or partition them over
+        // the NUMA nodes. See IndexMemory.
+        uint64_t indexPageSize_ = 0;
+        IndexNumaPolicyEnum indexNumaPolicy_ = tIndexNumaNone;
+
         bool enableCompactCachePolicy_ = true;
 
+        // Rebuild the indexes from the on-ssd metadata when the cache starts
+        bool enableRecovery_ = false;
+
+        // Append cached data to segments of a log instead of placing it at the
+        // position of its FP slots. The log has logOverProvisioning_ percent
+        // (at least two) more segments than the cache data area so that the
+        // cleaner always finds space to relocate live data.
+        bool enableLogStructuredLayout_ = false;
+        uint32_t segmentSize_ = 2 * 1024 * 1024;
+        uint32_t logOverProvisioning_ = 10;
+
         // Used when replaying trace, for each request, we would fill in the fingerprint value
         // specified in the trace rather than the computed one.
         std::map<uint64_t, Fingerprint> lba2Fingerprints_;
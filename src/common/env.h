@@ -2,4 +2,4 @@
 //#define CACHE_DEDUP
 //#define DARC
 //#define DLRU
-#define MAX_NUM_LBAS_PER_CACHED_CHUNK 60u
+#define MAX_NUM_LBAS_PER_CACHED_CHUNK 29u
@@ -6,11 +6,65 @@
 #include <map>
 #include <cassert>
 #include "metadata/cachededup/common.h"
+#include "metadata/index_memory.h"
+#include "utils/per_thread.h"
+#include "utils/timer.h"
 namespace cache {
+  /*
+   * A counter of Stats kept in a block per thread (see PerThread), so that
+   * adding to it is a plain store to a cache line of the calling thread.
+   * Reading it sums the blocks of all threads, which is meant for dumps and
+   * not for the data path.
+   */
+  class StatsCounter {
+    public:
+      static const uint32_t kMaxCounters = 1024;
+
+      StatsCounter() : _id(_n_counters().fetch_add(1, std::memory_order_relaxed)) {
+        assert(_id < kMaxCounters);
+      }
+      StatsCounter(const StatsCounter &) = delete;
+      StatsCounter &operator=(const StatsCounter &) = delete;
+
+      inline void add(uint64_t v) {
+        PerThread<Block>::add(PerThread<Block>::local()._counts[_id], v);
+      }
+      uint64_t load() const {
+        uint64_t v = 0;
+        PerThread<Block>::forEach([&](Block &block) {
+          v += block._counts[_id].load(std::memory_order_relaxed);
+        });
+        return v;
+      }
+      operator uint64_t() const { return load(); }
+
+      // Zero every counter in the blocks of all threads
+      static void resetAll() {
+        PerThread<Block>::forEach([](Block &block) { block.reset(); });
+      }
+
+    private:
+      struct Block {
+        std::atomic<uint64_t> _counts[kMaxCounters];
+        Block() { reset(); }
+        void reset() {
+          for (auto &count : _counts) {
+            count.store(0, std::memory_order_relaxed);
+          }
+        }
+      };
+      static std::atomic<uint32_t> &_n_counters() {
+        static std::atomic<uint32_t> n(0);
+        return n;
+      }
+
+      const uint32_t _id;
+  };
+
   /*
    * class Stats is used to statistic in the data path.
-   * It is a singleton class with std::atomic to ensure
-   * thread-safety.
+   * It is a singleton class; counters are StatsCounter, and the levels that
+   * are set rather than added (dirty bytes, queue depths) are std::atomic.
    */
 struct Stats {
   public:
@@ -56,16 +110,173 @@ struct Stats {
                 << "    Num bytes read from hdd: " << _n_bytes_read_from_hdd << std::endl
                 << std::endl;
 
+      if (Config::getInstance().getCacheMode() == tWriteBack) {
+        uint64_t nFlushWrites = _n_flush_writes_to_hdd;
+        std::cout << std::fixed << std::setprecision(2) << "Write-back statistics: " << std::endl
+                  << "    Num lbas flushed by flushers: " << _n_lbas_flushed << std::endl
+                  << "    Num lbas flushed on eviction: " << _n_lbas_flushed_on_eviction << std::endl
+                  << "    Num flush writes to hdd: " << nFlushWrites << std::endl
+                  << "    Num dirty lbas not written back: " << _n_lbas_not_written_back << std::endl
+                  << "    Avg flush write size (KiB): " << (nFlushWrites == 0 ? 0 : _n_bytes_flushed_to_hdd / 1024.0 / nFlushWrites) << std::endl
+                  << "    Flush throughput per flusher (MBytes/s): " << (_time_elapsed_flush == 0 ? 0 : _n_bytes_flushed_to_hdd * 1.0 / _time_elapsed_flush) << std::endl
+                  << "    Dirty bytes (current): " << _n_dirty_bytes << std::endl
+                  << "    Dirty bytes (peak): " << _max_dirty_bytes << std::endl
+                  << "    Num lbas staged on eviction: " << _n_lbas_staged << std::endl
+                  << "    Num lbas destaged: " << _n_lbas_destaged << std::endl
+                  << "    Num staged lbas superseded: " << _n_lbas_staged_superseded << std::endl
+                  << "    Num reads served from staging: " << _n_reads_from_staging << std::endl
+                  << "    Num evictions with staging full: " << _n_staging_full << std::endl
+                  << "    Staged bytes (peak): " << _max_staged_bytes << std::endl
+                  << std::endl;
+      }
+
+      if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+        uint64_t nBytesAppended = _n_bytes_appended_to_log;
+        std::cout << std::fixed << std::setprecision(2) << "Log-structured layout statistics: " << std::endl
+                  << "    Num bytes appended to log: " << nBytesAppended << std::endl
+                  << "    Num segments cleaned: " << _n_segments_cleaned << std::endl
+                  << "    Num chunks relocated by cleaner: " << _n_chunks_relocated << std::endl
+                  << "    Num bytes relocated by cleaner: " << _n_bytes_relocated << std::endl
+                  << "    Num chunks evicted by cleaner: " << _n_chunks_evicted_by_cleaner << std::endl
+                  << "    Cleaner write amplification: " << (nBytesAppended == 0 ? 0 : (nBytesAppended + _n_bytes_relocated) * 1.0 / nBytesAppended) << std::endl
+                  << std::endl;
+      }
+
+      uint32_t nCacheDevices = Config::getInstance().getnCacheDevices()
+        + (Config::getInstance().getMetadataDeviceName() != nullptr);
+      if (nCacheDevices > 1) {
+        std::cout << "Cache device statistics: " << std::endl;
+        for (uint32_t deviceId = 0; deviceId < nCacheDevices && deviceId < kMaxCacheDevices; ++deviceId) {
+          auto &device = _cache_devices[deviceId];
+          std::cout << "    Device " << deviceId
+                    << (deviceId == Config::getInstance().getnCacheDevices() ? " (metadata)" : "") << ": "
+                    << "reads " << device._n_reads << " (" << device._n_bytes_read << " bytes), "
+                    << "writes " << device._n_writes << " (" << device._n_bytes_written << " bytes), "
+                    << "max queue depth " << device._max_queue_depth << std::endl;
+        }
+        std::cout << "    Num requests split across stripes: " << _n_requests_split << std::endl
+                  << std::endl;
+      }
+
+      if (Config::getInstance().getnVolumes() > 1) {
+        std::cout << std::fixed << std::setprecision(2) << "Volume statistics: " << std::endl;
+        for (uint32_t volumeId = 0; volumeId < Config::getInstance().getnVolumes() && volumeId < kMaxVolumes; ++volumeId) {
+          auto &volume = _volumes[volumeId];
+          uint64_t nReads = volume._n_reads, nWrites = volume._n_writes;
+          std::cout << "    Volume " << volumeId << ": "
+                    << "reads " << nReads << " (hit ratio " << (nReads == 0 ? 0 : volume._n_read_hits * 100.0 / nReads) << "%), "
+                    << "writes " << nWrites << " (dup ratio " << (nWrites == 0 ? 0 : volume._n_write_dups * 100.0 / nWrites) << "%), "
+                    << "written through over quota " << volume._n_writes_through << ", "
+                    << "dirty bytes " << volume._n_dirty_bytes << std::endl;
+        }
+        std::cout << std::endl;
+      }
+
+      if (Config::getInstance().getnTenants() > 1) {
+        std::cout << std::fixed << std::setprecision(2) << "Tenant statistics: " << std::endl;
+        for (uint32_t tenantId = 0; tenantId < Config::getInstance().getnTenants() && tenantId < kMaxVolumes; ++tenantId) {
+          uint64_t nReads = 0, nReadHits = 0, nWrites = 0, nWriteDups = 0;
+          for (uint32_t volumeId = 0; volumeId < Config::getInstance().getnVolumes() && volumeId < kMaxVolumes; ++volumeId) {
+            if (Config::getInstance().getTenantOfVolume(volumeId) == tenantId) {
+              nReads += _volumes[volumeId]._n_reads;
+              nReadHits += _volumes[volumeId]._n_read_hits;
+              nWrites += _volumes[volumeId]._n_writes;
+              nWriteDups += _volumes[volumeId]._n_write_dups;
+            }
+          }
+          std::cout << "    Tenant " << tenantId << ": "
+                    << "hit ratio " << (nReads == 0 ? 0 : nReadHits * 100.0 / nReads) << "%, "
+                    << "dup ratio " << (nWrites == 0 ? 0 : nWriteDups * 100.0 / nWrites) << "%, "
+                    << "occupied bytes " << _tenant_occupied_bytes[tenantId] << std::endl;
+        }
+        std::cout << std::endl;
+      }
+
+      if (Config::getInstance().getSequentialCutoff() != 0) {
+        uint64_t nReads = _n_read_hit + _n_read_not_hit, nReadsCached = nReads - _n_reads_bypassed;
+        std::cout << std::fixed << std::setprecision(2) << "Sequential bypass statistics: " << std::endl
+                  << "    Num reads bypassed: " << _n_reads_bypassed << std::endl
+                  << "        Num bypassed reads served from cache: " << _n_read_hits_bypassed << std::endl
+                  << "    Num writes bypassed: " << _n_writes_bypassed << std::endl
+                  << "    Num sequential writes to cached lbas: " << _n_sequential_writes_cached << std::endl
+                  << "    Num bytes bypassed: " << _n_bytes_bypassed << std::endl
+                  << "    Hit ratio of non-bypassed reads: " << (nReadsCached == 0 ? 0 :
+                       (_n_read_hit - _n_read_hits_bypassed) * 100.0 / nReadsCached) << "%" << std::endl
+                  << std::endl;
+      }
+
+      if (Config::getInstance().getAdmissionThreshold() != 0) {
+        std::cout << "Admission statistics: " << std::endl
+                  << "    Num read misses admitted: " << _n_read_misses_admitted << std::endl
+                  << "    Num read misses not admitted: " << _n_read_misses_not_admitted << std::endl
+                  << "    Num bytes not admitted: " << _n_bytes_not_admitted << std::endl
+                  << "    Num times a shard of the frequencies was aged: " << _n_admission_filter_aged << std::endl
+                  << std::endl;
+      }
+
+      if (Config::getInstance().getReadAheadChunks() != 0) {
+        uint64_t nChunksReadAhead = _n_chunks_read_ahead;
+        std::cout << std::fixed << std::setprecision(2) << "Read-ahead statistics: " << std::endl
+                  << "    Num read-ahead reads: " << _n_read_aheads << std::endl
+                  << "    Num chunks read ahead: " << nChunksReadAhead << std::endl
+                  << "    Num chunks read ahead used: " << _n_read_ahead_hits << std::endl
+                  << "    Num chunks read ahead wasted: " << _n_read_ahead_wasted << std::endl
+                  << "    Read-ahead accuracy: " << (nChunksReadAhead == 0 ? 0 : _n_read_ahead_hits * 100.0 / nChunksReadAhead) << "%" << std::endl
+                  << std::endl;
+      }
+
+      uint64_t nBytesRequested = _n_bytes_requested;
+      std::cout << std::fixed << std::setprecision(2) << "Copy statistics: " << std::endl
+                << "    Num bytes requested: " << nBytesRequested << std::endl
+                << "    Num copies: " << _n_copies << std::endl
+                << "    Num bytes copied: " << _n_bytes_copied << std::endl
+                << "    Bytes copied per byte requested: " << (nBytesRequested == 0 ? 0 : _n_bytes_copied * 1.0 / nBytesRequested) << std::endl
+                << std::endl;
+
+      uint64_t nBuffersAcquired = _n_buffers_acquired;
+      std::cout << std::fixed << std::setprecision(2) << "Buffer pool statistics: " << std::endl
+                << "    Num buffers acquired: " << nBuffersAcquired << std::endl
+                << "    Thread cache hit ratio: " << (nBuffersAcquired == 0 ? 0 : _n_buffers_from_thread_caches * 100.0 / nBuffersAcquired) << "%" << std::endl
+                << "    Pool hit ratio: " << (nBuffersAcquired == 0 ? 0 : (_n_buffers_from_thread_caches + _n_buffers_from_pool) * 100.0 / nBuffersAcquired) << "%" << std::endl
+                << "    Num slabs (huge pages reserved): " << _n_buffer_slabs << " (" << _n_buffer_slabs_hugetlb << ")" << std::endl
+                << std::endl;
+
+      if (_n_ordered_requests != 0) {
+        std::cout << "Ordering statistics: " << std::endl
+                  << "    Num ordered requests: " << _n_ordered_requests << std::endl
+                  << "    Num requests waiting for earlier ones to the same chunk: " << _n_ordered_requests_waited << std::endl
+                  << std::endl;
+      }
+
+      if (Config::getInstance().getIndexPageSize() != 0
+          || Config::getInstance().getIndexNumaPolicy() != tIndexNumaNone) {
+        std::cout << "Index memory statistics: " << std::endl
+                  << "    Index page size: " << Config::getInstance().getIndexPageSize() << std::endl
+                  << "    Num NUMA nodes: " << IndexMemory::getnNodes() << std::endl
+                  << "    Num bytes mapped (huge pages reserved): " << _n_index_bytes << " (" << _n_index_bytes_hugetlb << ")" << std::endl
+                  << std::endl;
+      }
+
+      if (_n_partial_reads + _n_partial_writes != 0) {
+        std::cout << "Partial chunk statistics: " << std::endl
+                  << "    Num partial chunk reads: " << _n_partial_reads << std::endl
+                  << "    Num partial chunk reads served from the coalescing buffer: " << _n_partial_reads_buffered << std::endl
+                  << "    Num partial chunk writes: " << _n_partial_writes << std::endl
+                  << "    Num chunks completed by coalesced writes: " << _n_chunks_coalesced << std::endl
+                  << "    Num chunks completed by read-modify-write: " << _n_chunks_read_modify_written << std::endl
+                  << std::endl;
+      }
+
       std::cout << std::fixed << std::setprecision(0) << "Time Elapsed: " << std::endl
-                << "    Time elpased for compression: " << _time_elapsed_compression << std::endl
-                << "    Time elpased for decompression: " << _time_elapsed_decompression << std::endl
-                << "    Time elpased for computeFingerprint: " << _time_elapsed_fingerprinting << std::endl
-                << "    Time elpased for dedup: " << _time_elapsed_dedup << std::endl
-                << "    Time elpased for lookup: " << _time_elapsed_lookup << std::endl
-                << "    Time elpased for update_index: " << _time_elapsed_update_index << std::endl
-                << "    Time elpased for io_ssd: " << _time_elapsed_io_ssd << std::endl
-                << "    Time elpased for io_hdd: " << _time_elapsed_io_hdd << std::endl
-                << "    Time elpased for debug: " << _time_elapsed_debug << std::endl
+                << "    Time elpased for compression: " << get_time_elapsed_compression() << std::endl
+                << "    Time elpased for decompression: " << get_time_elapsed_decompression() << std::endl
+                << "    Time elpased for computeFingerprint: " << get_time_elapsed_fingerprinting() << std::endl
+                << "    Time elpased for dedup: " << get_time_elapsed_dedup() << std::endl
+                << "    Time elpased for lookup: " << get_time_elapsed_lookup() << std::endl
+                << "    Time elpased for update_index: " << get_time_elapsed_update_index() << std::endl
+                << "    Time elpased for io_ssd: " << get_time_elapsed_io_ssd() << std::endl
+                << "    Time elpased for io_hdd: " << get_time_elapsed_io_hdd() << std::endl
+                << "    Time elpased for debug: " << get_time_elapsed_debug() << std::endl
                 << std::endl;
 
       std::cout << std::setprecision(2) << "Overall Stats: " << std::endl
@@ -84,19 +295,19 @@ struct Stats {
 
     inline void addReadLookupStatistics(Chunk &c) {
       if (c.lookupResult_ == HIT) {
-        _n_read_hit.fetch_add(1, std::memory_order_relaxed);
+        _n_read_hit.add(1);
       } else if (c.lookupResult_ == NOT_HIT) {
-        _n_read_not_hit.fetch_add(1, std::memory_order_relaxed);
+        _n_read_not_hit.add(1);
 
         if (c.hitLBAIndex_ == false) {
-          _n_read_not_hit_lba_not_hit.fetch_add(1, std::memory_order_relaxed);
+          _n_read_not_hit_lba_not_hit.add(1);
         } else {
           if (c.hitFPIndex_ == false) {
-            _n_read_not_hit_ca_not_hit.fetch_add(1, std::memory_order_relaxed);
+            _n_read_not_hit_ca_not_hit.add(1);
           } else {
             // read request only match LBA
             if (c.verficationResult_ == BOTH_LBA_AND_FP_NOT_VALID) {
-              _n_read_not_hit_lba_not_match.fetch_add(1, std::memory_order_relaxed);
+              _n_read_not_hit_lba_not_match.add(1);
             } else {
               std::cout << c.hasFingerprint_ << std::endl;
               std::cout << c.verficationResult_ << std::endl;
@@ -109,32 +320,32 @@ struct Stats {
 
     inline void add_read_post_dedup_stat(Chunk &c) {
       if (c.dedupResult_ == DUP_CONTENT) {
-        _n_read_not_hit_dup_content.fetch_add(1, std::memory_order_relaxed);
+        _n_read_not_hit_dup_content.add(1);
       } else {
-        _n_read_not_hit_not_dup.fetch_add(1, std::memory_order_relaxed);
+        _n_read_not_hit_not_dup.add(1);
         if (c.hitFPIndex_ == false) {
-          _n_read_not_hit_not_dup_ca_not_hit.fetch_add(1, std::memory_order_relaxed);
+          _n_read_not_hit_not_dup_ca_not_hit.add(1);
         } else {
           if (c.verficationResult_ == BOTH_LBA_AND_FP_NOT_VALID
               || c.verficationResult_ == ONLY_LBA_VALID) {
-            _n_read_not_hit_not_dup_ca_not_match.fetch_add(1, std::memory_order_relaxed);
+            _n_read_not_hit_not_dup_ca_not_match.add(1);
           }
         }
       }
     }
 
     inline void add_write_stat(Chunk &c) {
-      _n_write.fetch_add(1, std::memory_order_relaxed);
+      _n_write.add(1);
       if (c.dedupResult_ == DUP_CONTENT) {
-        _n_write_dup_content.fetch_add(1, std::memory_order_relaxed);
+        _n_write_dup_content.add(1);
       } else if (c.dedupResult_ == NOT_DUP) {
-        _n_write_not_dup.fetch_add(1, std::memory_order_relaxed);
+        _n_write_not_dup.add(1);
         if (!c.hitFPIndex_) {
-          _n_write_not_dup_ca_not_hit.fetch_add(1, std::memory_order_relaxed);
+          _n_write_not_dup_ca_not_hit.add(1);
         } else {
           if (c.verficationResult_ == BOTH_LBA_AND_FP_NOT_VALID
               || c.verficationResult_ == ONLY_LBA_VALID) {
-            _n_write_not_dup_ca_not_match.fetch_add(1, std::memory_order_relaxed);
+            _n_write_not_dup_ca_not_match.add(1);
           }
         }
       }
@@ -155,15 +366,15 @@ struct Stats {
      *                                        |
      *                                        - ca hit but not match
      */
-    std::atomic<uint64_t> _n_write;
-    std::atomic<uint64_t> _n_write_dup_content;
-    std::atomic<uint64_t> _n_write_not_dup;
+    StatsCounter _n_write;
+    StatsCounter _n_write_dup_content;
+    StatsCounter _n_write_not_dup;
 
     // write and lba index information
     // ca not hit - the entry has never shown before or been evicted already
     // ca not match - reflect the number of collision
-    std::atomic<uint64_t> _n_write_not_dup_ca_not_hit;
-    std::atomic<uint64_t> _n_write_not_dup_ca_not_match;
+    StatsCounter _n_write_not_dup_ca_not_hit;
+    StatsCounter _n_write_not_dup_ca_not_match;
 
     /*
      * Read - consist of +-- hit     - cause - lba hit, ca hit, and lba match
@@ -179,35 +390,35 @@ struct Stats {
      */
     // n_read_hit + n_read_not_hit = n_read
     // n_read_not_hit_dup_content + n_read_not_hit_not_dup = n_read_not_hit
-    std::atomic<uint64_t> _n_read_hit;
-    std::atomic<uint64_t> _n_read_not_hit;
-    std::atomic<uint64_t> _n_read_not_hit_dup_content;
-    std::atomic<uint64_t> _n_read_not_hit_not_dup;
+    StatsCounter _n_read_hit;
+    StatsCounter _n_read_not_hit;
+    StatsCounter _n_read_not_hit_dup_content;
+    StatsCounter _n_read_not_hit_not_dup;
 
     // read and index information
     // lba not hit - the entry has never shown before or been evicted already
     // ca not hit - the entry must be evicted already (ca -> dp is the most critical one that affects hit ratio)
     // lba not match - lba collision happens (lba sig collision may cause eviction or cause 
-    std::atomic<uint64_t> _n_read_not_hit_lba_not_hit;
-    std::atomic<uint64_t> _n_read_not_hit_ca_not_hit;
-    std::atomic<uint64_t> _n_read_not_hit_lba_not_match;
+    StatsCounter _n_read_not_hit_lba_not_hit;
+    StatsCounter _n_read_not_hit_ca_not_hit;
+    StatsCounter _n_read_not_hit_lba_not_match;
 
     // ca not hit - the entry has never shown before or been evicted already
     // ca not match - reflect the number of collision
     // Note: ca not match causes a invalidation of the corresponding entry
-    std::atomic<uint64_t> _n_read_not_hit_not_dup_ca_not_hit;
-    std::atomic<uint64_t> _n_read_not_hit_not_dup_ca_not_match;
+    StatsCounter _n_read_not_hit_not_dup_ca_not_hit;
+    StatsCounter _n_read_not_hit_not_dup_ca_not_match;
 
     /*
-     * Time Elapsed. Time consumed by each part of the system
+     * Time Elapsed. Time consumed by each part of the system, summed in
+     * Timer ticks and converted to microseconds when read
      */
 #define _(str) \
-    uint64_t _time_elapsed_##str; \
-    inline void add_time_elapsed_##str(uint64_t v) {\
-      _time_elapsed_##str += v; \
-    }
-    //std::atomic<double> _time_elapsed_##str;
-    //_time_elapsed_##str.fetch_add(v, std::memory_order_relaxed);
+    StatsCounter _ticks_elapsed_##str; \
+    inline void add_time_elapsed_##str(uint64_t ticks) {\
+      _ticks_elapsed_##str.add(ticks); \
+    } \
+    inline uint64_t get_time_elapsed_##str() { return Timer::toUs(_ticks_elapsed_##str); }
     _(compression);
     _(decompression);
     _(fingerprinting);
@@ -220,79 +431,300 @@ struct Stats {
 #undef _
 
     // compression level
-    std::atomic<int> _compress_level[4];
+    StatsCounter _compress_level[4];
 
     // stats in write buffer
-    std::atomic<uint64_t> _n_bytes_written_to_write_buffer;
-    std::atomic<uint64_t> _n_bytes_read_from_write_buffer;
+    StatsCounter _n_bytes_written_to_write_buffer;
+    StatsCounter _n_bytes_read_from_write_buffer;
 
     // describe the total number of bytes should be written without dedup and compression
-    std::atomic<uint64_t> _n_total_bytes_written_to_ssd; 
-    std::atomic<uint64_t> _n_data_bytes_written_to_ssd;
-    std::atomic<uint64_t> _n_data_bytes_read_from_ssd;
+    StatsCounter _n_total_bytes_written_to_ssd; 
+    StatsCounter _n_data_bytes_written_to_ssd;
+    StatsCounter _n_data_bytes_read_from_ssd;
+
+    StatsCounter _n_metadata_bytes_written_to_ssd;
+    StatsCounter _n_metadata_bytes_read_from_ssd;
+
+    StatsCounter _n_bytes_written_to_hdd;
+    StatsCounter _n_bytes_read_from_hdd;
+
+    inline void add_bytes_written_to_write_buffer(uint64_t v) { _n_bytes_written_to_write_buffer.add(v); }
+    inline void add_bytes_read_from_write_buffer(uint64_t v) {  _n_bytes_read_from_write_buffer.add(v); }
+
+    inline void add_total_bytes_written_to_ssd(uint64_t v) { _n_total_bytes_written_to_ssd.add(v); }
+    inline void add_bytes_written_to_ssd(uint64_t v) {   _n_data_bytes_written_to_ssd.add(v); }
+    inline void add_bytes_read_from_ssd(uint64_t v) {    _n_data_bytes_read_from_ssd.add(v); }
+
+    inline void add_metadata_bytes_written_to_ssd(uint64_t v) {   _n_metadata_bytes_written_to_ssd.add(v); }
+    inline void add_metadata_bytes_read_from_ssd(uint64_t v) {    _n_metadata_bytes_read_from_ssd.add(v); }
+
+    inline void add_bytes_written_to_hdd(uint64_t v) { _n_bytes_written_to_hdd.add(v); }
+    inline void add_bytes_read_from_hdd(uint64_t v) {  _n_bytes_read_from_hdd.add(v); }
+
+    // write-back flushing
+    StatsCounter _n_lbas_flushed;
+    StatsCounter _n_lbas_flushed_on_eviction;
+    StatsCounter _n_flush_writes_to_hdd;
+    StatsCounter _n_bytes_flushed_to_hdd;
+    StatsCounter _time_elapsed_flush;
+    StatsCounter _n_lbas_not_written_back;
+    std::atomic<uint64_t> _n_dirty_bytes;
+    std::atomic<uint64_t> _max_dirty_bytes;
+
+    inline void add_flush_write_to_hdd(uint64_t nLbas, uint64_t nBytes) {
+      _n_lbas_flushed.add(nLbas);
+      _n_flush_writes_to_hdd.add(1);
+      _n_bytes_flushed_to_hdd.add(nBytes);
+    }
+    inline void add_lbas_flushed_on_eviction(uint64_t v) { _n_lbas_flushed_on_eviction.add(v); }
+    inline void add_time_elapsed_flush(uint64_t v) { _time_elapsed_flush.add(v); }
+    inline void add_lbas_not_written_back(uint64_t v) { _n_lbas_not_written_back.add(v); }
+    // staging of evicted dirty chunks
+    StatsCounter _n_lbas_staged;
+    StatsCounter _n_lbas_destaged;
+    StatsCounter _n_lbas_staged_superseded;
+    StatsCounter _n_reads_from_staging;
+    StatsCounter _n_staging_full;
+    std::atomic<uint64_t> _n_staged_bytes;
+    std::atomic<uint64_t> _max_staged_bytes;
+
+    inline void add_lbas_staged(uint64_t v) { _n_lbas_staged.add(v); }
+    inline void add_lbas_destaged(uint64_t v) { _n_lbas_destaged.add(v); }
+    inline void add_lbas_staged_superseded(uint64_t v) { _n_lbas_staged_superseded.add(v); }
+    inline void add_reads_from_staging(uint64_t v) { _n_reads_from_staging.add(v); }
+    inline void add_staging_full(uint64_t v) { _n_staging_full.add(v); }
+    inline void set_staged_bytes(uint64_t v) {
+      _n_staged_bytes.store(v, std::memory_order_relaxed);
+      if (v > _max_staged_bytes.load(std::memory_order_relaxed)) {
+        _max_staged_bytes.store(v, std::memory_order_relaxed);
+      }
+    }
+    inline void set_dirty_bytes(uint64_t v) {
+      _n_dirty_bytes.store(v, std::memory_order_relaxed);
+      if (v > _max_dirty_bytes.load(std::memory_order_relaxed)) {
+        _max_dirty_bytes.store(v, std::memory_order_relaxed);
+      }
+    }
+
+    // log-structured layout
+    StatsCounter _n_bytes_appended_to_log;
+    StatsCounter _n_segments_cleaned;
+    StatsCounter _n_chunks_relocated;
+    StatsCounter _n_bytes_relocated;
+    StatsCounter _n_chunks_evicted_by_cleaner;
+
+    inline void add_bytes_appended_to_log(uint64_t v) { _n_bytes_appended_to_log.add(v); }
+    inline void add_segments_cleaned(uint64_t v) { _n_segments_cleaned.add(v); }
+    inline void add_chunk_relocated(uint64_t nBytes) {
+      _n_chunks_relocated.add(1);
+      _n_bytes_relocated.add(nBytes);
+    }
+    inline void add_chunk_evicted_by_cleaner() {
+      _n_chunks_evicted_by_cleaner.add(1);
+    }
+
+    // per cache device I/O (the metadata device, if any, follows the cache devices)
+    static const uint32_t kMaxCacheDevices = 16;
+    struct CacheDeviceStats {
+      StatsCounter _n_reads;
+      StatsCounter _n_writes;
+      StatsCounter _n_bytes_read;
+      StatsCounter _n_bytes_written;
+      std::atomic<uint32_t> _queue_depth;
+      std::atomic<uint32_t> _max_queue_depth;
+    } _cache_devices[kMaxCacheDevices];
+    StatsCounter _n_requests_split;
+
+    // Count an I/O issued to a cache device; end_cache_device_io when it completes
+    inline void begin_cache_device_io(uint32_t deviceId, bool isWrite, uint32_t len) {
+      auto &device = _cache_devices[deviceId];
+      if (isWrite) {
+        device._n_writes.add(1);
+        device._n_bytes_written.add(len);
+      } else {
+        device._n_reads.add(1);
+        device._n_bytes_read.add(len);
+      }
+      uint32_t queueDepth = device._queue_depth.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (queueDepth > device._max_queue_depth.load(std::memory_order_relaxed)) {
+        device._max_queue_depth.store(queueDepth, std::memory_order_relaxed);
+      }
+    }
+    inline void end_cache_device_io(uint32_t deviceId) {
+      _cache_devices[deviceId]._queue_depth.fetch_sub(1, std::memory_order_relaxed);
+    }
+    inline void add_requests_split(uint64_t v) { _n_requests_split.add(v); }
+
+    // per volume
+    static const uint32_t kMaxVolumes = 64;
+    struct VolumeStats {
+      StatsCounter _n_reads;
+      StatsCounter _n_read_hits;
+      StatsCounter _n_writes;
+      StatsCounter _n_write_dups;
+      StatsCounter _n_writes_through;
+      std::atomic<uint64_t> _n_dirty_bytes;
+    } _volumes[kMaxVolumes];
+
+    inline void add_volume_read(uint32_t volumeId, bool isHit) {
+      _volumes[volumeId]._n_reads.add(1);
+      if (isHit) _volumes[volumeId]._n_read_hits.add(1);
+    }
+    inline void add_volume_write(uint32_t volumeId, bool isDup) {
+      _volumes[volumeId]._n_writes.add(1);
+      if (isDup) _volumes[volumeId]._n_write_dups.add(1);
+    }
+    inline void add_volume_write_through(uint32_t volumeId) {
+      _volumes[volumeId]._n_writes_through.add(1);
+    }
+    inline void set_volume_dirty_bytes(uint32_t volumeId, uint64_t v) {
+      _volumes[volumeId]._n_dirty_bytes.store(v, std::memory_order_relaxed);
+    }
+
+    // per tenant (hit and dup ratios are aggregated from the volumes of a tenant)
+    std::atomic<uint64_t> _tenant_occupied_bytes[kMaxVolumes];
+    inline void set_tenant_occupied_bytes(uint32_t tenantId, uint64_t v) {
+      _tenant_occupied_bytes[tenantId].store(v, std::memory_order_relaxed);
+    }
+
+    // sequential bypass
+    StatsCounter _n_reads_bypassed;
+    StatsCounter _n_read_hits_bypassed;
+    StatsCounter _n_writes_bypassed;
+    StatsCounter _n_sequential_writes_cached;
+    StatsCounter _n_bytes_bypassed;
+    // A sequential read is bypassed on a miss, and served by the cache on a hit
+    inline void add_read_bypassed(bool isHit, uint32_t len) {
+      _n_reads_bypassed.add(1);
+      if (isHit) {
+        _n_read_hits_bypassed.add(1);
+      } else {
+        _n_bytes_bypassed.add(len);
+      }
+    }
+    inline void add_write_bypassed(uint32_t len) {
+      _n_writes_bypassed.add(1);
+      _n_bytes_bypassed.add(len);
+    }
+    inline void add_sequential_write_cached() {
+      _n_sequential_writes_cached.add(1);
+    }
 
-    std::atomic<uint64_t> _n_metadata_bytes_written_to_ssd;
-    std::atomic<uint64_t> _n_metadata_bytes_read_from_ssd;
+    // admission filter
+    StatsCounter _n_read_misses_admitted;
+    StatsCounter _n_read_misses_not_admitted;
+    StatsCounter _n_bytes_not_admitted;
+    StatsCounter _n_admission_filter_aged;
+    inline void add_read_miss_admission(bool isAdmitted, uint32_t len) {
+      if (isAdmitted) {
+        _n_read_misses_admitted.add(1);
+      } else {
+        _n_read_misses_not_admitted.add(1);
+        _n_bytes_not_admitted.add(len);
+      }
+    }
+    inline void add_admission_filter_aged() {
+      _n_admission_filter_aged.add(1);
+    }
 
-    std::atomic<uint64_t> _n_bytes_written_to_hdd;
-    std::atomic<uint64_t> _n_bytes_read_from_hdd;
+    // read-ahead (chunks still in the buffer are neither used nor wasted)
+    StatsCounter _n_read_aheads;
+    StatsCounter _n_chunks_read_ahead;
+    StatsCounter _n_read_ahead_hits;
+    StatsCounter _n_read_ahead_wasted;
+    inline void add_read_ahead(uint32_t nChunks) {
+      _n_read_aheads.add(1);
+      _n_chunks_read_ahead.add(nChunks);
+    }
+    inline void add_read_ahead_hit() { _n_read_ahead_hits.add(1); }
+    inline void add_read_ahead_wasted() { _n_read_ahead_wasted.add(1); }
+
+    // memory copies of request data: bounce buffers, (de)compression,
+    // partial chunks, and the in-memory buffers of the cache
+    StatsCounter _n_bytes_requested;
+    StatsCounter _n_copies;
+    StatsCounter _n_bytes_copied;
+    inline void add_bytes_requested(uint32_t len) { _n_bytes_requested.add(len); }
+    inline void add_copy(uint64_t len) {
+      _n_copies.add(1);
+      _n_bytes_copied.add(len);
+    }
 
-    inline void add_bytes_written_to_write_buffer(uint64_t v) { _n_bytes_written_to_write_buffer.fetch_add(v, std::memory_order_relaxed); }
-    inline void add_bytes_read_from_write_buffer(uint64_t v) {  _n_bytes_read_from_write_buffer .fetch_add(v, std::memory_order_relaxed); }
+    // buffer pool: acquisitions served by the cache of the thread, by the
+    // shared free lists, or by a new slab
+    StatsCounter _n_buffers_acquired;
+    StatsCounter _n_buffers_from_thread_caches;
+    StatsCounter _n_buffers_from_pool;
+    StatsCounter _n_buffer_slabs;
+    StatsCounter _n_buffer_slabs_hugetlb;
+    inline void add_buffer_acquired(bool isFromThreadCache, bool isPooled) {
+      _n_buffers_acquired.add(1);
+      if (isFromThreadCache) {
+        _n_buffers_from_thread_caches.add(1);
+      } else if (isPooled) {
+        _n_buffers_from_pool.add(1);
+      }
+    }
+    inline void add_buffer_slab(bool isHugeTlb) {
+      _n_buffer_slabs.add(1);
+      if (isHugeTlb) {
+        _n_buffer_slabs_hugetlb.add(1);
+      }
+    }
 
-    inline void add_total_bytes_written_to_ssd(uint64_t v) { _n_total_bytes_written_to_ssd.fetch_add(v, std::memory_order_relaxed); }
-    inline void add_bytes_written_to_ssd(uint64_t v) {   _n_data_bytes_written_to_ssd  .fetch_add(v, std::memory_order_relaxed); }
-    inline void add_bytes_read_from_ssd(uint64_t v) {    _n_data_bytes_read_from_ssd   .fetch_add(v, std::memory_order_relaxed); }
+    // requests ordered per chunk, and those that waited for earlier ones
+    StatsCounter _n_ordered_requests;
+    StatsCounter _n_ordered_requests_waited;
+    inline void add_ordered_request(bool hasWaited) {
+      _n_ordered_requests.add(1);
+      if (hasWaited) {
+        _n_ordered_requests_waited.add(1);
+      }
+    }
 
-    inline void add_metadata_bytes_written_to_ssd(uint64_t v) {   _n_metadata_bytes_written_to_ssd  .fetch_add(v, std::memory_order_relaxed); }
-    inline void add_metadata_bytes_read_from_ssd(uint64_t v) {    _n_metadata_bytes_read_from_ssd   .fetch_add(v, std::memory_order_relaxed); }
+    // memory of the indexes and sketches
+    StatsCounter _n_index_bytes;
+    StatsCounter _n_index_bytes_hugetlb;
+    inline void add_index_memory(uint64_t size, bool isHugeTlb) {
+      _n_index_bytes.add(size);
+      if (isHugeTlb) {
+        _n_index_bytes_hugetlb.add(size);
+      }
+    }
 
-    inline void add_bytes_written_to_hdd(uint64_t v) { _n_bytes_written_to_hdd.fetch_add(v, std::memory_order_relaxed); }
-    inline void add_bytes_read_from_hdd(uint64_t v) {  _n_bytes_read_from_hdd .fetch_add(v, std::memory_order_relaxed); }
+    // partial chunk I/O
+    StatsCounter _n_partial_reads;
+    StatsCounter _n_partial_reads_buffered;
+    StatsCounter _n_partial_writes;
+    StatsCounter _n_chunks_coalesced;
+    StatsCounter _n_chunks_read_modify_written;
+    inline void add_partial_read(bool isBuffered) {
+      _n_partial_reads.add(1);
+      if (isBuffered) {
+        _n_partial_reads_buffered.add(1);
+      }
+    }
+    inline void add_partial_write() { _n_partial_writes.add(1); }
+    inline void add_coalesced_chunk(bool isReadModifyWritten) {
+      if (isReadModifyWritten) {
+        _n_chunks_read_modify_written.add(1);
+      } else {
+        _n_chunks_coalesced.add(1);
+      }
+    }
 
     inline void add_compress_level(int compress_level) 
     {
-      _compress_level[compress_level].fetch_add(1, std::memory_order_relaxed);
+      _compress_level[compress_level].add(1);
     }
 
     void reset() {
-      _n_write.store(0, std::memory_order_relaxed);
-      _n_write_dup_content.store(0, std::memory_order_relaxed);
-      _n_write_not_dup.store(0, std::memory_order_relaxed);
-      _n_write_not_dup_ca_not_hit.store(0, std::memory_order_relaxed);
-      _n_write_not_dup_ca_not_match.store(0, std::memory_order_relaxed);
-      _n_read_hit.store(0, std::memory_order_relaxed);
-      _n_read_not_hit.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_dup_content.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_not_dup.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_lba_not_hit.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_ca_not_hit.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_lba_not_match.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_not_dup_ca_not_hit.store(0, std::memory_order_relaxed);
-      _n_read_not_hit_not_dup_ca_not_match.store(0, std::memory_order_relaxed);
-
-      _n_total_bytes_written_to_ssd.store(0, std::memory_order_relaxed);
-      _n_metadata_bytes_written_to_ssd.store(0, std::memory_order_relaxed);
-      _n_metadata_bytes_read_from_ssd.store(0, std::memory_order_relaxed);
-      _n_data_bytes_written_to_ssd.store(0, std::memory_order_relaxed);
-      _n_data_bytes_read_from_ssd.store(0, std::memory_order_relaxed);
-      _n_bytes_written_to_hdd.store(0, std::memory_order_relaxed);
-      _n_bytes_read_from_hdd.store(0, std::memory_order_relaxed);
-      _n_bytes_written_to_write_buffer.store(0, std::memory_order_relaxed);
-      _n_bytes_read_from_write_buffer.store(0, std::memory_order_relaxed);
-
-#define _(str) \
-      _time_elapsed_##str = 0;
-      _(compression);
-      _(decompression);
-      _(fingerprinting);
-      _(dedup);
-      _(lookup);
-      _(update_index);
-      _(io_ssd);
-      _(io_hdd);
-      _(debug);
-#undef _
+      StatsCounter::resetAll();
+      _max_dirty_bytes.store(_n_dirty_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      _max_staged_bytes.store(_n_staged_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      for (auto &device : _cache_devices) {
+        device._max_queue_depth.store(device._queue_depth.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
     }
   private:
       Stats() {
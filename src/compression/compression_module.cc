@@ -51,6 +51,10 @@ void CompressionModule::compress(Chunk &chunk)
     chunk.compressedBuf_ = chunk.buf_;
   }
 #endif
+  if (chunk.compressedBuf_ != chunk.buf_) {
+    // The compressed data is written from its own buffer
+    Stats::getInstance().add_copy(chunk.len_);
+  }
   END_TIMER(compression);
 }
 
@@ -67,6 +71,7 @@ void CompressionModule::decompress(Chunk &chunk)
       LZ4_decompress_safe((const char*)chunk.compressedBuf_, (char*)chunk.buf_,
                           chunk.compressedLen_, chunk.len_);
     }
+    Stats::getInstance().add_copy(chunk.len_);
   }
   END_TIMER(decompression);
 }
@@ -0,0 +1,146 @@
+#include "buffer_pool.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace cache {
+
+  BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&buffer) noexcept
+  {
+    if (this != &buffer) {
+      if (buf_ != nullptr) {
+        BufferPool::getInstance().release(buf_);
+      }
+      buf_ = buffer.buf_;
+      buffer.buf_ = nullptr;
+    }
+    return *this;
+  }
+
+  BufferPool::Buffer::~Buffer()
+  {
+    if (buf_ != nullptr) {
+      BufferPool::getInstance().release(buf_);
+    }
+  }
+
+  BufferPool::ThreadCache::~ThreadCache()
+  {
+    for (uint8_t *buf : buffers_) {
+      BufferPool::getInstance().releaseShared(buf);
+    }
+  }
+
+  BufferPool& BufferPool::getInstance() {
+    // Never destroyed: the per-thread caches of threads exiting after the
+    // statics, the main thread included, still release into it
+    static BufferPool *instance = new BufferPool();
+    return *instance;
+  }
+
+  BufferPool::ThreadCache &BufferPool::getThreadCache() {
+    static thread_local ThreadCache threadCache;
+    return threadCache;
+  }
+
+  BufferPool::BufferPool()
+  {
+    bufferSize_ = (Config::getInstance().getChunkSize() + kAlignment - 1) / kAlignment * kAlignment;
+    slabSize_ = (bufferSize_ + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+
+    // Node ids are "0" or "0-n" on machines without holes in the numbering
+    nNodes_ = 1;
+    FILE *f = fopen("/sys/devices/system/node/possible", "r");
+    if (f != nullptr) {
+      uint32_t first, last;
+      int n = fscanf(f, "%u-%u", &first, &last);
+      if (n == 2 && last >= first) {
+        nNodes_ = last + 1;
+      }
+      fclose(f);
+    }
+    freeBuffers_.resize(nNodes_);
+  }
+
+  uint32_t BufferPool::getCurrentNode()
+  {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+      return 0;
+    }
+    return node;
+  }
+
+  void BufferPool::allocateSlab(uint32_t nodeId)
+  {
+    bool isHugeTlb = true;
+    void *slab = mmap(nullptr, slabSize_, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (slab == MAP_FAILED) {
+      // No huge pages reserved, fall back to transparent huge pages
+      isHugeTlb = false;
+      slab = mmap(nullptr, slabSize_, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (slab == MAP_FAILED) {
+        std::cout << "Cannot allocate memory!" << std::endl;
+        exit(-1);
+      }
+      madvise(slab, slabSize_, MADV_HUGEPAGE);
+    }
+    // First touch places the pages on the node of this thread
+    memset(slab, 0, slabSize_);
+
+    slabs_[(uintptr_t)slab] = {slabSize_, nodeId};
+    for (uint64_t offset = 0; offset + bufferSize_ <= slabSize_; offset += bufferSize_) {
+      freeBuffers_[nodeId].push_back((uint8_t *)slab + offset);
+    }
+    Stats::getInstance().add_buffer_slab(isHugeTlb);
+  }
+
+  BufferPool::Buffer BufferPool::acquire()
+  {
+    ThreadCache &threadCache = getThreadCache();
+    if (!threadCache.buffers_.empty()) {
+      uint8_t *buf = threadCache.buffers_.back();
+      threadCache.buffers_.pop_back();
+      Stats::getInstance().add_buffer_acquired(true, true);
+      return Buffer(buf);
+    }
+
+    uint32_t nodeId = std::min(getCurrentNode(), nNodes_ - 1);
+    std::lock_guard<std::mutex> l(mutex_);
+    bool isPooled = !freeBuffers_[nodeId].empty();
+    if (!isPooled) {
+      allocateSlab(nodeId);
+    }
+    uint8_t *buf = freeBuffers_[nodeId].back();
+    freeBuffers_[nodeId].pop_back();
+    Stats::getInstance().add_buffer_acquired(false, isPooled);
+    return Buffer(buf);
+  }
+
+  void BufferPool::release(uint8_t *buf)
+  {
+    ThreadCache &threadCache = getThreadCache();
+    if (threadCache.buffers_.size() < kThreadCacheSize) {
+      threadCache.buffers_.push_back(buf);
+      return;
+    }
+    releaseShared(buf);
+  }
+
+  void BufferPool::releaseShared(uint8_t *buf)
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    // The slab starting at or before buf
+    auto it = std::prev(slabs_.upper_bound((uintptr_t)buf));
+    freeBuffers_[it->second.nodeId_].push_back(buf);
+  }
+}
@@ -0,0 +1,92 @@
+/* File: io/buffer_pool.h
+ * Description:
+ *   This file contains the declaration of BufferPool, which hands out
+ *   chunk-sized I/O buffers aligned for direct I/O.
+ *
+ *   1. Buffers are carved from slabs of whole huge pages. A slab is mapped
+ *      with MAP_HUGETLB if huge pages are reserved, and otherwise mapped
+ *      normally and advised for transparent huge pages.
+ *   2. A slab is touched by the thread that maps it so that its pages are
+ *      placed on the NUMA node of that thread. Free buffers are kept per
+ *      node, and a thread takes buffers of its own node.
+ *   3. Each thread keeps a few released buffers for itself in front of the
+ *      shared free lists, so that most acquisitions take no lock.
+ *
+ *   Buffers go back to the pool when their Buffer handle is destroyed. The
+ *   pool grows on demand and never shrinks.
+ */
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace cache {
+
+class BufferPool {
+ public:
+  // A buffer of the pool, released when the handle is destroyed
+  class Buffer {
+   public:
+    Buffer() : buf_(nullptr) {}
+    Buffer(Buffer &&buffer) noexcept : buf_(buffer.buf_) { buffer.buf_ = nullptr; }
+    Buffer &operator=(Buffer &&buffer) noexcept;
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+    ~Buffer();
+    inline uint8_t *get() const { return buf_; }
+   private:
+    friend class BufferPool;
+    explicit Buffer(uint8_t *buf) : buf_(buf) {}
+    uint8_t *buf_;
+  };
+
+  static BufferPool& getInstance();
+
+  // A buffer of one chunk
+  Buffer acquire();
+  // Whether buf can be used for direct I/O without a bounce buffer
+  static inline bool isAligned(const void *buf) { return (uintptr_t)buf % kAlignment == 0; }
+
+  static const uint32_t kAlignment = 512;
+
+ private:
+  BufferPool();
+
+  // Released buffers kept by a thread, returned to the pool when it exits
+  struct ThreadCache {
+    std::vector<uint8_t *> buffers_;
+    ~ThreadCache();
+  };
+  struct Slab {
+    uint64_t size_;
+    uint32_t nodeId_;
+  };
+  static ThreadCache &getThreadCache();
+  static uint32_t getCurrentNode();
+
+  void release(uint8_t *buf);
+  void releaseShared(uint8_t *buf);
+  // Map a slab on the current node and add its buffers to the free list
+  // of the node; the caller holds mutex_
+  void allocateSlab(uint32_t nodeId);
+
+  static const uint32_t kThreadCacheSize = 16;
+  static const uint64_t kHugePageSize = 2 * 1024 * 1024ull;
+
+  uint32_t bufferSize_;
+  uint64_t slabSize_;
+  uint32_t nNodes_;
+  // Free buffers of each NUMA node
+  std::vector<std::vector<uint8_t *>> freeBuffers_;
+  // Slabs by start address
+  std::map<uintptr_t, Slab> slabs_;
+  std::mutex mutex_;
+};
+
+}
+
+#endif //__BUFFER_POOL_H__
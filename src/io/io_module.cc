@@ -4,6 +4,7 @@
 #include "utils/utils.h"
 #include <csignal>
 #include <memory>
+#include <condition_variable>
 
 namespace cache {
 
@@ -30,15 +31,64 @@ IOModule &IOModule::getInstance() {
 }
 
 
-uint32_t IOModule::addCacheDevice(char *filename)
+void IOModule::initCacheLayout()
 {
+  nCacheDevices_ = Config::getInstance().getnCacheDevices();
+  hasMetadataDevice_ = Config::getInstance().getMetadataDeviceName() != nullptr;
+  if (nCacheDevices_ + hasMetadataDevice_ > Stats::kMaxCacheDevices) {
+    std::cout << "At most " << Stats::kMaxCacheDevices << " cache devices are supported!" << std::endl;
+    exit(-1);
+  }
+
+#if !defined(CACHE_DEDUP)
+  // The on-ssd metadata of ACDC precedes the cache data, one extent per FP bucket
+  metadataRegionSize_ = 1ull * Config::getInstance().getnFpBuckets() * Config::getInstance().getnFPSlotsPerBucket() * Config::getInstance().getMetadataSize();
+#endif
+  metadataStripeSize_ = 1ull * Config::getInstance().getnFPSlotsPerBucket() * Config::getInstance().getMetadataSize();
+  dataStripeSize_ = Config::getInstance().getCacheStripeSize();
+
   // a temporary size for cache device
   // 32 MiB cache device
   uint64_t size = Config::getInstance().getCacheDeviceSize();
-  cacheDevice_ = std::make_unique<BlockDevice>();
-  cacheDevice_->_direct_io = Config::getInstance().isDirectIOEnabled();
-  cacheDevice_->open(filename, size + 1ull * Config::getInstance().getnFpBuckets() * Config::getInstance().getnFPSlotsPerBucket() * Config::getInstance().getMetadataSize());
-  return 0;
+  if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+    // Over-provisioned log segments
+    size = std::max(size, (uint64_t)Config::getInstance().getnLogSegments() * Config::getInstance().getSegmentSize());
+  }
+  if (nCacheDevices_ == 1) {
+    metadataSizePerDevice_ = hasMetadataDevice_ ? 0 : metadataRegionSize_;
+    dataSizePerDevice_ = size;
+  } else {
+    uint64_t nMetadataStripes = (metadataRegionSize_ + metadataStripeSize_ - 1) / metadataStripeSize_;
+    uint64_t nDataStripes = (size + dataStripeSize_ - 1) / dataStripeSize_;
+    metadataSizePerDevice_ = hasMetadataDevice_ ? 0 :
+      (nMetadataStripes + nCacheDevices_ - 1) / nCacheDevices_ * metadataStripeSize_;
+    dataSizePerDevice_ = (nDataStripes + nCacheDevices_ - 1) / nCacheDevices_ * dataStripeSize_;
+  }
+}
+
+uint32_t IOModule::addCacheDevice(char *filename)
+{
+  if (cacheDevices_.empty()) {
+    initCacheLayout();
+  }
+  uint32_t deviceId = cacheDevices_.size();
+  cacheDevices_.emplace_back(std::make_unique<BlockDevice>());
+  cacheDevices_[deviceId]->_direct_io = Config::getInstance().isDirectIOEnabled();
+  cacheDevices_[deviceId]->open(filename, metadataSizePerDevice_ + dataSizePerDevice_);
+  if (nCacheDevices_ + hasMetadataDevice_ > 1) {
+    deviceQueues_.emplace_back(std::make_unique<AThreadPool>(1));
+  }
+  return deviceId;
+}
+
+uint32_t IOModule::addMetadataDevice(char *filename)
+{
+  uint32_t deviceId = cacheDevices_.size();
+  cacheDevices_.emplace_back(std::make_unique<BlockDevice>());
+  cacheDevices_[deviceId]->_direct_io = Config::getInstance().isDirectIOEnabled();
+  cacheDevices_[deviceId]->open(filename, metadataRegionSize_);
+  deviceQueues_.emplace_back(std::make_unique<AThreadPool>(1));
+  return deviceId;
 }
 
 uint32_t IOModule::addPrimaryDevice(char *filename)
@@ -46,10 +96,11 @@ uint32_t IOModule::addPrimaryDevice(char *filename)
   // a temporary size for primary device
   // 128 MiB primary device
   uint64_t size = Config::getInstance().getPrimaryDeviceSize();
-  primaryDevice_ = std::make_unique<BlockDevice>();
-  primaryDevice_->_direct_io = Config::getInstance().isDirectIOEnabled();
-  primaryDevice_->open(filename, size);
-  return 0;
+  uint32_t volumeId = primaryDevices_.size();
+  primaryDevices_.emplace_back(std::make_unique<BlockDevice>());
+  primaryDevices_[volumeId]->_direct_io = Config::getInstance().isDirectIOEnabled();
+  primaryDevices_[volumeId]->open(filename, size);
+  return volumeId;
 }
 
 uint32_t IOModule::read(DeviceType deviceType, uint64_t addr, void *buf, uint32_t len)
@@ -57,7 +108,7 @@ uint32_t IOModule::read(DeviceType deviceType, uint64_t addr, void *buf, uint32_
   uint32_t ret = 0;
   if (deviceType == PRIMARY_DEVICE) {
     BEGIN_TIMER();
-    ret = primaryDevice_->read(addr, static_cast<uint8_t *>(buf), len);
+    ret = primaryDevices_[getVolumeId(addr)]->read(getVolumeAddress(addr), static_cast<uint8_t *>(buf), len);
     END_TIMER(io_hdd);
     Stats::getInstance().add_bytes_read_from_hdd(len);
   } else if (deviceType == CACHE_DEVICE) {
@@ -67,10 +118,11 @@ uint32_t IOModule::read(DeviceType deviceType, uint64_t addr, void *buf, uint32_
 
     BEGIN_TIMER();
     Stats::getInstance().add_bytes_read_from_ssd(len);
-    ret = cacheDevice_->read(addr, static_cast<uint8_t *>(buf), len);
+    ret = accessCacheDevices(addr, static_cast<uint8_t *>(buf), len, false);
     END_TIMER(io_ssd);
   } else if (deviceType == IN_MEM_BUFFER) {
     inMemBuffer_.read(addr, static_cast<uint8_t *>(buf), len);
+    Stats::getInstance().add_copy(len);
   }
   return ret;
 }
@@ -79,7 +131,7 @@ uint32_t IOModule::write(DeviceType deviceType, uint64_t addr, void *buf, uint32
 {
   if (deviceType == PRIMARY_DEVICE) {
     BEGIN_TIMER();
-    primaryDevice_->write(addr, (uint8_t*)buf, len);
+    primaryDevices_[getVolumeId(addr)]->write(getVolumeAddress(addr), (uint8_t*)buf, len);
     END_TIMER(io_hdd);
     Stats::getInstance().add_bytes_written_to_hdd(len);
   } else if (deviceType == CACHE_DEVICE) {
@@ -88,16 +140,18 @@ uint32_t IOModule::write(DeviceType deviceType, uint64_t addr, void *buf, uint32
     }
     BEGIN_TIMER();
     Stats::getInstance().add_bytes_written_to_ssd(len);
-    cacheDevice_->write(addr, (uint8_t *) buf, len);
+    accessCacheDevices(addr, (uint8_t *) buf, len, true);
     END_TIMER(io_ssd);
   } else if (deviceType == IN_MEM_BUFFER) {
     inMemBuffer_.write(addr, (uint8_t*)buf, len);
+    Stats::getInstance().add_copy(len);
   } else if (deviceType == JOURNAL) {
     std::lock_guard<std::mutex> l(mutex_);
     if (journalOffset_ + len >= 512) {
       journalOffset_ = 8;
       journal_[0] = journalId_++;
-      cacheDevice_->write(journalDiskOffset_ + journalDiskStart_, journal_, 512);
+      // The journal is metadata, kept at the start of the metadata device or the first cache device
+      cacheDevices_[hasMetadataDevice_ ? nCacheDevices_ : 0]->write(journalDiskOffset_ + journalDiskStart_, journal_, 512);
       journalDiskOffset_ += 512;
       if (journalDiskOffset_ >= journalSize_) {
         journalDiskOffset_ = 0;
@@ -112,7 +166,112 @@ uint32_t IOModule::write(DeviceType deviceType, uint64_t addr, void *buf, uint32
 void IOModule::flush(uint64_t addr, uint64_t bufferOffset, uint32_t len)
 {
   Stats::getInstance().add_bytes_written_to_ssd(len);
-  cacheDevice_->write(addr, inMemBuffer_.buf_ + bufferOffset, len);
+  accessCacheDevices(addr, inMemBuffer_.buf_ + bufferOffset, len, true);
+}
+
+void IOModule::sync()
+{
+  for (auto &primaryDevice : primaryDevices_) {
+    primaryDevice->sync();
+  }
+  for (auto &cacheDevice : cacheDevices_) {
+    cacheDevice->sync();
+  }
+}
+
+void IOModule::mapCacheAddress(uint64_t addr, uint8_t *buf, uint32_t len,
+    std::vector<CacheDeviceRequest> &requests)
+{
+  if (nCacheDevices_ == 1 && !hasMetadataDevice_) {
+    requests.push_back({0, addr, buf, len});
+    return;
+  }
+  while (len > 0) {
+    uint32_t deviceId;
+    uint64_t deviceAddr, stripeEnd;
+    if (addr < metadataRegionSize_ && hasMetadataDevice_) {
+      deviceId = nCacheDevices_;
+      deviceAddr = addr;
+      stripeEnd = metadataRegionSize_;
+    } else if (addr < metadataRegionSize_) {
+      uint64_t stripeId = addr / metadataStripeSize_;
+      deviceId = stripeId % nCacheDevices_;
+      deviceAddr = stripeId / nCacheDevices_ * metadataStripeSize_ + addr % metadataStripeSize_;
+      stripeEnd = (stripeId + 1) * metadataStripeSize_;
+    } else {
+      uint64_t offset = addr - metadataRegionSize_;
+      uint64_t stripeId = offset / dataStripeSize_;
+      deviceId = stripeId % nCacheDevices_;
+      deviceAddr = metadataSizePerDevice_ + stripeId / nCacheDevices_ * dataStripeSize_ + offset % dataStripeSize_;
+      stripeEnd = metadataRegionSize_ + (stripeId + 1) * dataStripeSize_;
+    }
+    uint32_t pieceLen = std::min((uint64_t)len, stripeEnd - addr);
+    if (!requests.empty() && requests.back().deviceId_ == deviceId
+        && requests.back().addr_ + requests.back().len_ == deviceAddr) {
+      // Consecutive stripes of the same device
+      requests.back().len_ += pieceLen;
+    } else {
+      requests.push_back({deviceId, deviceAddr, buf, pieceLen});
+    }
+    addr += pieceLen;
+    buf += pieceLen;
+    len -= pieceLen;
+  }
+}
+
+uint32_t IOModule::accessCacheDevice(const CacheDeviceRequest &request, bool isWrite)
+{
+  uint32_t ret = 0;
+  Stats::getInstance().begin_cache_device_io(request.deviceId_, isWrite, request.len_);
+  if (isWrite) {
+    ret = cacheDevices_[request.deviceId_]->write(request.addr_, request.buf_, request.len_);
+  } else {
+    ret = cacheDevices_[request.deviceId_]->read(request.addr_, request.buf_, request.len_);
+  }
+  Stats::getInstance().end_cache_device_io(request.deviceId_);
+  return ret;
+}
+
+uint32_t IOModule::accessCacheDevices(uint64_t addr, uint8_t *buf, uint32_t len, bool isWrite)
+{
+  std::vector<CacheDeviceRequest> requests;
+  mapCacheAddress(addr, buf, len, requests);
+  if (requests.size() == 1) {
+    return accessCacheDevice(requests[0], isWrite);
+  }
+
+  // The parts on other devices go to their device queues and proceed in
+  // parallel with the parts on the device of the first one.
+  Stats::getInstance().add_requests_split(1);
+  std::mutex mutex;
+  std::condition_variable condVar;
+  uint32_t nPending = 0;
+  std::atomic<uint32_t> ret(0);
+  uint32_t firstDeviceId = requests[0].deviceId_;
+  for (auto &request : requests) {
+    if (request.deviceId_ == firstDeviceId) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> l(mutex);
+      ++nPending;
+    }
+    deviceQueues_[request.deviceId_]->doJob([&, request]() {
+      ret += accessCacheDevice(request, isWrite);
+      std::lock_guard<std::mutex> l(mutex);
+      if (--nPending == 0) {
+        condVar.notify_one();
+      }
+    });
+  }
+  for (auto &request : requests) {
+    if (request.deviceId_ == firstDeviceId) {
+      ret += accessCacheDevice(request, isWrite);
+    }
+  }
+  std::unique_lock<std::mutex> l(mutex);
+  condVar.wait(l, [&nPending]() { return nPending == 0; });
+  return ret;
 }
 
 }
@@ -23,16 +23,47 @@ namespace cache {
       ~IOModule();
     public:
       static IOModule& getInstance();
+      // Cache devices must be added in the order of the configuration; the
+      // metadata device, if any, after them
       uint32_t addCacheDevice(char *filename);
+      uint32_t addMetadataDevice(char *filename);
+      // Primary devices are added in the order of the volume ids; primary
+      // device addresses are lbas (see toLba)
       uint32_t addPrimaryDevice(char *filename);
       uint32_t read(DeviceType deviceType, uint64_t addr, void *buf, uint32_t len);
       uint32_t write(DeviceType deviceType, uint64_t addr, void *buf, uint32_t len);
       void flush(uint64_t addr, uint64_t bufferOffset, uint32_t len);
-      inline void sync() { primaryDevice_->sync(); cacheDevice_->sync(); }
+      void sync();
     private:
-      // Currently, we assume that only one cache and one primary
-      std::unique_ptr< BlockDevice > primaryDevice_;
-      std::unique_ptr< BlockDevice > cacheDevice_;
+      // The part of a cache request that falls into one stripe of one device
+      struct CacheDeviceRequest {
+        uint32_t deviceId_;
+        uint64_t addr_;
+        uint8_t *buf_;
+        uint32_t len_;
+      };
+      void initCacheLayout();
+      // Map a cache address range to device requests, split at stripe boundaries
+      void mapCacheAddress(uint64_t addr, uint8_t *buf, uint32_t len, std::vector<CacheDeviceRequest> &requests);
+      uint32_t accessCacheDevices(uint64_t addr, uint8_t *buf, uint32_t len, bool isWrite);
+      uint32_t accessCacheDevice(const CacheDeviceRequest &request, bool isWrite);
+
+      std::vector< std::unique_ptr< BlockDevice > > primaryDevices_;
+      // The cache address space is [metadata region][cache data region]. With
+      // several cache devices, both regions are striped over the devices so
+      // that the metadata and the data of an FP bucket live on one device.
+      // A metadata device, if any, holds the whole metadata region and
+      // follows the cache devices in cacheDevices_.
+      std::vector< std::unique_ptr< BlockDevice > > cacheDevices_;
+      // One I/O queue per device, serving the parts of requests spanning devices
+      std::vector< std::unique_ptr< AThreadPool > > deviceQueues_;
+      uint32_t nCacheDevices_ = 0;
+      bool hasMetadataDevice_ = false;
+      uint64_t metadataRegionSize_ = 0;
+      uint64_t metadataStripeSize_ = 0;
+      uint64_t dataStripeSize_ = 0;
+      uint64_t metadataSizePerDevice_ = 0;
+      uint64_t dataSizePerDevice_ = 0;
       Stats *stats_{};
 
       struct {
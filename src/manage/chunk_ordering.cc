@@ -0,0 +1,101 @@
+#include "chunk_ordering.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+#include <algorithm>
+
+namespace cache {
+
+  ChunkOrdering::ChunkOrdering()
+  {
+    chunkSize_ = Config::getInstance().getChunkSize();
+    // A single thread runs requests in order already
+    isEnabled_ = Config::getInstance().isMultiThreadingEnabled();
+    if (isEnabled_) {
+      stripes_ = std::make_unique<Stripe[]>(kNumStripes);
+    }
+  }
+
+  ChunkOrdering::Ticket ChunkOrdering::issue(uint64_t lba, uint32_t len)
+  {
+    Ticket ticket;
+    ticket.lba_ = lba;
+    ticket.len_ = len;
+    if (!isEnabled_ || len == 0) {
+      return ticket;
+    }
+
+    uint64_t firstChunkLba = lba / chunkSize_ * chunkSize_;
+    uint32_t nChunks = (lba + len - firstChunkLba + chunkSize_ - 1) / chunkSize_;
+    ticket.turns_.resize(nChunks);
+    if (nChunks == 1) {
+      Stripe &stripe = getStripe(firstChunkLba);
+      std::lock_guard<std::mutex> l(stripe.mutex_);
+      ticket.turns_[0] = stripe.chunks_[firstChunkLba].nIssued_++;
+      return ticket;
+    }
+
+    // The turns on all the chunks are taken at once, otherwise two requests
+    // issued concurrently could each be first on one chunk and wait for the
+    // other. Stripes are locked in the order of their index.
+    std::vector<Stripe *> stripes;
+    for (uint32_t i = 0; i < nChunks; ++i) {
+      stripes.push_back(&getStripe(firstChunkLba + i * (uint64_t)chunkSize_));
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+    for (Stripe *stripe : stripes) {
+      stripe->mutex_.lock();
+    }
+    for (uint32_t i = 0; i < nChunks; ++i) {
+      uint64_t chunkLba = firstChunkLba + i * (uint64_t)chunkSize_;
+      ticket.turns_[i] = getStripe(chunkLba).chunks_[chunkLba].nIssued_++;
+    }
+    for (Stripe *stripe : stripes) {
+      stripe->mutex_.unlock();
+    }
+    return ticket;
+  }
+
+  void ChunkOrdering::wait(Ticket &ticket)
+  {
+    if (ticket.isWaited_ || ticket.turns_.empty()) {
+      return;
+    }
+    bool hasWaited = false;
+    uint64_t firstChunkLba = ticket.lba_ / chunkSize_ * chunkSize_;
+    for (uint32_t i = 0; i < ticket.turns_.size(); ++i) {
+      uint64_t chunkLba = firstChunkLba + i * (uint64_t)chunkSize_;
+      Stripe &stripe = getStripe(chunkLba);
+      std::unique_lock<std::mutex> l(stripe.mutex_);
+      Turns &turns = stripe.chunks_[chunkLba];
+      while (turns.nServed_ != ticket.turns_[i]) {
+        hasWaited = true;
+        stripe.condVar_.wait(l);
+      }
+    }
+    ticket.isWaited_ = true;
+    Stats::getInstance().add_ordered_request(hasWaited);
+  }
+
+  void ChunkOrdering::release(Ticket &ticket)
+  {
+    if (ticket.turns_.empty()) {
+      return;
+    }
+    uint64_t firstChunkLba = ticket.lba_ / chunkSize_ * chunkSize_;
+    for (uint32_t i = 0; i < ticket.turns_.size(); ++i) {
+      uint64_t chunkLba = firstChunkLba + i * (uint64_t)chunkSize_;
+      Stripe &stripe = getStripe(chunkLba);
+      std::lock_guard<std::mutex> l(stripe.mutex_);
+      auto it = stripe.chunks_.find(chunkLba);
+      if (++it->second.nServed_ == it->second.nIssued_) {
+        // No request to the chunk is pending
+        stripe.chunks_.erase(it);
+      } else {
+        stripe.condVar_.notify_all();
+      }
+    }
+    ticket.turns_.clear();
+  }
+}
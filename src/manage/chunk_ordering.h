@@ -0,0 +1,77 @@
+/* File: manage/chunk_ordering.h
+ * Description:
+ *   This file contains the declaration of ChunkOrdering, which runs the
+ *   requests to a chunk one at a time and in the order they are issued.
+ *
+ *   1. Issuing a request gives it a turn on every chunk it covers. The turns
+ *      of a chunk are counted in one of kNumStripes stripes, each with its
+ *      own mutex and condition variable, so that requests to different
+ *      chunks seldom share a lock and a completion only wakes the requests
+ *      waiting on its stripe.
+ *   2. A request waits until the requests issued before it on its chunks are
+ *      done, then runs, then passes the turn on. A chunk is forgotten once
+ *      no request to it is pending.
+ *
+ *   Issuing and running can happen on different threads: a dispatcher issues
+ *   requests in their order, and the threads that run them may pick them up
+ *   in any order (see AustereCache::issue).
+ */
+#ifndef __CHUNK_ORDERING_H__
+#define __CHUNK_ORDERING_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace cache {
+
+class ChunkOrdering {
+ public:
+  // The turns of a request on its chunks
+  class Ticket {
+   public:
+    Ticket() : lba_(0), len_(0), isWaited_(false) {}
+    inline uint64_t getLba() const { return lba_; }
+    inline uint32_t getLen() const { return len_; }
+   private:
+    friend class ChunkOrdering;
+    uint64_t lba_;
+    uint32_t len_;
+    bool isWaited_;
+    // One per chunk, none when requests are not ordered
+    std::vector<uint32_t> turns_;
+  };
+
+  ChunkOrdering();
+  // Take the turns of a request of len bytes at lba
+  Ticket issue(uint64_t lba, uint32_t len);
+  // Wait for the turns of the ticket, once
+  void wait(Ticket &ticket);
+  // Pass the turns of the ticket on to the next requests
+  void release(Ticket &ticket);
+
+ private:
+  struct Turns {
+    uint32_t nIssued_;
+    uint32_t nServed_;
+  };
+  struct alignas(64) Stripe {
+    std::mutex mutex_;
+    std::condition_variable condVar_;
+    std::unordered_map<uint64_t, Turns> chunks_;
+  };
+  inline Stripe &getStripe(uint64_t chunkLba) { return stripes_[chunkLba / chunkSize_ % kNumStripes]; }
+
+  static const uint32_t kNumStripes = 1024;
+
+  uint32_t chunkSize_;
+  bool isEnabled_;
+  std::unique_ptr<Stripe[]> stripes_;
+};
+
+}
+
+#endif //__CHUNK_ORDERING_H__
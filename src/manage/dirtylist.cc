@@ -1,33 +1,56 @@
 #include "common/config.h"
+#include "common/stats.h"
 #include "dirtylist.h"
 
 #include <csignal>
 #include <mutex>
+#include <chrono>
+#include <algorithm>
 
 
 namespace cache {
 
-  DirtyList::DirtyList() : shutdown_(false)
-  {
-    std::thread flushThread([this] {
-        while (true) {
-          {
-            std::unique_lock<std::mutex> l(mutex_);
-            condVar_.wait(l);
-            flush();
-            if (shutdown_ == true) {
-              break;
-            }
-          }
-        }
-        });
-    flushThread.detach();
-    size_ = -1;
+  DirtyList::DirtyList() :
+    nDirtyBytes_(0), isFlushing_(false), flushCursor_(0),
+    nStagedBytes_(0), destagerShutdown_(false), shutdown_(false)
+  {
+    for (auto &nVolumeDirtyBytes : nVolumeDirtyBytes_) {
+      nVolumeDirtyBytes = 0;
+    }
+    highWatermark_ = Config::getInstance().getDirtyHighWatermark();
+    lowWatermark_ = std::min(Config::getInstance().getDirtyLowWatermark(), highWatermark_);
+    stagingCapacity_ = Config::getInstance().getStagingBufferSize();
+    uint32_t nFlushers = std::max(1u, Config::getInstance().getnFlushThreads());
+    for (uint32_t i = 0; i < nFlushers; ++i) {
+      flushers_.emplace_back([this] { flusherThread(); });
+    }
+    destager_ = std::thread([this] { destagerThread(); });
+  }
+
+  DirtyList::~DirtyList() {
+    shutdown();
   }
 
   void DirtyList::shutdown() {
-    shutdown_ = true;
-    condVar_.notify_all();
+    {
+      std::lock_guard<std::mutex> l(flushMutex_);
+      shutdown_ = true;
+      condVar_.notify_all();
+    }
+    for (auto &flusher : flushers_) {
+      flusher.join();
+    }
+    flushers_.clear();
+
+    // Evictions are done, drain the staging buffer
+    {
+      std::lock_guard<std::mutex> l(stagingMutex_);
+      destagerShutdown_ = true;
+      stagingCondVar_.notify_all();
+    }
+    if (destager_.joinable()) {
+      destager_.join();
+    }
   }
 
   void DirtyList::setCompressionModule(std::shared_ptr<CompressionModule> compressionModule)
@@ -40,15 +63,206 @@ namespace cache {
     return instance;
   }
 
+  std::mutex &DirtyList::getFlushLock(uint64_t lba)
+  {
+    return flushLocks_[lba / Config::getInstance().getChunkSize() % kNumFlushLocks];
+  }
+
+  DirtyList::DirtyShard &DirtyList::getDirtyShard(uint64_t lba)
+  {
+    return dirtyShards_[lba / Config::getInstance().getChunkSize() % kNumDirtyShards];
+  }
+
+  uint64_t DirtyList::getIndexKey(uint64_t cachedataLocation)
+  {
+#if defined(CDARC)
+    // The cache data pointer of CDARC is (weu id, offset in the weu)
+    return cachedataLocation >> 32;
+#else
+    return cachedataLocation;
+#endif
+  }
+
+  DirtyList::LocationShard &DirtyList::getLocationShard(uint64_t indexKey)
+  {
+    // Cache data pointers are aligned, mix the bits before picking a shard
+    return locationShards_[(indexKey * 0x9E3779B97F4A7C15ull) >> 58 & (kNumDirtyShards - 1)];
+  }
+
+  void DirtyList::indexLocation(uint64_t lba, uint64_t cachedataLocation)
+  {
+    uint64_t indexKey = getIndexKey(cachedataLocation);
+    LocationShard &shard = getLocationShard(indexKey);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    shard.dirtyLbas_[indexKey].insert(lba);
+  }
+
+  void DirtyList::unindexLocation(uint64_t lba, uint64_t cachedataLocation)
+  {
+    uint64_t indexKey = getIndexKey(cachedataLocation);
+    LocationShard &shard = getLocationShard(indexKey);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    auto it = shard.dirtyLbas_.find(indexKey);
+    if (it != shard.dirtyLbas_.end()) {
+      it->second.erase(lba);
+      if (it->second.empty()) {
+        shard.dirtyLbas_.erase(it);
+      }
+    }
+  }
+
+  void DirtyList::getDirtyLbas(uint64_t cachedataLocation, std::vector<uint64_t> &lbas)
+  {
+    uint64_t indexKey = getIndexKey(cachedataLocation);
+    LocationShard &shard = getLocationShard(indexKey);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    auto it = shard.dirtyLbas_.find(indexKey);
+    if (it != shard.dirtyLbas_.end()) {
+      lbas.insert(lbas.end(), it->second.begin(), it->second.end());
+    }
+  }
+
+  bool DirtyList::getLatestUpdate(uint64_t lba, uint64_t &cachedataLocation, uint32_t &len)
+  {
+    DirtyShard &shard = getDirtyShard(lba);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    auto it = shard.latestUpdates_.find(lba);
+    if (it == shard.latestUpdates_.end()) {
+      return false;
+    }
+    cachedataLocation = it->second.first;
+    len = it->second.second;
+    return true;
+  }
+
+  bool DirtyList::isDirty(uint64_t lba)
+  {
+    // An lba moves from the shard to the staging buffer under the shard lock
+    DirtyShard &shard = getDirtyShard(lba);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    if (shard.latestUpdates_.find(lba) != shard.latestUpdates_.end()) {
+      return true;
+    }
+    std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+    return stagedChunks_.find(lba) != stagedChunks_.end();
+  }
+
+  bool DirtyList::isLatestUpdate(uint64_t lba, uint64_t cachedataLocation, uint32_t len)
+  {
+    uint64_t latestLocation;
+    uint32_t latestLen;
+    return getLatestUpdate(lba, latestLocation, latestLen)
+      && latestLocation == cachedataLocation
+      && latestLen == len;
+  }
+
+  void DirtyList::eraseLatestUpdate(DirtyShard &shard,
+      std::unordered_map<uint64_t, std::pair<uint64_t, uint32_t>>::iterator it)
+  {
+    unindexLocation(it->first, it->second.first);
+    shard.orderedLbas_.erase(it->first);
+    uint32_t volumeId = getVolumeId(it->first);
+    shard.latestUpdates_.erase(it);
+    Stats::getInstance().set_dirty_bytes(
+        nDirtyBytes_ -= Config::getInstance().getChunkSize());
+    Stats::getInstance().set_volume_dirty_bytes(volumeId,
+        nVolumeDirtyBytes_[volumeId] -= Config::getInstance().getChunkSize());
+  }
+
+  void DirtyList::eraseLatestUpdate(uint64_t lba, uint64_t cachedataLocation)
+  {
+    DirtyShard &shard = getDirtyShard(lba);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    auto it = shard.latestUpdates_.find(lba);
+    if (it != shard.latestUpdates_.end() && it->second.first == cachedataLocation) {
+      eraseLatestUpdate(shard, it);
+    }
+  }
+
   void DirtyList::addLatestUpdate(uint64_t lba, uint64_t cachedataLocation, uint32_t len)
   {
-    std::lock_guard<std::mutex> l(listMutex_);
-    latestUpdates_[lba] = std::make_pair(cachedataLocation, len);
-    if (latestUpdates_.size() >= size_) {
+    {
+      DirtyShard &shard = getDirtyShard(lba);
+      std::lock_guard<std::mutex> l(shard.mutex_);
+      auto it = shard.latestUpdates_.find(lba);
+      if (it == shard.latestUpdates_.end()) {
+        shard.latestUpdates_.emplace(lba, std::make_pair(cachedataLocation, len));
+        shard.orderedLbas_.insert(lba);
+        Stats::getInstance().set_dirty_bytes(
+            nDirtyBytes_ += Config::getInstance().getChunkSize());
+        Stats::getInstance().set_volume_dirty_bytes(getVolumeId(lba),
+            nVolumeDirtyBytes_[getVolumeId(lba)] += Config::getInstance().getChunkSize());
+      } else {
+        if (getIndexKey(it->second.first) != getIndexKey(cachedataLocation)) {
+          unindexLocation(lba, it->second.first);
+        }
+        it->second = std::make_pair(cachedataLocation, len);
+      }
+      indexLocation(lba, cachedataLocation);
+
+      // The staged copy (if any) is outdated now
+      std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+      auto stagedIt = stagedChunks_.find(lba);
+      if (stagedIt != stagedChunks_.end()) {
+        stagedChunks_.erase(stagedIt);
+        nStagedBytes_ -= Config::getInstance().getChunkSize();
+        Stats::getInstance().set_staged_bytes(nStagedBytes_);
+        Stats::getInstance().add_lbas_staged_superseded(1);
+      }
+    }
+    if (!isFlushing_ && nDirtyBytes_ >= highWatermark_) {
+      std::lock_guard<std::mutex> l(flushMutex_);
+      isFlushing_ = true;
       condVar_.notify_all();
     }
   }
 
+  bool DirtyList::isOverDirtyQuota(uint64_t lba)
+  {
+    uint64_t quota = Config::getInstance().getVolumeDirtyQuota();
+    return quota != 0 && nVolumeDirtyBytes_[getVolumeId(lba)] >= quota;
+  }
+
+  void DirtyList::writeThrough(uint64_t lba, uint8_t *buf, uint32_t len)
+  {
+    // Ordered against the flush of the older version
+    std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+    IOModule::getInstance().write(PRIMARY_DEVICE, lba, buf, len);
+
+    DirtyShard &shard = getDirtyShard(lba);
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    auto it = shard.latestUpdates_.find(lba);
+    if (it != shard.latestUpdates_.end()) {
+      eraseLatestUpdate(shard, it);
+    }
+    std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+    auto stagedIt = stagedChunks_.find(lba);
+    if (stagedIt != stagedChunks_.end()) {
+      stagedChunks_.erase(stagedIt);
+      nStagedBytes_ -= Config::getInstance().getChunkSize();
+      Stats::getInstance().set_staged_bytes(nStagedBytes_);
+      Stats::getInstance().add_lbas_staged_superseded(1);
+    }
+  }
+
+  void DirtyList::relocate(uint64_t cachedataLocation, uint64_t newCachedataLocation, uint32_t len)
+  {
+    std::vector<uint64_t> lbas;
+    getDirtyLbas(cachedataLocation, lbas);
+    for (auto lba : lbas) {
+      DirtyShard &shard = getDirtyShard(lba);
+      std::lock_guard<std::mutex> l(shard.mutex_);
+      auto it = shard.latestUpdates_.find(lba);
+      if (it == shard.latestUpdates_.end()
+          || it->second != std::make_pair(cachedataLocation, len)) {
+        continue;
+      }
+      unindexLocation(lba, cachedataLocation);
+      it->second.first = newCachedataLocation;
+      indexLocation(lba, newCachedataLocation);
+    }
+  }
+
   /*
    * Description:
    *   Add a newly evicted block into the dirty list
@@ -57,4 +271,287 @@ namespace cache {
   {
     flushOneBlock(cachedataLocation, len);
   }
+
+  bool DirtyList::stageEvictedLbas(const std::vector<uint64_t> &lbas,
+      uint64_t cachedataLocation, uint32_t len, const uint8_t *data)
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    {
+      std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+      if (nStagedBytes_ + 1ull * lbas.size() * chunkSize > stagingCapacity_) {
+        Stats::getInstance().add_staging_full(1);
+        return false;
+      }
+    }
+    auto stagedChunk = std::make_shared<BufferPool::Buffer>(BufferPool::getInstance().acquire());
+    memcpy(stagedChunk->get(), data, chunkSize);
+    Stats::getInstance().add_copy(chunkSize);
+
+    // Move each lba from the dirty list to the staging buffer atomically,
+    // so that a concurrent update of the lba always supersedes the staged copy.
+    for (auto lba : lbas) {
+      DirtyShard &shard = getDirtyShard(lba);
+      std::lock_guard<std::mutex> l(shard.mutex_);
+      auto it = shard.latestUpdates_.find(lba);
+      if (it == shard.latestUpdates_.end()
+          || it->second != std::make_pair(cachedataLocation, len)) {
+        continue;
+      }
+      eraseLatestUpdate(shard, it);
+      std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+      if (stagedChunks_.find(lba) == stagedChunks_.end()) {
+        nStagedBytes_ += chunkSize;
+      }
+      stagedChunks_[lba] = stagedChunk;
+      destageQueue_.push_back(lba);
+      Stats::getInstance().add_lbas_staged(1);
+    }
+    std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+    Stats::getInstance().set_staged_bytes(nStagedBytes_);
+    stagingCondVar_.notify_all();
+    return true;
+  }
+
+  bool DirtyList::readStaged(uint64_t lba, uint8_t *buf, uint32_t len)
+  {
+    std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+    auto it = stagedChunks_.find(lba);
+    if (it == stagedChunks_.end()) {
+      return false;
+    }
+    memcpy(buf, it->second->get(), std::min(len, Config::getInstance().getChunkSize()));
+    Stats::getInstance().add_copy(std::min(len, Config::getInstance().getChunkSize()));
+    Stats::getInstance().add_reads_from_staging(1);
+    return true;
+  }
+
+  void DirtyList::destagerThread()
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    while (true) {
+      uint64_t lba;
+      std::shared_ptr<BufferPool::Buffer> stagedChunk;
+      {
+        std::unique_lock<std::mutex> stagingLock(stagingMutex_);
+        stagingCondVar_.wait(stagingLock,
+            [this] { return destagerShutdown_ || !destageQueue_.empty(); });
+        if (destageQueue_.empty()) {
+          break;
+        }
+        lba = destageQueue_.front();
+        destageQueue_.pop_front();
+        auto it = stagedChunks_.find(lba);
+        if (it == stagedChunks_.end()) {
+          continue;
+        }
+        stagedChunk = it->second;
+      }
+
+      // Ordered against the flush of any newer version of the lba
+      std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+      {
+        std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+        auto it = stagedChunks_.find(lba);
+        if (it == stagedChunks_.end() || it->second != stagedChunk) {
+          continue;
+        }
+      }
+      IOModule::getInstance().write(PRIMARY_DEVICE, lba, stagedChunk->get(), chunkSize);
+      Stats::getInstance().add_lbas_destaged(1);
+      {
+        std::lock_guard<std::mutex> stagingLock(stagingMutex_);
+        auto it = stagedChunks_.find(lba);
+        if (it != stagedChunks_.end() && it->second == stagedChunk) {
+          stagedChunks_.erase(it);
+          nStagedBytes_ -= chunkSize;
+          Stats::getInstance().set_staged_bytes(nStagedBytes_);
+        }
+      }
+    }
+  }
+
+  void DirtyList::flusherThread()
+  {
+    // Each flusher reuses one buffer for its coalesced writes
+    uint8_t *buf = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&buf), 512,
+          1ull * kMaxChunksPerFlushWrite * Config::getInstance().getChunkSize()) != 0) {
+      std::cout << "Cannot allocate memory!" << std::endl;
+      exit(-1);
+    }
+    while (true) {
+      {
+        std::unique_lock<std::mutex> l(flushMutex_);
+        condVar_.wait(l, [this] { return shutdown_ || isFlushing_; });
+        if (shutdown_ && nDirtyBytes_ == 0) {
+          break;
+        }
+      }
+      if (!flush(buf)) {
+        break;
+      }
+    }
+    free(buf);
+  }
+
+  void DirtyList::collectBatch(std::vector<DirtyEntry> &batch)
+  {
+    // Continue from where the last batch ends, so that
+    // the primary device sees (mostly) ascending addresses.
+    // Each shard contributes its next few LBAs after the cursor; the merged
+    // batch stops before the first LBA a truncated shard may have missed.
+    const uint32_t kMaxPerShard = 2 * kMaxFlushBatch / kNumDirtyShards + 1;
+    std::lock_guard<std::mutex> l(flushMutex_);
+    for (int pass = 0; pass < 2 && batch.empty(); ++pass) {
+      uint64_t cursor = (pass == 0) ? flushCursor_ : 0;
+      uint64_t bound = ~0ull;
+      for (auto &shard : dirtyShards_) {
+        std::lock_guard<std::mutex> shardLock(shard.mutex_);
+        uint32_t nCollected = 0;
+        for (auto it = shard.orderedLbas_.lower_bound(cursor);
+             it != shard.orderedLbas_.end() && *it <= bound; ++it) {
+          if (inFlightLbas_.find(*it) != inFlightLbas_.end()
+              || unflushableLbas_.find(*it) != unflushableLbas_.end()) {
+            continue;
+          }
+          if (nCollected == kMaxPerShard) {
+            bound = *it - 1;
+            break;
+          }
+          auto &value = shard.latestUpdates_[*it];
+          batch.push_back({*it, value.first, value.second});
+          ++nCollected;
+        }
+      }
+      std::sort(batch.begin(), batch.end(),
+          [](const DirtyEntry &a, const DirtyEntry &b) { return a.lba_ < b.lba_; });
+      while (!batch.empty() && (batch.size() > kMaxFlushBatch || batch.back().lba_ > bound)) {
+        batch.pop_back();
+      }
+    }
+    for (auto &entry : batch) {
+      inFlightLbas_.insert(entry.lba_);
+    }
+    if (!batch.empty()) {
+      flushCursor_ = batch.back().lba_ + 1;
+    }
+  }
+
+  /*
+   * Description:
+   *   Flush one batch of dirty LBAs. Adjacent LBAs in the batch are
+   *   coalesced into large sequential writes to the primary device.
+   */
+  bool DirtyList::flush(uint8_t *buf)
+  {
+    std::vector<DirtyEntry> batch;
+    collectBatch(batch);
+    if (batch.empty()) {
+      std::unique_lock<std::mutex> l(flushMutex_);
+      if (shutdown_ && inFlightLbas_.empty()) {
+        // Only lbas that cannot be written back are left
+        return false;
+      }
+      // Everything left is being flushed by other flushers
+      condVar_.wait_for(l, std::chrono::milliseconds(1));
+      return true;
+    }
+
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    std::vector<uint64_t> unreadableLbas;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0, j = 0; i < batch.size(); i = j) {
+      for (j = i + 1; j < batch.size() && j - i < kMaxChunksPerFlushWrite
+                      && batch[j].lba_ == batch[j - 1].lba_ + chunkSize; ++j) {
+      }
+      flushRun(batch.data() + i, j - i, buf, unreadableLbas);
+    }
+    Stats::getInstance().add_time_elapsed_flush(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - begin).count());
+
+    {
+      std::lock_guard<std::mutex> l(flushMutex_);
+      for (auto &entry : batch) {
+        inFlightLbas_.erase(entry.lba_);
+      }
+      if (isFlushing_ && nDirtyBytes_ <= lowWatermark_) {
+        isFlushing_ = false;
+      }
+      // Before shutdown, a later pass retries them. At shutdown nothing
+      // repoints them any more: they stay dirty, and are reported.
+      if (shutdown_) {
+        for (uint64_t lba : unreadableLbas) {
+          std::cout << "Cannot write back dirty lba " << lba
+                    << ", its cached data cannot be read" << std::endl;
+          unflushableLbas_.insert(lba);
+        }
+        Stats::getInstance().add_lbas_not_written_back(unreadableLbas.size());
+      }
+    }
+    return true;
+  }
+
+  void DirtyList::flushRun(DirtyEntry *entries, uint32_t nEntries, uint8_t *buf,
+      std::vector<uint64_t> &unreadableLbas)
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    // Flushers may hold several flush locks, take them in a fixed order
+    std::set<std::mutex *> flushLocks;
+    for (uint32_t i = 0; i < nEntries; ++i) {
+      flushLocks.insert(&getFlushLock(entries[i].lba_));
+    }
+    for (auto flushLock : flushLocks) {
+      flushLock->lock();
+    }
+
+    std::vector<bool> isReady(nEntries, false);
+    for (uint32_t i = 0; i < nEntries; ++i) {
+      if (!isLatestUpdate(entries[i].lba_, entries[i].cachedataLocation_, entries[i].len_)) {
+        continue;
+      }
+      isReady[i] = readDirtyChunk(entries[i], buf + 1ull * i * chunkSize);
+    }
+
+    // The cached data may be overwritten while being read if the LBA is
+    // updated in between, only write back those that are still the latest.
+    std::vector<bool> isValid(isReady);
+    for (uint32_t i = 0; i < nEntries; ++i) {
+      isValid[i] = isValid[i] &&
+        isLatestUpdate(entries[i].lba_, entries[i].cachedataLocation_, entries[i].len_);
+    }
+
+    for (uint32_t i = 0, j = 0; i < nEntries; i = j) {
+      if (!isValid[i]) {
+        j = i + 1;
+        continue;
+      }
+      for (j = i + 1; j < nEntries && isValid[j]; ++j) {
+      }
+      IOModule::getInstance().write(PRIMARY_DEVICE, entries[i].lba_,
+          buf + 1ull * i * chunkSize, (j - i) * chunkSize);
+      Stats::getInstance().add_flush_write_to_hdd(j - i, 1ull * (j - i) * chunkSize);
+    }
+
+    for (uint32_t i = 0; i < nEntries; ++i) {
+      if (isValid[i]) {
+        eraseLatestUpdate(entries[i].lba_, entries[i].cachedataLocation_);
+      } else if (!isReady[i]
+          && isLatestUpdate(entries[i].lba_, entries[i].cachedataLocation_, entries[i].len_)) {
+        // Never marked clean without being written back
+        unreadableLbas.push_back(entries[i].lba_);
+      }
+    }
+
+    for (auto flushLock : flushLocks) {
+      flushLock->unlock();
+    }
+
+    // Out of the flush locks, which are taken under fingerprint bucket locks
+    for (uint32_t i = 0; i < nEntries; ++i) {
+      if (isValid[i]) {
+        markClean(entries[i]);
+      }
+    }
+  }
 }
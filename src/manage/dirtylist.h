@@ -2,10 +2,18 @@
 #define __DIRTY_LIST__
 
 #include "compression/compression_module.h"
+#include "io/buffer_pool.h"
 #include "io/io_module.h"
 
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <list>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <condition_variable>
 
 namespace cache {
@@ -14,6 +22,7 @@ namespace cache {
 
     public:
       DirtyList();
+      ~DirtyList();
       void setCompressionModule(std::shared_ptr<CompressionModule> compressionModule);
 
       static DirtyList& getInstance();
@@ -26,23 +35,129 @@ namespace cache {
 
       void addLatestUpdate(uint64_t lba, uint64_t cachedataLocation, uint32_t len);
       void addEvictedChunk(uint64_t cachedataLocation, uint32_t len);
-      void flush();
+      // Flush one batch through buf (kMaxChunksPerFlushWrite chunks), return
+      // false once nothing that can be written back is left at shutdown
+      bool flush(uint8_t *buf);
       void flushOneLba(uint64_t lba, uint64_t cachedataLocation, Metadata &metadata);
       void flushOneBlock(uint64_t cachedataLocation, uint32_t len);
+      // Serve a primary-device read from the staging buffer if the lba is
+      // evicted but not destaged yet
+      bool readStaged(uint64_t lba, uint8_t *buf, uint32_t len);
+      // Whether the latest data of the lba is not on the primary device yet
+      // (dirty in the cache or staged)
+      bool isDirty(uint64_t lba);
+      // Whether the volume of the lba has reached its dirty quota
+      bool isOverDirtyQuota(uint64_t lba);
+      // Write the data of the lba to the primary device right away and drop
+      // its older dirty version, if any (volume over its dirty quota, or
+      // sequential write bypassing the cache)
+      void writeThrough(uint64_t lba, uint8_t *buf, uint32_t len);
+      // Cached data moved (log cleaning), repoint the dirty lbas still referring to it
+      void relocate(uint64_t cachedataLocation, uint64_t newCachedataLocation, uint32_t len);
 
+      // Write back all dirty data and stop the flushers
       void shutdown();
 
     private:
-      // logical block address to cache data pointer and length
-      std::map<uint64_t, std::pair<uint64_t, uint32_t>> latestUpdates_;
-      std::map<uint64_t, uint64_t> latestUpdatesMetadataLocations_;
+      struct DirtyEntry {
+        uint64_t lba_;
+        uint64_t cachedataLocation_;
+        uint32_t len_;
+      };
+
+      void flusherThread();
+      // Pick the next batch of dirty LBAs (in LBA order) for a flusher
+      void collectBatch(std::vector<DirtyEntry> &batch);
+      // Write a run of LBA-adjacent dirty chunks with one large primary write;
+      // the lbas whose latest data cannot be read are left dirty in unreadableLbas
+      void flushRun(DirtyEntry *entries, uint32_t nEntries, uint8_t *buf,
+          std::vector<uint64_t> &unreadableLbas);
+      // Read the (decompressed) cached data of a dirty LBA, variant-specific
+      bool readDirtyChunk(const DirtyEntry &entry, uint8_t *buf);
+      // Record in the on-ssd metadata that a written back LBA is clean,
+      // variant-specific
+      void markClean(const DirtyEntry &entry);
+
+      // The dirty list is sharded by LBA. Each shard keeps a hash table for
+      // O(1) updates and an ordered set of its LBAs for LBA-ordered flushing.
+      struct DirtyShard {
+        std::mutex mutex_;
+        // logical block address to cache data pointer and length
+        std::unordered_map<uint64_t, std::pair<uint64_t, uint32_t>> latestUpdates_;
+        std::set<uint64_t> orderedLbas_;
+      };
+      // Reverse index from a cache data pointer to the dirty LBAs whose latest
+      // data is there, sharded by the pointer. Lock order: DirtyShard first.
+      // CDARC evicts a whole WEU at once and indexes by WEU id instead.
+      struct LocationShard {
+        std::mutex mutex_;
+        std::unordered_map<uint64_t, std::unordered_set<uint64_t>> dirtyLbas_;
+      };
+      DirtyShard &getDirtyShard(uint64_t lba);
+      LocationShard &getLocationShard(uint64_t indexKey);
+      static uint64_t getIndexKey(uint64_t cachedataLocation);
+      // Require the lock of the dirty shard of the lba to be held
+      void eraseLatestUpdate(DirtyShard &shard,
+          std::unordered_map<uint64_t, std::pair<uint64_t, uint32_t>>::iterator it);
+      void indexLocation(uint64_t lba, uint64_t cachedataLocation);
+      void unindexLocation(uint64_t lba, uint64_t cachedataLocation);
+
+      bool getLatestUpdate(uint64_t lba, uint64_t &cachedataLocation, uint32_t &len);
+      bool isLatestUpdate(uint64_t lba, uint64_t cachedataLocation, uint32_t len);
+      void eraseLatestUpdate(uint64_t lba, uint64_t cachedataLocation);
+      // Dirty lbas whose latest data is at the given cache data pointer
+      // (for CDARC, anywhere in the WEU of the pointer)
+      void getDirtyLbas(uint64_t cachedataLocation, std::vector<uint64_t> &lbas);
+
+      // Copy the dirty lbas of an evicted chunk into the staging buffer so that
+      // the cache slot can be reused before the data reaches the primary device.
+      // Return false if the staging buffer is full.
+      bool stageEvictedLbas(const std::vector<uint64_t> &lbas,
+          uint64_t cachedataLocation, uint32_t len, const uint8_t *data);
+      void destagerThread();
+
+      // Serialize flushes of the same LBA from the flushers and the eviction path
+      std::mutex &getFlushLock(uint64_t lba);
+      static const uint32_t kNumFlushLocks = 1024;
+      static const uint32_t kMaxFlushBatch = 256;
+      static const uint32_t kMaxChunksPerFlushWrite = 32;
+      static const uint32_t kNumDirtyShards = 64;
+
+      DirtyShard dirtyShards_[kNumDirtyShards];
+      LocationShard locationShards_[kNumDirtyShards];
       std::list<EvictedBlock> evictedBlocks_;
       std::shared_ptr<CompressionModule> compressionModule_;
-      uint64_t size_;
-      std::mutex mutex_;
-      std::mutex listMutex_;
+      // Flushers start when the dirty bytes exceed the high watermark
+      // and stop once they drop below the low watermark.
+      std::atomic<uint64_t> nDirtyBytes_;
+      std::atomic<uint64_t> nVolumeDirtyBytes_[Stats::kMaxVolumes];
+      uint64_t highWatermark_;
+      uint64_t lowWatermark_;
+      std::atomic<bool> isFlushing_;
+      // LBAs picked by flushers but not yet written back
+      std::set<uint64_t> inFlightLbas_;
+      // Dirty LBAs whose cached data could not be read at shutdown, left
+      // dirty and not picked again
+      std::set<uint64_t> unflushableLbas_;
+      uint64_t flushCursor_;
+      std::vector<std::thread> flushers_;
+      std::mutex flushLocks_[kNumFlushLocks];
+
+      // Evicted dirty chunks waiting for the destager. Lbas sharing the same
+      // evicted chunk share one staged copy.
+      std::map<uint64_t, std::shared_ptr<BufferPool::Buffer>> stagedChunks_;
+      std::list<uint64_t> destageQueue_;
+      uint64_t nStagedBytes_;
+      uint64_t stagingCapacity_;
+      std::thread destager_;
+      std::mutex stagingMutex_;
+      std::condition_variable stagingCondVar_;
+      bool destagerShutdown_;
+      // Guards the flushers' state (isFlushing_, inFlightLbas_, unflushableLbas_,
+      // flushCursor_, shutdown_)
+      std::mutex flushMutex_;
       std::condition_variable condVar_;
-      bool shutdown_;
+      std::atomic<bool> shutdown_;
   };
 }
 
@@ -1,79 +1,50 @@
 #ifdef ACDC
 #include "dirtylist.h"
- 
+#include "common/stats.h"
+#include "io/buffer_pool.h"
+#include "metadata/metadata_module.h"
+
 
 namespace cache {
 
-    void DirtyList::flush() {
-      alignas(512) uint8_t compressedData[Config::getInstance().getChunkSize()];
-      alignas(512) uint8_t uncompressedData[Config::getInstance().getChunkSize()];
+    bool DirtyList::readDirtyChunk(const DirtyEntry &entry, uint8_t *buf) {
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      uint8_t *compressedData = compressedBuf.get();
       alignas(512) Metadata metadata{};
 
-      if (latestUpdates_.size() >= size_) {
-        std::vector<std::pair<std::pair<uint64_t, uint64_t>, std::pair<uint64_t, uint32_t>>> toFlush;
-        {
-          std::lock_guard<std::mutex> l(listMutex_);
-          for (auto pr : latestUpdates_) {
-            uint64_t lba = pr.first;
-            uint64_t cachedataLocation = pr.second.first;
-            uint64_t metadataLocation = FPIndex::cachedataLocationToMetadataLocation(cachedataLocation);
-            uint32_t len = pr.second.second;
-            toFlush.emplace_back(std::make_pair(lba, cachedataLocation), std::make_pair(metadataLocation, len));
-          }
-        }
-
-        for (auto pr : toFlush) {
-            uint64_t lba = pr.first.first;
-            uint64_t cachedataLocation = pr.first.second;
-            uint64_t metadataLocation = pr.second.first;
-            uint32_t len = pr.second.second;
-
-          // Read chunk metadata (compressed length)
-          IOModule::getInstance().read(CACHE_DEVICE, metadataLocation, &metadata, Config::getInstance().getMetadataSize());
-          // Read cached data
-          if (len == Config::getInstance().getChunkSize()) {
-            IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, uncompressedData, len);
-          } else {
-            IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, compressedData, len);
-            // Decompress cached data
-            memset(uncompressedData, 0, Config::getInstance().getChunkSize());
-            compressionModule_->decompress(compressedData, uncompressedData,
-                                           metadata.compressedLen_, Config::getInstance().getChunkSize());
-          }
-          IOModule::getInstance().write(PRIMARY_DEVICE, lba, uncompressedData,
-                                        Config::getInstance().getChunkSize());
-        }
-
-        {
-          std::lock_guard<std::mutex> l(listMutex_);
-          for (auto pr : toFlush) {
-            uint64_t lba = pr.first.first;
-            uint64_t cachedataLocation = pr.first.second;
-            uint32_t len = pr.second.second;
-            if (latestUpdates_.find(lba) != latestUpdates_.end()) {
-              if (latestUpdates_[lba].first == cachedataLocation &&
-                  latestUpdates_[lba].second == len) {
-                latestUpdates_.erase(lba);
-              }
-            }
-          }
+      // Read cached data
+      if (entry.len_ == Config::getInstance().getChunkSize()) {
+        IOModule::getInstance().read(CACHE_DEVICE, entry.cachedataLocation_, buf, entry.len_);
+      } else {
+        // Read chunk metadata (compressed length)
+        uint64_t metadataLocation = FPIndex::cachedataLocationToMetadataLocation(entry.cachedataLocation_);
+        if (metadataLocation == ~0ull) {
+          // The log segment has been cleaned, the lba now points elsewhere
+          return false;
         }
+        IOModule::getInstance().read(CACHE_DEVICE, metadataLocation,
+            &metadata, Config::getInstance().getMetadataSize());
+        IOModule::getInstance().read(CACHE_DEVICE, entry.cachedataLocation_, compressedData, entry.len_);
+        // Decompress cached data
+        memset(buf, 0, Config::getInstance().getChunkSize());
+        CompressionModule::decompress(compressedData, buf,
+                                      metadata.compressedLen_, Config::getInstance().getChunkSize());
       }
+      return true;
+    }
+
+    void DirtyList::markClean(const DirtyEntry &entry) {
+      MetadataModule::getInstance().markClean(entry.lba_, entry.cachedataLocation_);
     }
 
     void DirtyList::flushOneLba(uint64_t lba, uint64_t cachedataLocation, Metadata &metadata) {
-      alignas(512) uint8_t compressedData[Config::getInstance().getChunkSize()];
-      alignas(512) uint8_t uncompressedData[Config::getInstance().getChunkSize()];
-      bool isDirty = false;
-      {
-        std::lock_guard<std::mutex> l(listMutex_);
-        if (latestUpdates_.find(lba) != latestUpdates_.end()) {
-          if (latestUpdates_[lba].first == cachedataLocation) {
-            isDirty = true;
-          }
-        }
-      }
-      if (isDirty) {
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      BufferPool::Buffer uncompressedBuf = BufferPool::getInstance().acquire();
+      uint8_t *compressedData = compressedBuf.get(), *uncompressedData = uncompressedBuf.get();
+      std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+      uint64_t latestLocation;
+      uint32_t latestLen;
+      if (getLatestUpdate(lba, latestLocation, latestLen) && latestLocation == cachedataLocation) {
         uint32_t len = metadata.compressedLen_;
         len = (len + 511) / 512 * 512;
         if (len == 0) len = Config::getInstance().getChunkSize();
@@ -82,73 +53,77 @@ namespace cache {
         } else {
           IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, compressedData, len);
           // Decompress cached data
-          memset(uncompressedData, 0, 32768);
-          compressionModule_->decompress(compressedData, uncompressedData,
+          memset(uncompressedData, 0, Config::getInstance().getChunkSize());
+          CompressionModule::decompress(compressedData, uncompressedData,
               metadata.compressedLen_, Config::getInstance().getChunkSize());
         }
         IOModule::getInstance().write(PRIMARY_DEVICE, lba, uncompressedData,
             Config::getInstance().getChunkSize());
+        Stats::getInstance().add_lbas_flushed_on_eviction(1);
+
+        // The lba is clean now
+        eraseLatestUpdate(lba, cachedataLocation);
       }
     }
 
     void DirtyList::flushOneBlock(uint64_t cachedataLocation, uint32_t len) {
-      alignas(512) uint8_t compressedData[Config::getInstance().getChunkSize()];
-      alignas(512) uint8_t uncompressedData[Config::getInstance().getChunkSize()];
+      BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+      BufferPool::Buffer uncompressedBuf = BufferPool::getInstance().acquire();
+      uint8_t *compressedData = compressedBuf.get(), *uncompressedData = uncompressedBuf.get();
       alignas(512) Metadata metadata{};
 
       std::vector<uint64_t> lbasToFlush;
+      std::vector<uint64_t> dirtyLbas;
       // Case 1: We have a newly evicted block.
-      uint64_t metadataLocation = FPIndex::cachedataLocationToMetadataLocation(cachedataLocation);
-
-      lbasToFlush.clear();
-
-      // Read chunk metadata (compressed length)
-      IOModule::getInstance().read(CACHE_DEVICE, metadataLocation, &metadata, Config::getInstance().getMetadataSize());
-      std::set<uint64_t> lbas;
-      for (int i = 0; i < metadata.numLBAs_; ++i) {
-        uint64_t lba = metadata.LBAs_[i];
-        lbas.insert(lba);
-      }
-      for (auto lba : lbas) {
-        {
-          std::lock_guard<std::mutex> l(listMutex_);
-          if (latestUpdates_.find(lba) != latestUpdates_.end()) {
-            if (latestUpdates_[lba].first == cachedataLocation) {
-              if (latestUpdates_[lba].second != len) {
-                std::cout << "Not match!" << std::endl;
-                std::cout << lbas.size() << metadata.numLBAs_ << std::endl;
-                std::cout << lba << std::endl;
-                std::cout << latestUpdates_[lba].second << " " << len << std::endl;
-                assert(0);
-              }
-              lbasToFlush.push_back(lba);
-            }
+      // Only the dirty lbas pointing to the block matter, a clean block costs no SSD read.
+      getDirtyLbas(cachedataLocation, dirtyLbas);
+      for (auto lba : dirtyLbas) {
+        uint64_t latestLocation;
+        uint32_t latestLen;
+        if (getLatestUpdate(lba, latestLocation, latestLen) && latestLocation == cachedataLocation) {
+          if (latestLen != len) {
+            std::cout << "Not match!" << std::endl;
+            std::cout << lba << std::endl;
+            std::cout << latestLen << " " << len << std::endl;
+            assert(0);
           }
+          lbasToFlush.push_back(lba);
         }
       }
+      if (lbasToFlush.empty()) {
+        return;
+      }
 
+      if (len != Config::getInstance().getChunkSize()) {
+        // Read chunk metadata (compressed length)
+        IOModule::getInstance().read(CACHE_DEVICE,
+            FPIndex::cachedataLocationToMetadataLocation(cachedataLocation),
+            &metadata, Config::getInstance().getMetadataSize());
+      }
       // Read cached data
       if (len == Config::getInstance().getChunkSize()) {
         IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, uncompressedData, len);
       } else {
         IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, compressedData, len);
         // Decompress cached data
-        memset(uncompressedData, 0, 32768);
-        compressionModule_->decompress(compressedData, uncompressedData,
+        memset(uncompressedData, 0, Config::getInstance().getChunkSize());
+        CompressionModule::decompress(compressedData, uncompressedData,
             metadata.compressedLen_, Config::getInstance().getChunkSize());
       }
+      // Hand the data to the destager so that the slot can be reused right away
+      if (stageEvictedLbas(lbasToFlush, cachedataLocation, len, uncompressedData)) {
+        return;
+      }
       for (auto lba : lbasToFlush) {
+        // A flusher may have written back the lba in the meantime
+        std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+        if (!isLatestUpdate(lba, cachedataLocation, len)) {
+          continue;
+        }
         IOModule::getInstance().write(PRIMARY_DEVICE, lba, uncompressedData,
             Config::getInstance().getChunkSize());
-      }
-      {
-        // Hold the lock to avoid race
-        std::lock_guard<std::mutex> l(listMutex_);
-        for (auto lba : lbasToFlush) {
-          if (latestUpdates_[lba].first == cachedataLocation) {
-            latestUpdates_.erase(lba);
-          }
-        }
+        Stats::getInstance().add_lbas_flushed_on_eviction(1);
+        eraseLatestUpdate(lba, cachedataLocation);
       }
     }
 }
@@ -1,40 +1,45 @@
 #if defined(DLRU) || defined(DARC) || defined(BUCKETDLRU)
 
 #include "dirtylist.h"
+#include "common/stats.h"
+#include "io/buffer_pool.h"
 
 namespace cache {
-void DirtyList::flush() {
-  alignas(512) uint8_t data[Config::getInstance().getChunkSize()];
+bool DirtyList::readDirtyChunk(const DirtyEntry &entry, uint8_t *buf) {
+  // Read cached data
+  IOModule::getInstance().read(CACHE_DEVICE, entry.cachedataLocation_, buf, Config::getInstance().getChunkSize());
+  return true;
+}
 
-  if (latestUpdates_.size() >= size_) {
-    for (auto pr : latestUpdates_) {
-      uint64_t lba = pr.first;
-      uint64_t cachedataLocation = pr.second.first;
-      // Read cached data
-      IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, data, Config::getInstance().getChunkSize());
-      IOModule::getInstance().write(PRIMARY_DEVICE, lba, data, Config::getInstance().getChunkSize());
-    }
-    latestUpdates_.clear();
-  }
+void DirtyList::markClean(const DirtyEntry &) {
+  // The metadata of CacheDedup is not persisted
 }
 
 void DirtyList::flushOneBlock(uint64_t cachedataLocation, uint32_t len) {
-  alignas(512) uint8_t data[Config::getInstance().getChunkSize()];
+  BufferPool::Buffer buffer = BufferPool::getInstance().acquire();
+  uint8_t *data = buffer.get();
 
   std::vector<uint64_t> lbasToFlush;
-  lbasToFlush.clear();
-  for (auto pr : latestUpdates_) {
-    if (pr.second.first == cachedataLocation) {
-      assert(pr.second.second == len);
-      lbasToFlush.push_back(pr.first);
-    }
+  getDirtyLbas(cachedataLocation, lbasToFlush);
+  if (lbasToFlush.empty()) {
+    return;
   }
   // Read cached data
   IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, data, Config::getInstance().getChunkSize());
+  // Hand the data to the destager so that the slot can be reused right away
+  if (stageEvictedLbas(lbasToFlush, cachedataLocation, len, data)) {
+    return;
+  }
 
   for (auto lba : lbasToFlush) {
+    // A flusher may have written back the lba in the meantime
+    std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+    if (!isLatestUpdate(lba, cachedataLocation, len)) {
+      continue;
+    }
     IOModule::getInstance().write(PRIMARY_DEVICE, lba, data, Config::getInstance().getChunkSize());
-    latestUpdates_.erase(lba);
+    Stats::getInstance().add_lbas_flushed_on_eviction(1);
+    eraseLatestUpdate(lba, cachedataLocation);
   }
 }
 }
@@ -1,54 +1,99 @@
 #if defined(CDARC)
 
 #include "dirtylist.h"
+#include "common/stats.h"
+#include "io/buffer_pool.h"
 #include "manage/manage_module.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace cache {
-void DirtyList::flush() {
-  alignas(512) uint8_t compressedData[Config::getInstance().getChunkSize()];
-  alignas(512) uint8_t decompressedData[Config::getInstance().getChunkSize()];
-
-  if (latestUpdates_.size() >= size_) {
-    for (auto pr : latestUpdates_) {
-      uint64_t lba = pr.first;
-      uint64_t cachedataLocation = pr.second.first;
-      uint32_t len = pr.second.second;
-      // Read cached compressedData
-      IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, compressedData, len);
-      CompressionModule::getInstance().decompress(compressedData, decompressedData, len, Config::getInstance().getChunkSize());
-      IOModule::getInstance().write(PRIMARY_DEVICE, lba, decompressedData, Config::getInstance().getChunkSize());
-    }
-    latestUpdates_.clear();
+bool DirtyList::readDirtyChunk(const DirtyEntry &entry, uint8_t *buf) {
+  BufferPool::Buffer compressedBuf = BufferPool::getInstance().acquire();
+  uint8_t *compressedData = compressedBuf.get();
+  // The cache data location of CDARC is (weu id, offset in the weu)
+  uint32_t weuId = entry.cachedataLocation_ >> 32;
+  uint32_t offset = entry.cachedataLocation_; // & 0xffffffff;
+  if (!ManageModule::getInstance().readWEU(weuId, offset, compressedData, entry.len_)) {
+    return false;
   }
+  CompressionModule::getInstance().decompress(compressedData, buf, entry.len_, Config::getInstance().getChunkSize());
+  return true;
+}
+
+void DirtyList::markClean(const DirtyEntry &) {
+  // The metadata of CacheDedup is not persisted
 }
 
 void DirtyList::flushOneBlock(uint64_t weuId, uint32_t len) {
-  alignas(512) uint8_t compressedData[Config::getInstance().getChunkSize()];
-  alignas(512) uint8_t decompressedData[Config::getInstance().getChunkSize()];
-
-  std::vector<uint64_t> lbasToFlush;
-  std::vector<std::pair<uint32_t, uint32_t>> locationsOfLbasToFlush;
-  lbasToFlush.clear();
-  locationsOfLbasToFlush.clear();
-  for (auto pr : latestUpdates_) {
-    // Due to that each time a WEU is evicted, all of the chunks reside in the WEU must be flushed
-    uint32_t _weuId = pr.second.first >> 32;
-    uint32_t offset = pr.second.first; // & 0xffffffff;
-    if (_weuId == weuId) {
-      lbasToFlush.push_back(pr.first);
-      locationsOfLbasToFlush.push_back(std::make_pair(ManageModule::getInstance().weuToCachedataLocation_[weuId]
-            + offset, pr.second.second));
+  BufferPool::Buffer decompressedBuf = BufferPool::getInstance().acquire();
+  uint8_t *decompressedData = decompressedBuf.get();
+
+  // Due to that each time a WEU is evicted, all of the chunks reside in the WEU must be flushed
+  std::vector<uint64_t> lbas;
+  getDirtyLbas(weuId << 32, lbas);
+  std::vector<DirtyEntry> entries;
+  uint32_t weuSpan = 0;
+  for (auto lba : lbas) {
+    DirtyEntry entry{lba, 0, 0};
+    if (getLatestUpdate(lba, entry.cachedataLocation_, entry.len_)
+        && (entry.cachedataLocation_ >> 32) == weuId) {
+      entries.push_back(entry);
+      weuSpan = std::max(weuSpan, (uint32_t)entry.cachedataLocation_ + entry.len_);
     }
   }
-  for (uint32_t i = 0; i < lbasToFlush.size(); ++i) {
-    uint64_t lba = lbasToFlush[i];
-    uint64_t cachedataLocation = locationsOfLbasToFlush[i].first;
-    uint32_t len = locationsOfLbasToFlush[i].second;
-    // Read cached compressedData
-    IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, compressedData, Config::getInstance().getChunkSize());
-    CompressionModule::getInstance().decompress(compressedData, decompressedData, len, Config::getInstance().getChunkSize());
-    IOModule::getInstance().write(PRIMARY_DEVICE, lba, decompressedData, Config::getInstance().getChunkSize());
-    latestUpdates_.erase(lba);
+  if (entries.empty()) {
+    return;
+  }
+  std::sort(entries.begin(), entries.end(),
+      [](const DirtyEntry &a, const DirtyEntry &b) { return a.lba_ < b.lba_; });
+
+  // Fetch the WEU (up to its last dirty chunk) with one sequential sweep of
+  // chunk-sized pool buffers
+  uint32_t chunkSize = Config::getInstance().getChunkSize();
+  weuSpan = (weuSpan + 511) / 512 * 512;
+  std::vector<BufferPool::Buffer> weuPieces;
+  for (uint32_t pieceOffset = 0; pieceOffset < weuSpan; pieceOffset += chunkSize) {
+    weuPieces.emplace_back(BufferPool::getInstance().acquire());
+    // The evicted WEU is flushed before ManageModule unmaps it or reuses
+    // its id, so it cannot be gone here
+    if (!ManageModule::getInstance().readWEU(weuId, pieceOffset, weuPieces.back().get(),
+          std::min(chunkSize, weuSpan - pieceOffset))) {
+      std::cout << "Cannot read evicted WEU " << weuId << ", "
+                << entries.size() << " dirty lbas would be lost" << std::endl;
+      exit(-1);
+    }
+  }
+  // A compressed chunk across two pieces is put back together here
+  BufferPool::Buffer joinedBuf = BufferPool::getInstance().acquire();
+
+  for (auto &entry : entries) {
+    uint64_t lba = entry.lba_;
+    uint64_t location = entry.cachedataLocation_;
+    uint32_t offset = location; // & 0xffffffff;
+    // A flusher may have written back the lba in the meantime
+    std::lock_guard<std::mutex> flushLock(getFlushLock(lba));
+    if (!isLatestUpdate(lba, location, entry.len_)) {
+      continue;
+    }
+    uint8_t *compressedData = weuPieces[offset / chunkSize].get() + offset % chunkSize;
+    uint32_t lenInPiece = chunkSize - offset % chunkSize;
+    if (entry.len_ > lenInPiece) {
+      memcpy(joinedBuf.get(), compressedData, lenInPiece);
+      memcpy(joinedBuf.get() + lenInPiece, weuPieces[offset / chunkSize + 1].get(), entry.len_ - lenInPiece);
+      compressedData = joinedBuf.get();
+      Stats::getInstance().add_copy(entry.len_);
+    }
+    CompressionModule::getInstance().decompress(compressedData, decompressedData,
+        entry.len_, chunkSize);
+    // Hand the data to the destager so that the WEU can be reused right away
+    if (stageEvictedLbas({lba}, location, entry.len_, decompressedData)) {
+      continue;
+    }
+    IOModule::getInstance().write(PRIMARY_DEVICE, lba, decompressedData, chunkSize);
+    Stats::getInstance().add_lbas_flushed_on_eviction(1);
+    eraseLatestUpdate(lba, location);
   }
 }
 }
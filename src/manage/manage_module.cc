@@ -1,4 +1,6 @@
 #include "manage_module.h"
+#include "dirtylist.h"
+#include "read_ahead.h"
 #include "common/stats.h"
 #include "utils/utils.h"
 #include <cassert>
@@ -38,6 +40,7 @@ namespace cache {
       buf = chunk.buf_;
       len = chunk.len_;
 #elif defined(CDARC)
+      std::lock_guard<std::mutex> l(weuMutex_);
       if (currentWEUId_ == chunk.weuId_) {
         deviceType = IN_MEM_BUFFER;
         addr = chunk.weuOffset_;
@@ -78,6 +81,16 @@ namespace cache {
     uint8_t *buf;
     uint32_t len;
     generateReadRequest(chunk, deviceType, addr, buf, len);
+    // Evicted dirty data may still be on its way to the primary device
+    if (deviceType == PRIMARY_DEVICE
+        && Config::getInstance().getCacheMode() == tWriteBack
+        && DirtyList::getInstance().readStaged(addr, buf, len)) {
+      return 0;
+    }
+    if (deviceType == PRIMARY_DEVICE
+        && ReadAhead::getInstance().read(addr, buf, len)) {
+      return 0;
+    }
     IOModule::getInstance().read(deviceType, addr, buf, len);
 
     return 0;
@@ -118,10 +131,13 @@ namespace cache {
       buf = chunk.buf_;
       len = chunk.len_;
 #elif defined(CDARC)
+      std::lock_guard<std::mutex> l(weuMutex_);
       uint64_t evictedCachedataLocation = -1;
       if (currentWEUId_ != chunk.weuId_) {
         if (chunk.evictedWEUId_ != currentWEUId_) {
           if (chunk.evictedWEUId_ != ~0u) {
+            // The dirty chunks of the evicted WEU were flushed when the FP
+            // index evicted it (CDARCFPIndex::update), before this unmapping
             evictedCachedataLocation = weuToCachedataLocation_[chunk.evictedWEUId_];
             weuToCachedataLocation_.erase(chunk.evictedWEUId_);
 
@@ -171,4 +187,21 @@ namespace cache {
     END_TIMER(update_index);
   }
 
+#if defined(CDARC)
+  bool ManageModule::readWEU(uint32_t weuId, uint32_t weuOffset, uint8_t *buf, uint32_t len)
+  {
+    std::lock_guard<std::mutex> l(weuMutex_);
+    if (currentWEUId_ == weuId) {
+      IOModule::getInstance().read(IN_MEM_BUFFER, weuOffset, buf, len);
+    } else {
+      auto it = weuToCachedataLocation_.find(weuId);
+      if (it == weuToCachedataLocation_.end()) {
+        return false;
+      }
+      IOModule::getInstance().read(CACHE_DEVICE, it->second + weuOffset, buf, len);
+    }
+    return true;
+  }
+#endif
+
 }
@@ -30,8 +30,14 @@ class ManageModule {
 
 #if defined(CDARC)
  public:
+  // Read data in a WEU, either from the SSD or from the in-memory WEU.
+  // Return false if the WEU is no longer cached.
+  bool readWEU(uint32_t weuId, uint32_t weuOffset, uint8_t *buf, uint32_t len);
+
   // maintain WEU to SSD locations
+  // weuMutex_ guards the mapping against the write-back flushers
   std::map<uint32_t, uint64_t> weuToCachedataLocation_;
+  std::mutex weuMutex_;
   uint32_t weuSize_;
   uint32_t currentWEUId_;
   uint64_t currentCachedataLocation_;
@@ -0,0 +1,165 @@
+#include "read_ahead.h"
+#include "dirtylist.h"
+#include "common/common.h"
+#include "common/config.h"
+#include "common/stats.h"
+#include "io/io_module.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace cache {
+
+  ReadAhead& ReadAhead::getInstance() {
+    static ReadAhead instance;
+    return instance;
+  }
+
+  ReadAhead::ReadAhead() :
+    clock_(0)
+  {
+    maxWindow_ = Config::getInstance().getReadAheadChunks();
+    nEntriesMax_ = Config::getInstance().getReadAheadBufferSize() / Config::getInstance().getChunkSize();
+    if (nEntriesMax_ == 0) {
+      maxWindow_ = 0;
+    }
+    streams_.resize(kNumStreams, {~0ull, 0, 0});
+  }
+
+  uint32_t ReadAhead::findStream(uint64_t lba)
+  {
+    uint32_t victim = 0;
+    for (uint32_t streamId = 0; streamId < streams_.size(); ++streamId) {
+      if (streams_[streamId].nextLba_ == lba) {
+        return streamId;
+      }
+      if (streams_[streamId].lastAccess_ < streams_[victim].lastAccess_) {
+        victim = streamId;
+      }
+    }
+    streams_[victim] = {~0ull, 0, 0};
+    return victim;
+  }
+
+  bool ReadAhead::read(uint64_t lba, uint8_t *buf, uint32_t len)
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    if (!isEnabled() || len != chunkSize || lba % chunkSize != 0) {
+      return false;
+    }
+    std::unique_lock<std::mutex> l(mutex_);
+    auto it = lbaToEntry_.find(lba);
+    if (it != lbaToEntry_.end()) {
+      memcpy(buf, it->second->data_.get(), len);
+      Stats::getInstance().add_copy(len);
+      erase(it->second, true);
+      return true;
+    }
+
+    uint32_t streamId = findStream(lba);
+    Stream &stream = streams_[streamId];
+    stream.lastAccess_ = ++clock_;
+    if (stream.nextLba_ != lba) {
+      // A new stream, read ahead from its next miss on
+      stream.nextLba_ = lba + len;
+      return false;
+    }
+
+    stream.window_ = std::min(maxWindow_, std::min(nEntriesMax_,
+          stream.window_ == 0 ? kInitialWindow : stream.window_ * 2));
+    // Stay on the volume and do not read ahead what is newer in the cache
+    uint64_t volumeEnd = toLba(getVolumeId(lba), Config::getInstance().getPrimaryDeviceSize());
+    uint32_t nChunks = 1;
+    while (nChunks <= stream.window_ && lba + 1ull * nChunks * chunkSize < volumeEnd
+           && !(Config::getInstance().getCacheMode() == tWriteBack
+                && DirtyList::getInstance().isDirty(lba + 1ull * nChunks * chunkSize))) {
+      ++nChunks;
+    }
+    if (nChunks == 1) {
+      stream.nextLba_ = lba + len;
+      return false;
+    }
+
+    stream.nextLba_ = lba + 1ull * nChunks * chunkSize;
+    auto inFlightRead = inFlightReads_.insert(inFlightReads_.end(),
+        {lba + chunkSize, stream.nextLba_, {}});
+    l.unlock();
+
+    uint8_t *data = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&data), 512, 1ull * nChunks * chunkSize) != 0) {
+      std::cout << "Cannot allocate memory!" << std::endl;
+      exit(-1);
+    }
+    IOModule::getInstance().read(PRIMARY_DEVICE, lba, data, nChunks * chunkSize);
+    memcpy(buf, data, len);
+    Stats::getInstance().add_copy(len);
+
+    l.lock();
+    auto &invalidatedLbas = inFlightRead->invalidatedLbas_;
+    for (uint32_t i = 1; i < nChunks; ++i) {
+      uint64_t chunkLba = lba + 1ull * i * chunkSize;
+      // The data read may be older than a write issued meanwhile
+      if (std::find(invalidatedLbas.begin(), invalidatedLbas.end(), chunkLba) == invalidatedLbas.end()) {
+        insert(chunkLba, streamId, data + 1ull * i * chunkSize);
+      }
+    }
+    inFlightReads_.erase(inFlightRead);
+    l.unlock();
+    free(data);
+    Stats::getInstance().add_read_ahead(nChunks - 1);
+    return true;
+  }
+
+  void ReadAhead::insert(uint64_t lba, uint32_t streamId, const uint8_t *data)
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    auto it = lbaToEntry_.find(lba);
+    if (it != lbaToEntry_.end()) {
+      erase(it->second, false);
+    }
+    while (entries_.size() >= nEntriesMax_) {
+      erase(std::prev(entries_.end()), false);
+    }
+    uint8_t *buf = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&buf), 512, chunkSize) != 0) {
+      std::cout << "Cannot allocate memory!" << std::endl;
+      exit(-1);
+    }
+    memcpy(buf, data, chunkSize);
+    Stats::getInstance().add_copy(chunkSize);
+    entries_.push_front({lba, streamId, std::unique_ptr<uint8_t, decltype(&free)>(buf, free)});
+    lbaToEntry_[lba] = entries_.begin();
+  }
+
+  void ReadAhead::erase(std::list<Entry>::iterator it, bool isUsed)
+  {
+    if (isUsed) {
+      Stats::getInstance().add_read_ahead_hit();
+    } else {
+      // Read ahead too far, or overwritten
+      Stream &stream = streams_[it->streamId_];
+      stream.window_ = std::max((uint32_t)kInitialWindow, stream.window_ / 2);
+      Stats::getInstance().add_read_ahead_wasted();
+    }
+    lbaToEntry_.erase(it->lba_);
+    entries_.erase(it);
+  }
+
+  void ReadAhead::invalidate(uint64_t lba)
+  {
+    if (!isEnabled()) {
+      return;
+    }
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = lbaToEntry_.find(lba);
+    if (it != lbaToEntry_.end()) {
+      erase(it->second, false);
+    }
+    for (auto &inFlightRead : inFlightReads_) {
+      if (lba >= inFlightRead.beginLba_ && lba < inFlightRead.endLba_) {
+        inFlightRead.invalidatedLbas_.push_back(lba);
+      }
+    }
+  }
+}
@@ -0,0 +1,85 @@
+/* File: manage/read_ahead.h
+ * Description:
+ *   This file contains the declaration of ReadAhead, which turns the primary
+ *   device reads of sequential read misses into fewer, larger reads.
+ *
+ *   1. Streams of read misses are tracked per volume and address. A miss
+ *      that continues a stream reads its chunk and the next window chunks
+ *      from the primary device at once; the extra chunks are kept in a
+ *      bounded in-memory buffer (LRU) until they are read.
+ *   2. The window of a stream starts at two chunks and doubles each time the
+ *      stream reaches the end of what was read ahead, up to readAheadChunks.
+ *      It is halved whenever a chunk read ahead for it leaves the buffer
+ *      unused.
+ *   3. A chunk read ahead is served like a primary read: it still goes
+ *      through the admission path of a read miss. Writes invalidate it, and
+ *      lbas dirty in the cache are never read ahead.
+ *   4. The mutex guards the streams and the buffer only; the primary device
+ *      is read without it. Writes during the read are recorded against the
+ *      read in flight, and the chunks they hit are not inserted.
+ */
+#ifndef __READ_AHEAD_H__
+#define __READ_AHEAD_H__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace cache {
+
+class ReadAhead {
+ public:
+  static ReadAhead& getInstance();
+
+  inline bool isEnabled() { return maxWindow_ != 0; }
+  // Serve a primary read of a missed chunk from the read-ahead buffer, or
+  // read ahead if the chunk continues a stream. Return false if the caller
+  // must read the chunk itself.
+  bool read(uint64_t lba, uint8_t *buf, uint32_t len);
+  // The lba is written, drop its copy read ahead
+  void invalidate(uint64_t lba);
+
+ private:
+  ReadAhead();
+
+  struct Stream {
+    uint64_t nextLba_;
+    uint32_t window_;
+    uint64_t lastAccess_;
+  };
+  struct Entry {
+    uint64_t lba_;
+    uint32_t streamId_;
+    std::unique_ptr<uint8_t, decltype(&free)> data_;
+  };
+  // Chunks [beginLba_, endLba_) being read ahead
+  struct InFlightRead {
+    uint64_t beginLba_;
+    uint64_t endLba_;
+    std::vector<uint64_t> invalidatedLbas_;
+  };
+
+  uint32_t findStream(uint64_t lba);
+  void insert(uint64_t lba, uint32_t streamId, const uint8_t *data);
+  void erase(std::list<Entry>::iterator it, bool isUsed);
+
+  static const uint32_t kInitialWindow = 2;
+  static const uint32_t kNumStreams = 16;
+
+  uint32_t maxWindow_;
+  uint32_t nEntriesMax_;
+  uint64_t clock_;
+  std::vector<Stream> streams_;
+  // Most recently read ahead first
+  std::list<Entry> entries_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> lbaToEntry_;
+  std::list<InFlightRead> inFlightReads_;
+  std::mutex mutex_;
+};
+
+}
+
+#endif //__READ_AHEAD_H__
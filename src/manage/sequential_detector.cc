@@ -0,0 +1,40 @@
+#include "sequential_detector.h"
+#include "common/config.h"
+
+namespace cache {
+
+  SequentialDetector& SequentialDetector::getInstance() {
+    static SequentialDetector instance;
+    return instance;
+  }
+
+  SequentialDetector::SequentialDetector() :
+    clock_(0)
+  {
+    cutoff_ = Config::getInstance().getSequentialCutoff();
+    // Empty streams never match a request, they are replaced first
+    streams_.resize(Config::getInstance().getnSequentialStreams(), {0, ~0ull, 0, 0});
+  }
+
+  bool SequentialDetector::isSequential(uint32_t volumeId, uint64_t addr, uint32_t len)
+  {
+    if (!isEnabled() || streams_.empty()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> l(mutex_);
+    Stream *victim = &streams_[0];
+    for (auto &stream : streams_) {
+      if (stream.volumeId_ == volumeId && stream.nextAddr_ == addr) {
+        stream.nextAddr_ = addr + len;
+        stream.nBytes_ += len;
+        stream.lastAccess_ = ++clock_;
+        return stream.nBytes_ >= cutoff_;
+      }
+      if (stream.lastAccess_ < victim->lastAccess_) {
+        victim = &stream;
+      }
+    }
+    *victim = {volumeId, addr + len, len, ++clock_};
+    return len >= cutoff_;
+  }
+}
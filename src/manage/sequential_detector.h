@@ -0,0 +1,48 @@
+/* File: manage/sequential_detector.h
+ * Description:
+ *   This file contains the declaration of SequentialDetector, which finds
+ *   sequential streams (e.g., backups and scans) among the requests so that
+ *   they can bypass the cache.
+ *
+ *   1. A stream is a run of requests on one volume, each starting where the
+ *      previous one ended. A bounded number of streams are tracked at a time,
+ *      and the least recently extended one is replaced by a new stream.
+ *   2. A request is sequential when the stream it extends (or the request
+ *      itself) reaches the sequential cutoff.
+ */
+#ifndef __SEQUENTIAL_DETECTOR_H__
+#define __SEQUENTIAL_DETECTOR_H__
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace cache {
+
+class SequentialDetector {
+ public:
+  static SequentialDetector& getInstance();
+
+  inline bool isEnabled() { return cutoff_ != 0; }
+  // Record the request and tell whether it belongs to a sequential stream
+  bool isSequential(uint32_t volumeId, uint64_t addr, uint32_t len);
+
+ private:
+  SequentialDetector();
+
+  struct Stream {
+    uint32_t volumeId_;
+    uint64_t nextAddr_;
+    uint64_t nBytes_;
+    uint64_t lastAccess_;
+  };
+
+  uint64_t cutoff_;
+  uint64_t clock_;
+  std::vector<Stream> streams_;
+  std::mutex mutex_;
+};
+
+}
+
+#endif //__SEQUENTIAL_DETECTOR_H__
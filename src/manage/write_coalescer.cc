@@ -0,0 +1,131 @@
+#include "write_coalescer.h"
+#include "common/config.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace cache {
+
+  WriteCoalescer& WriteCoalescer::getInstance() {
+    static WriteCoalescer instance;
+    return instance;
+  }
+
+  WriteCoalescer::WriteCoalescer() :
+    nEntries_(0)
+  {
+    chunkSize_ = Config::getInstance().getChunkSize();
+    nSectorsPerChunk_ = chunkSize_ / kSectorSize;
+    nEntriesMax_ = Config::getInstance().getWriteCoalescingBufferSize() / chunkSize_;
+  }
+
+  WriteCoalescer::Entry *WriteCoalescer::find(uint64_t lba)
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = lbaToEntry_.find(lba);
+    if (it == lbaToEntry_.end()) {
+      return nullptr;
+    }
+    // Keep the chunks in use in the buffer
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &*it->second;
+  }
+
+  WriteCoalescer::Entry *WriteCoalescer::insert(uint64_t lba)
+  {
+    uint8_t *data = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&data), 512, chunkSize_) != 0) {
+      std::cout << "Cannot allocate memory!" << std::endl;
+      exit(-1);
+    }
+    uint8_t *validSectors = new uint8_t[(nSectorsPerChunk_ + 7) / 8];
+    memset(validSectors, 0, (nSectorsPerChunk_ + 7) / 8);
+    std::lock_guard<std::mutex> l(mutex_);
+    entries_.push_front({lba, 0, false,
+        std::unique_ptr<uint8_t, decltype(&free)>(data, free),
+        std::unique_ptr<uint8_t[]>(validSectors)});
+    lbaToEntry_[lba] = entries_.begin();
+    nEntries_.store(entries_.size(), std::memory_order_relaxed);
+    return &entries_.front();
+  }
+
+  bool WriteCoalescer::getVictim(uint64_t &lba)
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (entries_.empty()) {
+      return false;
+    }
+    lba = entries_.back().lba_;
+    return true;
+  }
+
+  void WriteCoalescer::erase(uint64_t lba)
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = lbaToEntry_.find(lba);
+    if (it == lbaToEntry_.end()) {
+      return;
+    }
+    entries_.erase(it->second);
+    lbaToEntry_.erase(it);
+    nEntries_.store(entries_.size(), std::memory_order_relaxed);
+  }
+
+  bool WriteCoalescer::isValid(const Entry &entry, uint32_t sectorId) const
+  {
+    return (entry.validSectors_[sectorId / 8] >> (sectorId % 8)) & 1u;
+  }
+
+  void WriteCoalescer::merge(Entry &entry, uint32_t offset, const uint8_t *buf, uint32_t len)
+  {
+    memcpy(entry.data_.get() + offset, buf, len);
+    for (uint32_t sectorId = offset / kSectorSize;
+         sectorId < (offset + len + kSectorSize - 1) / kSectorSize; ++sectorId) {
+      if (!isValid(entry, sectorId)) {
+        entry.validSectors_[sectorId / 8] |= 1u << (sectorId % 8);
+        ++entry.nValidSectors_;
+      }
+    }
+  }
+
+  void WriteCoalescer::fill(Entry &entry, const uint8_t *chunk)
+  {
+    for (uint32_t sectorId = 0; sectorId < nSectorsPerChunk_; ++sectorId) {
+      if (!isValid(entry, sectorId)) {
+        memcpy(entry.data_.get() + sectorId * kSectorSize,
+            chunk + sectorId * kSectorSize, kSectorSize);
+        entry.validSectors_[sectorId / 8] |= 1u << (sectorId % 8);
+      }
+    }
+    entry.nValidSectors_ = nSectorsPerChunk_;
+    entry.isFilled_ = true;
+  }
+
+  void WriteCoalescer::overlay(const Entry &entry, uint8_t *chunk)
+  {
+    for (uint32_t sectorId = 0; sectorId < nSectorsPerChunk_; ++sectorId) {
+      if (isValid(entry, sectorId)) {
+        memcpy(chunk + sectorId * kSectorSize,
+            entry.data_.get() + sectorId * kSectorSize, kSectorSize);
+      }
+    }
+  }
+
+  bool WriteCoalescer::needsFill(const Entry &entry, uint32_t offset, uint32_t len)
+  {
+    uint32_t first = offset / kSectorSize, last = (offset + len - 1) / kSectorSize;
+    return (offset % kSectorSize != 0 && !isValid(entry, first))
+      || ((offset + len) % kSectorSize != 0 && !isValid(entry, last));
+  }
+
+  bool WriteCoalescer::covers(const Entry &entry, uint32_t offset, uint32_t len)
+  {
+    for (uint32_t sectorId = offset / kSectorSize;
+         sectorId < (offset + len + kSectorSize - 1) / kSectorSize; ++sectorId) {
+      if (!isValid(entry, sectorId)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
@@ -0,0 +1,102 @@
+/* File: manage/write_coalescer.h
+ * Description:
+ *   This file contains the declaration of WriteCoalescer, a small in-memory
+ *   buffer of partial chunk writes.
+ *
+ *   1. The cache fingerprints, deduplicates and stores whole chunks only. A
+ *      write that covers part of a chunk is merged into a buffered copy of
+ *      that chunk, tracked at a granularity of kSectorSize bytes.
+ *   2. Once adjacent partial writes have covered the whole chunk, it is
+ *      written to the cache like any full chunk write. If a chunk leaves the
+ *      buffer before (LRU, or at shutdown), the sectors never written are
+ *      filled with its current data, read from the cache or the primary
+ *      device (read-modify-write).
+ *   3. Reads of a chunk with buffered sectors see them on top of the data
+ *      in the cache, and a full chunk write drops them.
+ *
+ *   WriteCoalescer holds no I/O logic; AustereCache drives it. The list of
+ *   entries is guarded by an internal mutex held only while it is searched
+ *   or changed. An entry is guarded by the lock of its chunk (one of
+ *   kNumChunkLocks stripes), which AustereCache holds across the I/O of the
+ *   chunk, so that the reads and writes of different chunks run in parallel.
+ */
+#ifndef __WRITE_COALESCER_H__
+#define __WRITE_COALESCER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cache {
+
+class WriteCoalescer {
+ public:
+  struct Entry {
+    uint64_t lba_;
+    uint32_t nValidSectors_;
+    // Completed with data read from the cache or the primary device
+    bool isFilled_;
+    std::unique_ptr<uint8_t, decltype(&free)> data_;
+    std::unique_ptr<uint8_t[]> validSectors_;
+  };
+
+  static WriteCoalescer& getInstance();
+
+  // Guard the entry of the chunk at lba, to be held by the caller of
+  // the methods below
+  inline std::mutex &getChunkLock(uint64_t lba)
+  {
+    return chunkLocks_[(lba / chunkSize_) % kNumChunkLocks];
+  }
+  // Whether any chunk has buffered sectors; can be checked without any lock
+  inline bool isEmpty() { return nEntries_.load(std::memory_order_relaxed) == 0; }
+  inline bool isFull() { return nEntries_.load(std::memory_order_relaxed) >= nEntriesMax_; }
+  inline bool isOverCapacity() { return nEntries_.load(std::memory_order_relaxed) > nEntriesMax_; }
+
+  Entry *find(uint64_t lba);
+  // A new entry for the chunk at lba, most recently written
+  Entry *insert(uint64_t lba);
+  // The chunk of the least recently written entry, false if there is none;
+  // requires no chunk lock, as its entry is guarded by another one
+  bool getVictim(uint64_t &lba);
+  void erase(uint64_t lba);
+
+  // Copy len bytes at offset of the chunk into the entry
+  void merge(Entry &entry, uint32_t offset, const uint8_t *buf, uint32_t len);
+  // Complete the entry with the current data of its chunk
+  void fill(Entry &entry, const uint8_t *chunk);
+  // Copy the buffered sectors of the entry onto the data of its chunk
+  void overlay(const Entry &entry, uint8_t *chunk);
+  // Whether merging [offset, offset + len) would leave a sector partly
+  // unknown, so that the entry must be filled first
+  bool needsFill(const Entry &entry, uint32_t offset, uint32_t len);
+  // Whether [offset, offset + len) is fully buffered
+  bool covers(const Entry &entry, uint32_t offset, uint32_t len);
+  inline bool isComplete(const Entry &entry) { return entry.nValidSectors_ == nSectorsPerChunk_; }
+
+  static const uint32_t kSectorSize = 512;
+  static const uint32_t kNumChunkLocks = 1024;
+
+ private:
+  WriteCoalescer();
+
+  bool isValid(const Entry &entry, uint32_t sectorId) const;
+
+  uint32_t chunkSize_;
+  uint32_t nSectorsPerChunk_;
+  uint32_t nEntriesMax_;
+  // Most recently written first
+  std::list<Entry> entries_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> lbaToEntry_;
+  std::atomic<uint32_t> nEntries_;
+  std::mutex mutex_;
+  std::mutex chunkLocks_[kNumChunkLocks];
+};
+
+}
+
+#endif //__WRITE_COALESCER_H__
@@ -0,0 +1,119 @@
+#include "admission_filter.h"
+#include "bitmap.h"
+#include "common/config.h"
+#include "common/stats.h"
+#include "utils/xxhash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cache {
+
+  AdmissionFilter& AdmissionFilter::getInstance() {
+    static AdmissionFilter instance;
+    return instance;
+  }
+
+  AdmissionFilter::AdmissionFilter()
+  {
+    threshold_ = Config::getInstance().getAdmissionThreshold();
+    // About as many counters per row as lbas the LBA index holds
+    uint32_t nLbas = Config::getInstance().getnLbaBuckets() * Config::getInstance().getnLBASlotsPerBucket();
+    nShards_ = std::max(std::min((uint32_t)kNumShards, nLbas / 2), 1u);
+    shardWidth_ = std::max(nLbas / nShards_ / 2 * 2, 2u);
+    width_ = shardWidth_ * nShards_;
+    nShardDoorkeeperBits_ = shardWidth_ * 8;
+    shards_ = std::make_unique<Shard[]>(nShards_);
+    if (isEnabled()) {
+      sketch_ = IndexMemory::allocate(kHeight * width_ * 4 / 8);
+      doorkeeper_ = IndexMemory::allocate(nShardDoorkeeperBits_ * nShards_ / 8);
+    }
+  }
+
+  uint32_t AdmissionFilter::getShardId(uint64_t lba)
+  {
+    return XXH32(&lba, 8, 1013) % nShards_;
+  }
+
+  uint32_t AdmissionFilter::getCounterId(uint32_t shardId, uint32_t i, uint64_t lba)
+  {
+    return i * width_ + shardId * shardWidth_ + XXH32(&lba, 8, i * 1003 + 7) % shardWidth_;
+  }
+
+  uint32_t AdmissionFilter::getDoorkeeperBit(uint32_t shardId, uint32_t j, uint64_t lba)
+  {
+    return shardId * nShardDoorkeeperBits_ + XXH32(&lba, 8, j * 1009 + 11) % nShardDoorkeeperBits_;
+  }
+
+  bool AdmissionFilter::isInDoorkeeper(uint32_t shardId, uint64_t lba)
+  {
+    for (uint32_t j = 0; j < kNumDoorkeeperHashes; ++j) {
+      if (!Bitmap::Manipulator(doorkeeper_.get()).get(getDoorkeeperBit(shardId, j, lba))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t AdmissionFilter::getCount(uint32_t shardId, uint64_t lba)
+  {
+    uint32_t minVal = 15;
+    for (uint32_t i = 0; i < kHeight; ++i) {
+      uint32_t counterId = getCounterId(shardId, i, lba);
+      minVal = std::min(minVal, Bitmap::Manipulator(sketch_.get()).getBits(counterId * 4, counterId * 4 + 4));
+    }
+    return minVal;
+  }
+
+  void AdmissionFilter::recordAccess(uint64_t lba)
+  {
+    if (!isEnabled()) {
+      return;
+    }
+    uint32_t shardId = getShardId(lba);
+    Shard &shard = shards_[shardId];
+    std::lock_guard<std::mutex> l(shard.mutex_);
+    if (!isInDoorkeeper(shardId, lba)) {
+      for (uint32_t j = 0; j < kNumDoorkeeperHashes; ++j) {
+        Bitmap::Manipulator(doorkeeper_.get()).set(getDoorkeeperBit(shardId, j, lba));
+      }
+    } else {
+      // Conservative update: only the smallest counters grow
+      uint32_t minVal = getCount(shardId, lba);
+      for (uint32_t i = 0; i < kHeight; ++i) {
+        uint32_t counterId = getCounterId(shardId, i, lba);
+        uint32_t countValue = Bitmap::Manipulator(sketch_.get()).getBits(counterId * 4, counterId * 4 + 4);
+        if (countValue == minVal && countValue < 15) {
+          Bitmap::Manipulator(sketch_.get()).storeBits(counterId * 4, counterId * 4 + 4, countValue + 1);
+        }
+      }
+    }
+    if (++shard.nAccesses_ >= 1ull * kSampleFactor * shardWidth_) {
+      age(shardId);
+    }
+  }
+
+  bool AdmissionFilter::isAdmitted(uint64_t lba)
+  {
+    if (!isEnabled()) {
+      return true;
+    }
+    uint32_t shardId = getShardId(lba);
+    std::lock_guard<std::mutex> l(shards_[shardId].mutex_);
+    return isInDoorkeeper(shardId, lba) + getCount(shardId, lba) >= threshold_;
+  }
+
+  void AdmissionFilter::age(uint32_t shardId)
+  {
+    // Counters are nibble-aligned, halve both counters of a byte at once
+    for (uint32_t i = 0; i < kHeight; ++i) {
+      uint8_t *row = sketch_.get() + (i * width_ + shardId * shardWidth_) * 4 / 8;
+      for (uint32_t k = 0; k < shardWidth_ * 4 / 8; ++k) {
+        row[k] = (row[k] >> 1u) & 0x77u;
+      }
+    }
+    memset(doorkeeper_.get() + shardId * nShardDoorkeeperBits_ / 8, 0, nShardDoorkeeperBits_ / 8);
+    shards_[shardId].nAccesses_ = 0;
+    Stats::getInstance().add_admission_filter_aged();
+  }
+}
@@ -0,0 +1,78 @@
+/* File: metadata/admission_filter.h
+ * Description:
+ *   This file contains the declaration of AdmissionFilter, a TinyLFU-style
+ *   frequency filter deciding whether a read miss is admitted into the cache,
+ *   so that blocks accessed once do not take SSD bandwidth and CPU
+ *   (fingerprinting, compression) from the working set.
+ *
+ *   1. A doorkeeper Bloom filter absorbs the first access of every lba, only
+ *      further accesses are counted in a count-min sketch of 4-bit counters
+ *      (the same layout as SketchReferenceCounter).
+ *   2. The estimated frequency of an lba is its doorkeeper bit plus its
+ *      sketch count; a read miss is admitted when it reaches the admission
+ *      threshold (2 admits a block at its second access).
+ *   3. The counters and the doorkeeper bits are split into kNumShards
+ *      shards by a hash of the lba, each with its own lock, so that accesses
+ *      to different lbas seldom contend. A shard is a range of whole bytes
+ *      of every row of the sketch and of the doorkeeper.
+ *   4. Every kSampleFactor * width recorded accesses to a shard, its counters
+ *      are halved and its doorkeeper bits are cleared, so that the
+ *      frequencies follow the recent workload.
+ */
+#ifndef __ADMISSION_FILTER_H__
+#define __ADMISSION_FILTER_H__
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "index_memory.h"
+
+namespace cache {
+
+class AdmissionFilter {
+ public:
+  static AdmissionFilter& getInstance();
+
+  inline bool isEnabled() { return threshold_ != 0; }
+  // Count an access (read or write) to the lba
+  void recordAccess(uint64_t lba);
+  // Whether a read miss of the lba should be admitted into the cache
+  bool isAdmitted(uint64_t lba);
+
+ private:
+  struct Shard {
+    Shard() : nAccesses_(0) {}
+    std::mutex mutex_;
+    uint64_t nAccesses_;
+  };
+
+  AdmissionFilter();
+  inline uint32_t getShardId(uint64_t lba);
+  // Index of the counter of the lba in row i, and of its j-th doorkeeper bit
+  inline uint32_t getCounterId(uint32_t shardId, uint32_t i, uint64_t lba);
+  inline uint32_t getDoorkeeperBit(uint32_t shardId, uint32_t j, uint64_t lba);
+  bool isInDoorkeeper(uint32_t shardId, uint64_t lba);
+  uint32_t getCount(uint32_t shardId, uint64_t lba);
+  void age(uint32_t shardId);
+
+  static const uint32_t kHeight = 4;
+  static const uint32_t kNumDoorkeeperHashes = 2;
+  static const uint32_t kSampleFactor = 10;
+  static const uint32_t kNumShards = 64;
+
+  uint32_t threshold_;
+  uint32_t nShards_;
+  // Counters per row of a shard (even, so that shards never share a byte)
+  // and of the whole sketch
+  uint32_t shardWidth_;
+  uint32_t width_;
+  uint32_t nShardDoorkeeperBits_;
+  IndexMemory::Array sketch_;
+  IndexMemory::Array doorkeeper_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+}
+
+#endif //__ADMISSION_FILTER_H__
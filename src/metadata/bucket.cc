@@ -7,6 +7,8 @@
 #include "index.h"
 #include "cache_policies/cache_policy.h"
 #include "reference_counter.h"
+#include "segment_log.h"
+#include "tenant_manager.h"
 #include "common/stats.h"
 #include "manage/dirtylist.h"
 
@@ -125,7 +127,7 @@ namespace cache {
       cachePolicyExecutor_->promote(slot_id, n_slots_occupied);
     }
 
-    uint32_t FPBucket::update(uint64_t fpSignature, uint32_t nSlotsToOccupy)
+    uint32_t FPBucket::update(uint64_t fpSignature, uint32_t nSlotsToOccupy, uint32_t tenantId)
     {
       uint32_t nSlotsOccupied = 0;
       uint32_t slotId = lookup(fpSignature, nSlotsOccupied);
@@ -134,25 +136,30 @@ namespace cache {
           DirtyList::getInstance().addEvictedChunk(
             /* Compute ssd location of the evicted data */
             /* Actually, full Fingerprint and address is sufficient. */
-            FPIndex::computeCachedataLocation(bucketId_, slotId),
+            getCachedataLocation(slotId),
             nSlotsOccupied * Config::getInstance().getSubchunkSize()
           );
         }
+        if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+          SegmentLog::getInstance().invalidate(getCachedataLocation(slotId), nSlotsOccupied);
+        }
 
         for (uint32_t _slotId = slotId;
              _slotId < slotId + nSlotsOccupied;
              ++_slotId) {
           setInvalid(_slotId);
         }
+        clearOwner(slotId, nSlotsOccupied);
       }
 
-      slotId = cachePolicyExecutor_->allocate(nSlotsToOccupy);
+      slotId = cachePolicyExecutor_->allocate(nSlotsToOccupy, tenantId);
       for (uint32_t _slotId = slotId;
            _slotId < slotId + nSlotsToOccupy;
            ++_slotId) {
         setKey(_slotId, fpSignature);
         setValid(_slotId);
       }
+      setOwner(slotId, nSlotsToOccupy, tenantId);
 
       return slotId;
     }
@@ -161,10 +168,38 @@ namespace cache {
       for (uint32_t index = 0; index < nSlots_; index++) {
         if (getKey(index) == fpSignature) {
           setInvalid(index);
+          clearOwner(index, 1);
         }
       }
     }
 
+    void FPBucket::restore(uint64_t fpSignature, uint32_t slotId, uint32_t nSlotsToOccupy, uint32_t tenantId) {
+      for (uint32_t _slotId = slotId;
+           _slotId < slotId + nSlotsToOccupy;
+           ++_slotId) {
+        setKey(_slotId, fpSignature);
+        setValid(_slotId);
+      }
+      setOwner(slotId, nSlotsToOccupy, tenantId);
+      cachePolicyExecutor_->promote(slotId, nSlotsToOccupy);
+    }
+
+    uint64_t FPBucket::getCachedataLocation(uint32_t slotId) {
+      if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+        return SegmentLog::pointerToLocation(getValue(slotId));
+      }
+      return FPIndex::computeCachedataLocation(bucketId_, slotId);
+    }
+
+    void FPBucket::setCachedataLocation(uint32_t slotId, uint32_t nSlotsOccupied, uint64_t cachedataLocation) {
+      uint64_t pointer = SegmentLog::locationToPointer(cachedataLocation);
+      for (uint32_t _slotId = slotId;
+           _slotId < slotId + nSlotsOccupied;
+           ++_slotId) {
+        setValue(_slotId, pointer);
+      }
+    }
+
     void FPBucket::getFingerprints(std::set<uint64_t> &fpSet) {
       for (uint32_t i = 0; i < nSlots_; ++i) {
         if (isValid(i)) {
@@ -172,4 +207,40 @@ namespace cache {
         }
       }
     }
+
+    uint32_t FPBucket::getOwner(uint32_t slotId) {
+      if (owners_ == nullptr) {
+        return TenantManager::kNoTenant;
+      }
+      return owners_[slotId];
+    }
+
+    void FPBucket::setOwner(uint32_t slotId, uint32_t nSlotsOccupied, uint32_t tenantId) {
+      if (owners_ == nullptr) {
+        return;
+      }
+      // Policies without explicit eviction (LRU) overwrite the slots of
+      // other entries in place, whose owners lose them here.
+      clearOwner(slotId, nSlotsOccupied);
+      for (uint32_t _slotId = slotId;
+           _slotId < slotId + nSlotsOccupied;
+           ++_slotId) {
+        owners_[_slotId] = tenantId;
+      }
+      TenantManager::getInstance().addOccupancy(tenantId, nSlotsOccupied);
+    }
+
+    void FPBucket::clearOwner(uint32_t slotId, uint32_t nSlotsOccupied) {
+      if (owners_ == nullptr) {
+        return;
+      }
+      for (uint32_t _slotId = slotId;
+           _slotId < slotId + nSlotsOccupied;
+           ++_slotId) {
+        if (owners_[_slotId] != TenantManager::kNoTenant) {
+          TenantManager::getInstance().removeOccupancy(owners_[_slotId], 1);
+          owners_[_slotId] = TenantManager::kNoTenant;
+        }
+      }
+    }
 }
@@ -173,8 +173,10 @@ namespace cache {
   class FPBucket : public Bucket {
     public:
       FPBucket(uint32_t nBitsPerKey, uint32_t nBitsPerValue, uint32_t nSlots,
-          uint8_t *data, uint8_t *valid, CachePolicy *cachePolicy, uint32_t bucketId) :
-        Bucket(nBitsPerKey, nBitsPerValue, nSlots, data, valid, cachePolicy, bucketId)
+          uint8_t *data, uint8_t *valid, CachePolicy *cachePolicy, uint32_t bucketId,
+          uint8_t *owners = nullptr) :
+        Bucket(nBitsPerKey, nBitsPerValue, nSlots, data, valid, cachePolicy, bucketId),
+        owners_(owners)
       {
       }
 
@@ -195,12 +197,28 @@ namespace cache {
        * @param lba_sig
        * @param size
        */
-      uint32_t update(uint64_t fpSignature, uint32_t nSlotsToOccupy);
+      uint32_t update(uint64_t fpSignature, uint32_t nSlotsToOccupy, uint32_t tenantId = 0);
       // Delete an entry for a certain ca signature
       // This is required for hit but verification-failed chunk.
       void evict(uint64_t fpSignature);
+      // Re-insert an entry at a known position (used by recovery)
+      void restore(uint64_t fpSignature, uint32_t slotId, uint32_t nSlotsToOccupy, uint32_t tenantId = 0);
+
+      // Location of the cached data of the entry starting at slotId. With the
+      // log-structured layout, the slot values hold a pointer into the log.
+      uint64_t getCachedataLocation(uint32_t slotId);
+      void setCachedataLocation(uint32_t slotId, uint32_t nSlotsOccupied, uint64_t cachedataLocation);
 
       void getFingerprints(std::set<uint64_t> &fpSet);
+
+      // Tenant owning each slot, only tracked when owners_ is given
+      // (see TenantManager); the occupancy of tenants follows the owners.
+      uint32_t getOwner(uint32_t slotId);
+      void setOwner(uint32_t slotId, uint32_t nSlotsOccupied, uint32_t tenantId);
+      void clearOwner(uint32_t slotId, uint32_t nSlotsOccupied);
+
+    private:
+      uint8_t *owners_;
   };
 }
 #endif
@@ -64,7 +64,8 @@ namespace cache {
       }
     }
 
-    uint32_t BucketAwareLRUExecutor::allocate(uint32_t nSlotsToOccupy)
+    // Recency only, the tenant is ignored
+    uint32_t BucketAwareLRUExecutor::allocate(uint32_t nSlotsToOccupy, uint32_t)
     {
       uint32_t slotId = 0, nSlotsAvailable = 0,
         nSlots = bucket_->getnSlots();
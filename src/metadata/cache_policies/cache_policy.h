@@ -12,7 +12,9 @@ namespace cache {
 
         virtual void promote(uint32_t slotId, uint32_t nSlotsToOccupy = 1) = 0;
 
-        virtual uint32_t allocate(uint32_t nSlotsToOccupy = 1) = 0;
+        // tenantId is the tenant (see TenantManager) the slots are allocated for;
+        // only LeastReferenceCount ranks its victims by tenant
+        virtual uint32_t allocate(uint32_t nSlotsToOccupy = 1, uint32_t tenantId = 0) = 0;
 
         virtual void clearObsolete(std::shared_ptr <FPIndex> fpIndex) = 0;
 
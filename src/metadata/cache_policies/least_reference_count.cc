@@ -1,6 +1,8 @@
 #include <metadata/reference_counter.h>
 #include <common/stats.h>
 #include <manage/dirtylist.h>
+#include <metadata/segment_log.h>
+#include <metadata/tenant_manager.h>
 #include "least_reference_count.h"
  
 
@@ -12,10 +14,18 @@ namespace cache {
 
     void LeastReferenceCountExecutor::clearObsolete(std::shared_ptr<FPIndex> fpIndex) {}
 
-    uint32_t LeastReferenceCountExecutor::allocate(uint32_t nSlotsToOccupy)
+    uint32_t LeastReferenceCountExecutor::allocate(uint32_t nSlotsToOccupy, uint32_t tenantId)
     {
-
-      std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t>>> slotsToReferenceCounts;
+      // Entries are evicted by tenant rank first (see TenantManager), then
+      // by reference count
+      struct Candidate {
+        uint32_t slotId;
+        uint32_t rank;
+        uint32_t refCount;
+      };
+      std::vector<Candidate> candidates;
+      FPBucket *bucket = static_cast<FPBucket *>(bucket_);
+      bool isTenantAware = TenantManager::getInstance().isEnabled();
       uint32_t slotId = 0, nSlotsAvailable = 0,
         nSlots = bucket_->getnSlots();
 
@@ -25,29 +35,29 @@ namespace cache {
           continue;
         }
 
-        uint32_t nSlotsOccupied = 0;
         uint32_t slotId_ = slotId;
         uint64_t key = bucket_->getKey(slotId);
         uint64_t bucketId = bucket_->bucketId_;
         uint64_t fpHash = (bucketId << Config::getInstance().getnBitsPerFpSignature()) | key;
         uint32_t refCount = ReferenceCounter::getInstance().query(fpHash);
+        uint32_t rank = isTenantAware ?
+          TenantManager::getInstance().getEvictionRank(bucket->getOwner(slotId), tenantId) : 0;
         while (slotId < nSlots && bucket_->isValid(slotId)
                && key == bucket_->getKey(slotId)) {
           ++slotId;
-          nSlotsOccupied += 1;
         }
 
-        slotsToReferenceCounts.emplace_back(slotId_, std::make_pair(refCount, nSlotsOccupied));
+        candidates.push_back({slotId_, rank, refCount});
       }
 
-      std::sort(slotsToReferenceCounts.begin(),
-          slotsToReferenceCounts.end(),
-          [](auto &left, auto &right) {
-          uint32_t refCount1 = left.second.first, refCount2 = right.second.first;
-          uint32_t nOccupied1 = left.second.second, nOccupied2 = right.second.second;
-          return refCount1 < refCount2;
+      std::sort(candidates.begin(),
+          candidates.end(),
+          [](const Candidate &left, const Candidate &right) {
+          if (left.rank != right.rank) return left.rank < right.rank;
+          return left.refCount < right.refCount;
           });
 
+      auto candidate = candidates.begin();
       while (true) {
         // check whether there is a contiguous space
         // try to evict those zero referenced fingerprint first
@@ -66,25 +76,29 @@ namespace cache {
 
         if (nSlotsAvailable >= nSlotsToOccupy) break;
         // Evict the least RF entry
-        slotId = slotsToReferenceCounts[0].first;
+        slotId = candidate->slotId;
         uint64_t key = bucket_->getKey(slotId);
         while (slotId < nSlots && bucket_->isValid(slotId)
                && key == bucket_->getKey(slotId)) {
           bucket_->setInvalid(slotId);
           ++slotId;
         }
+        bucket->clearOwner(candidate->slotId, slotId - candidate->slotId);
 
+        uint64_t cachedataLocation = bucket->getCachedataLocation(candidate->slotId);
         if (Config::getInstance().getCacheMode() == tWriteBack) {
           DirtyList::getInstance().addEvictedChunk(
             /* Compute ssd location of the evicted data */
             /* Actually, full Fingerprint and address is sufficient. */
-            FPIndex::computeCachedataLocation(bucket_->getBucketId(), slotsToReferenceCounts[0].first),
-            (slotId - slotsToReferenceCounts[0].first) * Config::getInstance().getSubchunkSize()
+            cachedataLocation,
+            (slotId - candidate->slotId) * Config::getInstance().getSubchunkSize()
           );
         }
+        if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+          SegmentLog::getInstance().invalidate(cachedataLocation, slotId - candidate->slotId);
+        }
 
- 
-        slotsToReferenceCounts.erase(slotsToReferenceCounts.begin());
+        ++candidate;
       }
 
       return slotId - nSlotsAvailable;
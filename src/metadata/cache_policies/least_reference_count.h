@@ -13,7 +13,7 @@ namespace cache {
         // LBA signature only takes one slot.
         // So there is no need to care about the entry may take contiguous slots.
         void clearObsolete(std::shared_ptr<FPIndex> fpIndex) override;
-        uint32_t allocate(uint32_t nSlotsToOccupy) override;
+        uint32_t allocate(uint32_t nSlotsToOccupy, uint32_t tenantId) override;
     };
 
 
@@ -17,7 +17,8 @@ namespace cache {
 
     }
 
-    uint32_t LRUExecutor::allocate(uint32_t nSlotsToOccupy) {
+    // Recency only, the tenant is ignored
+    uint32_t LRUExecutor::allocate(uint32_t nSlotsToOccupy, uint32_t) {
       uint32_t slotId = 0, nSlotsAvailable = 0,
         nSlots = bucket_->getnSlots();
       for ( ; slotId < nSlots; ++slotId) {
@@ -15,7 +15,7 @@ namespace cache {
 
         std::list<uint32_t> *list_;
 
-        uint32_t allocate(uint32_t nSlotsToOccupy);
+        uint32_t allocate(uint32_t nSlotsToOccupy, uint32_t tenantId);
         void clearObsolete(std::shared_ptr<FPIndex> fpIndex);
 
         void promote(uint32_t slotId, uint32_t nSlotsToOccupy);
@@ -59,7 +59,10 @@ namespace cache {
 
     BucketizedDLRUFPIndex::BucketizedDLRUFPIndex() {
       nSlotsPerBucket_ = Config::getInstance().getnFPSlotsPerBucket();
-      nBuckets_ = Config::getInstance().getnFpBuckets();
+      // A slot holds a whole chunk, the cache data of a bucket starts at
+      // bucketId * nSlotsPerBucket_ * chunkSize (see lookup)
+      nBuckets_ = Config::getInstance().getCacheDeviceSize() /
+        (1ull * Config::getInstance().getChunkSize() * nSlotsPerBucket_);
       buckets_ = new CacheDedupFPBucket *[nBuckets_];
       std::cout << "Number of Fingerprint buckets: " << nBuckets_ << std::endl;
       for (int i = 0; i < nBuckets_; ++i) {
@@ -1,9 +1,13 @@
 #include "index.h"
 
 #include <utility>
+#include <cstring>
 #include "common/config.h"
 #include "common/stats.h"
 #include "reference_counter.h"
+#include "segment_log.h"
+#include "tenant_manager.h"
+#include "manage/dirtylist.h"
 #include "cache_policies/lru.h"
 #include "cache_policies/bucket_aware_lru.h"
 #include "cache_policies/least_reference_count.h"
@@ -30,8 +34,8 @@ namespace cache {
 
     nBytesPerBucket_ = ((nBitsPerKey_ + nBitsPerValue_) * nSlotsPerBucket_ + 7) / 8;
     nBytesPerBucketForValid_ = (1 * nSlotsPerBucket_ + 7) / 8;
-    data_ = std::make_unique<uint8_t[]>(nBytesPerBucket_ * nBuckets_ + 1);
-    valid_ = std::make_unique<uint8_t[]>(nBytesPerBucketForValid_ * nBuckets_ + 1);
+    data_ = IndexMemory::allocate(nBytesPerBucket_ * nBuckets_ + 1);
+    valid_ = IndexMemory::allocate(nBytesPerBucketForValid_ * nBuckets_ + 1);
     if (Config::getInstance().isMultiThreadingEnabled()) {
       mutexes_ = std::make_unique<std::mutex[]>(nBuckets_);
     }
@@ -72,17 +76,26 @@ namespace cache {
   FPIndex::FPIndex()
   {
     nBitsPerKey_ = Config::getInstance().getnBitsPerFpSignature();
-    nBitsPerValue_ = 4;
+    if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+      // Each slot of an entry holds the position of its data in the log
+      nBitsPerValue_ = SegmentLog::getnBitsPerPointer();
+    } else {
+      nBitsPerValue_ = 4;
+    }
     nSlotsPerBucket_ = Config::getInstance().getnFPSlotsPerBucket();
     nBuckets_ = Config::getInstance().getnFpBuckets();
 
     nBytesPerBucket_ = ((nBitsPerKey_ + nBitsPerValue_) * nSlotsPerBucket_ + 7) / 8;
     nBytesPerBucketForValid_ = (1 * nSlotsPerBucket_ + 7) / 8;
-    data_ = std::make_unique<uint8_t[]>(nBytesPerBucket_ * nBuckets_ + 1);
-    valid_ = std::make_unique<uint8_t[]>(nBytesPerBucketForValid_ * nBuckets_ + 1);
+    data_ = IndexMemory::allocate(nBytesPerBucket_ * nBuckets_ + 1);
+    valid_ = IndexMemory::allocate(nBytesPerBucketForValid_ * nBuckets_ + 1);
     if (Config::getInstance().isMultiThreadingEnabled()) {
       mutexes_ = std::make_unique<std::mutex[]>(nBuckets_);
     }
+    if (TenantManager::getInstance().isEnabled()) {
+      owners_ = IndexMemory::allocate(nSlotsPerBucket_ * nBuckets_);
+      memset(owners_.get(), TenantManager::kNoTenant, nSlotsPerBucket_ * nBuckets_);
+    }
 
     if (Config::getInstance().isCompactCachePolicyEnabled()) {
       cachePolicy_ = std::move(std::make_unique<LeastReferenceCount>());
@@ -108,6 +121,9 @@ namespace cache {
 
   uint64_t FPIndex::cachedataLocationToMetadataLocation(uint64_t cachedataLocation)
   {
+    if (Config::getInstance().isLogStructuredLayoutEnabled()) {
+      return SegmentLog::getInstance().getMetadataLocation(cachedataLocation);
+    }
     return (cachedataLocation - 1ull *
         Config::getInstance().getnFPSlotsPerBucket() *
         Config::getInstance().getMetadataSize() *
@@ -121,11 +137,12 @@ namespace cache {
     uint32_t bucketId = fpHash >> nBitsPerKey_,
              signature = fpHash & ((1u << nBitsPerKey_) - 1),
              nSlotsOccupied = 0;
-    uint32_t index = getFPBucket(bucketId)->lookup(signature, nSlotsOccupied);
+    std::unique_ptr<FPBucket> bucket = getFPBucket(bucketId);
+    uint32_t index = bucket->lookup(signature, nSlotsOccupied);
     if (index == ~0u) return false;
 
     nSubchunks = nSlotsOccupied;
-    cachedataLocation = computeCachedataLocation(bucketId, index);
+    cachedataLocation = bucket->getCachedataLocation(index);
     metadataLocation = computeMetadataLocation(bucketId, index);
 
     return true;
@@ -138,15 +155,66 @@ namespace cache {
     getFPBucket(bucketId)->promote(signature);
   }
 
-  void FPIndex::update(uint64_t fpHash, uint32_t nSubchunks, uint64_t &cachedataLocation, uint64_t &metadataLocation)
+  void FPIndex::update(uint64_t fpHash, uint32_t nSubchunks, uint64_t &cachedataLocation, uint64_t &metadataLocation,
+      uint32_t tenantId)
   {
     uint32_t bucketId = fpHash >> nBitsPerKey_,
              signature = fpHash & ((1u << nBitsPerKey_) - 1),
              nSlotsToOccupy = nSubchunks;
 
-    uint32_t slotId = getFPBucket(bucketId)->update(signature, nSlotsToOccupy);
-    cachedataLocation = computeCachedataLocation(bucketId, slotId);
+    if (!Config::getInstance().isLogStructuredLayoutEnabled()) {
+      uint32_t slotId = getFPBucket(bucketId)->update(signature, nSlotsToOccupy, tenantId);
+      cachedataLocation = computeCachedataLocation(bucketId, slotId);
+      metadataLocation = computeMetadataLocation(bucketId, slotId);
+      return;
+    }
+
+    // Take the space in the log first: the cleaner may relocate other
+    // entries, and must not see the half-initialized slots of this one.
+    cachedataLocation = SegmentLog::getInstance().allocate(*this, nSubchunks);
+    std::unique_ptr<FPBucket> bucket = getFPBucket(bucketId);
+    uint32_t slotId = bucket->update(signature, nSlotsToOccupy, tenantId);
+    bucket->setCachedataLocation(slotId, nSlotsToOccupy, cachedataLocation);
     metadataLocation = computeMetadataLocation(bucketId, slotId);
+    SegmentLog::getInstance().append(cachedataLocation, fpHash, nSubchunks, metadataLocation);
+  }
+
+  bool FPIndex::relocate(uint64_t fpHash, uint64_t cachedataLocation, uint64_t newCachedataLocation)
+  {
+    uint32_t bucketId = fpHash >> nBitsPerKey_,
+             signature = fpHash & ((1u << nBitsPerKey_) - 1),
+             nSlotsOccupied = 0;
+    std::unique_ptr<FPBucket> bucket = getFPBucket(bucketId);
+    uint32_t slotId = bucket->lookup(signature, nSlotsOccupied);
+    if (slotId == ~0u || bucket->getCachedataLocation(slotId) != cachedataLocation) {
+      return false;
+    }
+    bucket->setCachedataLocation(slotId, nSlotsOccupied, newCachedataLocation);
+    return true;
+  }
+
+  void FPIndex::evict(uint64_t fpHash, uint64_t cachedataLocation)
+  {
+    uint32_t bucketId = fpHash >> nBitsPerKey_,
+             signature = fpHash & ((1u << nBitsPerKey_) - 1),
+             nSlotsOccupied = 0;
+    std::unique_ptr<FPBucket> bucket = getFPBucket(bucketId);
+    uint32_t slotId = bucket->lookup(signature, nSlotsOccupied);
+    if (slotId == ~0u || bucket->getCachedataLocation(slotId) != cachedataLocation) {
+      return;
+    }
+    if (Config::getInstance().getCacheMode() == tWriteBack) {
+      DirtyList::getInstance().addEvictedChunk(cachedataLocation,
+          nSlotsOccupied * Config::getInstance().getSubchunkSize());
+    }
+    bucket->evict(signature);
+  }
+
+  void FPIndex::restore(uint64_t fpHash, uint32_t slotId, uint32_t nSubchunks, uint32_t tenantId)
+  {
+    uint32_t bucketId = fpHash >> nBitsPerKey_,
+             signature = fpHash & ((1u << nBitsPerKey_) - 1);
+    getFPBucket(bucketId)->restore(signature, slotId, nSubchunks, tenantId);
   }
 
   std::unique_ptr<std::lock_guard<std::mutex>> LBAIndex::lock(uint64_t lbaHash)
@@ -8,6 +8,8 @@
  *      Index implements a getBucketManipulator function that wraps and returns a bucket manipulator.
  *   3. Index exposes lookup, promote, and update for caller to query/update the index structure,
  *      it also expose mutex lock and unlock for concurrency control.
+ *   4. Bucket arrays are allocated by IndexMemory, on huge pages and spread over NUMA nodes
+ *      if configured; getBucketNode tells the node holding a bucket.
  */
 #ifndef __INDEX_H__
 #define __INDEX_H__
@@ -22,6 +24,7 @@
 #include "cache_policies/cache_policy.h"
 #include "common/config.h"
 #include "metadata/cachededup/common.h"
+#include "index_memory.h"
 namespace cache {
   class Index {
     public:
@@ -29,13 +32,19 @@ namespace cache {
       ~Index() = default;
 
       void setCachePolicy(std::unique_ptr<CachePolicy> cachePolicy);
+      // NUMA node holding the slots of the bucket (0 unless the index is partitioned)
+      uint32_t getBucketNode(uint32_t bucketId)
+      {
+        return IndexMemory::getNode(data_, nBytesPerBucket_ * (uint64_t)bucketId);
+      }
+      uint32_t getnBuckets() { return nBuckets_; }
     protected:
       uint32_t nBitsPerSlot_{}, nSlotsPerBucket_{},
                nBitsPerKey_{}, nBitsPerValue_{},
                nBytesPerBucket_{}, nBuckets_{},
                nBytesPerBucketForValid_{};
-      std::unique_ptr< uint8_t[] > data_;
-      std::unique_ptr< uint8_t[] > valid_;
+      IndexMemory::Array data_;
+      IndexMemory::Array valid_;
       std::unique_ptr< CachePolicy > cachePolicy_;
       std::unique_ptr< std::mutex[] > mutexes_;
   };
@@ -49,6 +58,8 @@ namespace cache {
       void promote(uint64_t lbaHash);
       uint64_t update(uint64_t lbaHash, uint64_t fpHash);
       std::unique_ptr<std::lock_guard<std::mutex>> lock(uint64_t lbaHash);
+      using Index::getBucketNode;
+      using Index::getnBuckets;
 
       std::unique_ptr<LBABucket> getLBABucket(uint32_t bucketId)
       {
@@ -71,8 +82,19 @@ namespace cache {
       ~FPIndex();
       bool lookup(uint64_t fpHash, uint32_t &nSubchunks, uint64_t &cachedataLocation, uint64_t &metadataLocation);
       void promote(uint64_t fpHash);
-      void update(uint64_t fpHash, uint32_t nSubchunks, uint64_t &cachedataLocation, uint64_t &metadataLocation);
+      // tenantId is the tenant the new entry is charged to (see TenantManager)
+      void update(uint64_t fpHash, uint32_t nSubchunks, uint64_t &cachedataLocation, uint64_t &metadataLocation,
+          uint32_t tenantId = 0);
+      void restore(uint64_t fpHash, uint32_t slotId, uint32_t nSubchunks, uint32_t tenantId = 0);
+      // Point the entry of fpHash to the new location if it is still at the old one
+      // (log-structured layout only)
+      bool relocate(uint64_t fpHash, uint64_t cachedataLocation, uint64_t newCachedataLocation);
+      // Drop the entry of fpHash if it is still at the given location, flushing
+      // its dirty lbas in write-back mode (log-structured layout only)
+      void evict(uint64_t fpHash, uint64_t cachedataLocation);
       std::unique_ptr<std::lock_guard<std::mutex>> lock(uint64_t fpHash);
+      using Index::getBucketNode;
+      using Index::getnBuckets;
 
       void getFingerprints(std::set<uint64_t> &fpSet);
 
@@ -81,7 +103,8 @@ namespace cache {
             nBitsPerKey_, nBitsPerValue_, nSlotsPerBucket_,
             data_.get() + nBytesPerBucket_ * bucketId,
             valid_.get() + nBytesPerBucketForValid_ * bucketId,
-            cachePolicy_.get(), bucketId));
+            cachePolicy_.get(), bucketId,
+            owners_ ? owners_.get() + nSlotsPerBucket_ * bucketId : nullptr));
       }
       static uint64_t computeCachedataLocation(uint32_t bucketId, uint32_t slotId);
       static uint64_t computeMetadataLocation(uint32_t bucketId, uint32_t slotId);
@@ -89,6 +112,9 @@ namespace cache {
 
       void reference(uint64_t fpHash);
       void dereference(uint64_t fpHash);
+    private:
+      // Owner tenant of every slot, only allocated with several tenants
+      IndexMemory::Array owners_;
   };
 }
 #endif
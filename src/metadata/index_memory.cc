@@ -0,0 +1,132 @@
+#include "index_memory.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace cache {
+
+  namespace {
+    const uint64_t kPageSize = 4096;
+    const uint64_t kHugePageSize = 2 * 1024 * 1024ull;
+    const uint64_t kGiganticPageSize = 1024 * 1024 * 1024ull;
+
+    inline uint64_t roundUp(uint64_t size, uint64_t alignment)
+    {
+      return (size + alignment - 1) / alignment * alignment;
+    }
+  }
+
+  void IndexMemory::Deleter::operator()(uint8_t *array) const
+  {
+    if (isMapped_) {
+      munmap(array, size_);
+    } else {
+      delete[] array;
+    }
+  }
+
+  uint32_t IndexMemory::getnNodes()
+  {
+    static uint32_t nNodes = []() {
+      // Node ids are "0" or "0-n" on machines without holes in the numbering
+      uint32_t n = 1, first, last;
+      FILE *f = fopen("/sys/devices/system/node/possible", "r");
+      if (f != nullptr) {
+        if (fscanf(f, "%u-%u", &first, &last) == 2 && last >= first) {
+          n = last + 1;
+        }
+        fclose(f);
+      }
+      // Node masks are a single word
+      return n < 64 ? n : 64;
+    }();
+    return nNodes;
+  }
+
+  uint64_t IndexMemory::getPartitionSize(uint64_t mapSize, uint64_t pageSize)
+  {
+    return roundUp((mapSize + getnNodes() - 1) / getnNodes(), pageSize);
+  }
+
+  uint32_t IndexMemory::getNode(const Array &array, uint64_t offset)
+  {
+    const Deleter &deleter = array.get_deleter();
+    if (Config::getInstance().getIndexNumaPolicy() != tIndexNumaPartition || !deleter.isMapped_) {
+      return 0;
+    }
+    return offset / getPartitionSize(deleter.size_, deleter.pageSize_);
+  }
+
+  void IndexMemory::bind(void *addr, uint64_t len, int mode, uint64_t nodeMask)
+  {
+    // No libnuma, the system call takes the same arguments as mbind(2)
+    if (syscall(SYS_mbind, addr, len, mode, &nodeMask, 64, 0) != 0) {
+      std::cout << "Cannot apply the NUMA policy of the index!" << std::endl;
+    }
+  }
+
+  IndexMemory::Array IndexMemory::allocate(uint64_t size)
+  {
+    uint64_t pageSize = Config::getInstance().getIndexPageSize();
+    IndexNumaPolicyEnum numaPolicy = Config::getInstance().getIndexNumaPolicy();
+    if (pageSize == 0 && numaPolicy == tIndexNumaNone) {
+      return Array(new uint8_t[size](), {size, false, 0});
+    }
+
+    void *array = MAP_FAILED;
+    bool isHugeTlb = false;
+    // Size of the pages actually mapped
+    uint64_t mapPageSize = std::max(pageSize, kPageSize);
+    uint64_t mapSize = roundUp(size, mapPageSize);
+    if (pageSize >= kHugePageSize) {
+      array = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+          | (pageSize >= kGiganticPageSize ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+      isHugeTlb = array != MAP_FAILED;
+    }
+    if (array == MAP_FAILED) {
+      // Transparent huge pages are at most 2 MiB
+      mapPageSize = std::min(mapPageSize, kHugePageSize);
+      mapSize = roundUp(size, mapPageSize);
+      array = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (array == MAP_FAILED) {
+        std::cout << "Cannot allocate memory!" << std::endl;
+        exit(-1);
+      }
+      if (pageSize >= kHugePageSize) {
+        // No huge pages reserved, fall back to transparent huge pages
+        madvise(array, mapSize, MADV_HUGEPAGE);
+      }
+    }
+
+    // Pages are placed when first touched, after the policy is set
+    uint32_t nNodes = getnNodes();
+    if (numaPolicy == tIndexNumaInterleave) {
+      bind(array, mapSize, MPOL_INTERLEAVE, nNodes == 64 ? ~0ull : (1ull << nNodes) - 1);
+    } else if (numaPolicy == tIndexNumaPartition) {
+      uint64_t partitionSize = getPartitionSize(mapSize, mapPageSize);
+      for (uint32_t nodeId = 0; nodeId < nNodes && nodeId * partitionSize < mapSize; ++nodeId) {
+        bind((uint8_t *)array + nodeId * partitionSize,
+            std::min(partitionSize, mapSize - nodeId * partitionSize), MPOL_BIND, 1ull << nodeId);
+      }
+    }
+    Stats::getInstance().add_index_memory(mapSize, isHugeTlb);
+    return Array((uint8_t *)array, {mapSize, true, mapPageSize});
+  }
+}
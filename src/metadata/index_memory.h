@@ -0,0 +1,51 @@
+/* File: metadata/index_memory.h
+ * Description:
+ *   This file contains the declaration of IndexMemory, which allocates the
+ *   large arrays of the in-memory metadata: index buckets, valid bits, slot
+ *   owners and sketches.
+ *
+ *   1. With indexPageSize of 2 MiB or 1 GiB, an array is mapped on huge
+ *      pages of that size if they are reserved (MAP_HUGETLB), and otherwise
+ *      advised for transparent huge pages, to cut the TLB misses of random
+ *      bucket accesses.
+ *   2. With indexNumaPolicy, the pages of an array are interleaved over the
+ *      NUMA nodes, or the array is partitioned into one contiguous range per
+ *      node so that each bucket has a home node (see getNode).
+ *   Without either option, arrays come from the heap.
+ */
+#ifndef __INDEX_MEMORY_H__
+#define __INDEX_MEMORY_H__
+
+#include <cstdint>
+#include <memory>
+
+namespace cache {
+
+class IndexMemory {
+ public:
+  struct Deleter {
+    uint64_t size_;
+    bool isMapped_;
+    // Size of the pages the array is mapped on, 0 if it is on the heap
+    uint64_t pageSize_;
+    void operator()(uint8_t *array) const;
+  };
+  using Array = std::unique_ptr<uint8_t[], Deleter>;
+
+  // A zeroed array of size bytes
+  static Array allocate(uint64_t size);
+  // The NUMA node holding the byte at offset of the array, if arrays are
+  // partitioned over the nodes; 0 otherwise
+  static uint32_t getNode(const Array &array, uint64_t offset);
+  static uint32_t getnNodes();
+
+ private:
+  // Partitions are whole pages of the mapping, so that no page straddles
+  // two nodes
+  static uint64_t getPartitionSize(uint64_t mapSize, uint64_t pageSize);
+  static void bind(void *addr, uint64_t len, int mode, uint64_t nodeMask);
+};
+
+}
+
+#endif //__INDEX_MEMORY_H__
@@ -0,0 +1,232 @@
+#include "meta_recovery.h"
+#include "meta_verification.h"
+#include "tenant_manager.h"
+#include "common/config.h"
+#include "io/io_module.h"
+#include "manage/dirtylist.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace cache {
+
+  MetaRecovery::MetaRecovery(std::shared_ptr<LBAIndex> lbaIndex, std::shared_ptr<FPIndex> fpIndex) :
+    lbaIndex_(std::move(lbaIndex)), fpIndex_(std::move(fpIndex))
+  {}
+
+  bool MetaRecovery::validate(uint32_t bucketId, uint32_t slotId, const Metadata &metadata,
+                              uint64_t &fpHash, uint32_t &nSubchunks)
+  {
+    if (metadata.version_ == 0
+        || metadata.numLBAs_ == 0
+        || metadata.numLBAs_ > MAX_NUM_LBAS_PER_CACHED_CHUNK
+        || metadata.nextEvict_ >= MAX_NUM_LBAS_PER_CACHED_CHUNK) {
+      return false;
+    }
+    if (MetaVerification::computeChecksum(metadata) != metadata.checksum_) {
+      return false;
+    }
+
+    // The fingerprint must be hashed into the bucket that owns the slot
+    fpHash = Chunk::computeFingerprintHash(const_cast<uint8_t *>(metadata.fingerprint_));
+    if ((fpHash >> Config::getInstance().getnBitsPerFpSignature()) != bucketId) {
+      return false;
+    }
+
+    uint32_t maxSubchunks = Config::getInstance().getMaxSubchunks();
+    if (metadata.compressedLen_ == 0) {
+      nSubchunks = maxSubchunks;
+    } else {
+      nSubchunks = (metadata.compressedLen_ +
+          Config::getInstance().getSubchunkSize() - 1) /
+        Config::getInstance().getSubchunkSize();
+    }
+    if (nSubchunks > maxSubchunks
+        || slotId + nSubchunks > Config::getInstance().getnFPSlotsPerBucket()) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < metadata.numLBAs_; ++i) {
+      if (metadata.LBAs_[i] % Config::getInstance().getChunkSize() != 0
+          || metadata.lbaVersions_[i] == 0
+          || metadata.lbaVersions_[i] > metadata.version_) {
+        return false;
+      }
+    }
+    if ((metadata.dirtyLbas_ >> metadata.numLBAs_) != 0) {
+      return false;
+    }
+    return true;
+  }
+
+  void MetaRecovery::recoverBucket(uint32_t bucketId, Metadata *records, ScanResult &result)
+  {
+    struct Candidate {
+      uint32_t slotId_;
+      uint32_t nSubchunks_;
+      uint64_t fpHash_;
+      uint64_t version_;
+    };
+    uint32_t nSlots = Config::getInstance().getnFPSlotsPerBucket();
+    std::vector<Candidate> candidates;
+
+    for (uint32_t slotId = 0; slotId < nSlots; ++slotId) {
+      Candidate candidate{};
+      if (validate(bucketId, slotId, records[slotId], candidate.fpHash_, candidate.nSubchunks_)) {
+        candidate.slotId_ = slotId;
+        candidate.version_ = records[slotId].version_;
+        candidates.push_back(candidate);
+      }
+    }
+
+    // A slot range may have been reused after an eviction without the old
+    // record being overwritten: keep the newest record for each slot.
+    std::sort(candidates.begin(), candidates.end(),
+        [](const Candidate &left, const Candidate &right) {
+          return left.version_ > right.version_;
+        });
+    std::vector<bool> occupied(nSlots, false);
+    std::vector<Candidate> accepted;
+    for (auto &candidate : candidates) {
+      bool overlapped = false;
+      for (uint32_t slotId = candidate.slotId_; slotId < candidate.slotId_ + candidate.nSubchunks_; ++slotId) {
+        overlapped |= occupied[slotId];
+      }
+      if (overlapped) {
+        // The chunk was evicted, yet the lbas it lists must not fall back to
+        // older records: keep them as mappings to nowhere.
+        Metadata &metadata = records[candidate.slotId_];
+        for (uint32_t i = 0; i < metadata.numLBAs_; ++i) {
+          result.mappings_.push_back({metadata.LBAs_[i], metadata.lbaVersions_[i], 0, ~0ull, 0, false});
+        }
+        continue;
+      }
+      for (uint32_t slotId = candidate.slotId_; slotId < candidate.slotId_ + candidate.nSubchunks_; ++slotId) {
+        occupied[slotId] = true;
+      }
+      accepted.push_back(candidate);
+    }
+
+    // Re-insert from the oldest to the newest to approximate the recency order
+    for (auto it = accepted.rbegin(); it != accepted.rend(); ++it) {
+      Metadata &metadata = records[it->slotId_];
+      // The first lba of the list is the one that brought the chunk in
+      fpIndex_->restore(it->fpHash_, it->slotId_, it->nSubchunks_,
+          metadata.numLBAs_ > 0 ? TenantManager::getInstance().getTenantId(metadata.LBAs_[0]) : 0);
+
+      for (uint32_t i = 0; i < metadata.numLBAs_; ++i) {
+        result.mappings_.push_back({metadata.LBAs_[i], metadata.lbaVersions_[i], it->fpHash_,
+            FPIndex::computeCachedataLocation(bucketId, it->slotId_), it->nSubchunks_,
+            ((metadata.dirtyLbas_ >> i) & 1u) != 0});
+      }
+      result.maxVersion_ = std::max(result.maxVersion_, it->version_);
+      result.nRecords_ += 1;
+    }
+  }
+
+  void MetaRecovery::scan(uint32_t beginBucketId, uint32_t endBucketId, ScanResult &result)
+  {
+    // Metadata of a bucket is contiguous on the cache device,
+    // read ~1 MiB (several buckets) per request.
+    uint32_t nBytesPerBucket = Config::getInstance().getnFPSlotsPerBucket() * sizeof(Metadata);
+    uint32_t nBucketsPerRead = std::max(1u, (1u << 20u) / nBytesPerBucket);
+    Metadata *records = nullptr;
+    if (posix_memalign(reinterpret_cast<void **>(&records), 512, 1ull * nBucketsPerRead * nBytesPerBucket) != 0) {
+      std::cout << "Cannot allocate memory!" << std::endl;
+      exit(-1);
+    }
+
+    for (uint32_t bucketId = beginBucketId; bucketId < endBucketId; bucketId += nBucketsPerRead) {
+      uint32_t nBuckets = std::min(nBucketsPerRead, endBucketId - bucketId);
+      memset(records, 0, 1ull * nBuckets * nBytesPerBucket);
+      IOModule::getInstance().read(CACHE_DEVICE,
+          FPIndex::computeMetadataLocation(bucketId, 0),
+          records, nBuckets * nBytesPerBucket);
+      result.nBytesScanned_ += 1ull * nBuckets * nBytesPerBucket;
+
+      for (uint32_t i = 0; i < nBuckets; ++i) {
+        recoverBucket(bucketId + i,
+            records + 1ull * i * Config::getInstance().getnFPSlotsPerBucket(), result);
+      }
+    }
+    free(records);
+  }
+
+  uint64_t MetaRecovery::recover()
+  {
+    auto begin = std::chrono::steady_clock::now();
+    uint32_t nBuckets = Config::getInstance().getnFpBuckets();
+    uint32_t nThreads = std::max(1u, std::min(Config::getInstance().getMaxNumGlobalThreads(), nBuckets));
+
+    // 1. Scan the metadata region in parallel. Threads own disjoint bucket
+    //    ranges, so FP buckets can be restored without locking.
+    std::vector<ScanResult> results(nThreads);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < nThreads; ++i) {
+      threads.emplace_back([this, &results, i, nThreads, nBuckets] {
+          scan(1ull * nBuckets * i / nThreads, 1ull * nBuckets * (i + 1) / nThreads, results[i]);
+          });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    uint64_t maxVersion = 0, nRecords = 0, nBytesScanned = 0;
+    std::vector<LBAMapping> mappings;
+    for (auto &result : results) {
+      maxVersion = std::max(maxVersion, result.maxVersion_);
+      nRecords += result.nRecords_;
+      nBytesScanned += result.nBytesScanned_;
+      mappings.insert(mappings.end(), result.mappings_.begin(), result.mappings_.end());
+      result.mappings_.clear();
+      result.mappings_.shrink_to_fit();
+    }
+
+    // 2. Resolve the latest mapping of each LBA
+    bool isWriteBack = Config::getInstance().getCacheMode() == tWriteBack;
+    std::sort(mappings.begin(), mappings.end(),
+        [](const LBAMapping &left, const LBAMapping &right) {
+          return left.lba_ < right.lba_ ||
+            (left.lba_ == right.lba_ && left.version_ > right.version_);
+        });
+    std::vector<LBAMapping> resolved;
+    for (uint64_t i = 0, j = 0; i < mappings.size(); i = j) {
+      for (j = i + 1; j < mappings.size() && mappings[j].lba_ == mappings[i].lba_; ++j) {
+      }
+      // The latest data of the lba was evicted (and written back if dirty)
+      if (mappings[i].cachedataLocation_ == ~0ull) continue;
+      resolved.push_back(mappings[i]);
+    }
+    mappings.clear();
+    mappings.shrink_to_fit();
+
+    // 3. Replay the mappings through the LBA index (oldest first), which also
+    //    rebuilds the reference counts as the normal update path does.
+    std::sort(resolved.begin(), resolved.end(),
+        [](const LBAMapping &left, const LBAMapping &right) {
+          return left.version_ < right.version_;
+        });
+    for (auto &mapping : resolved) {
+      uint64_t removedFingerprintHash =
+        lbaIndex_->update(Chunk::computeLBAHash(mapping.lba_), mapping.fpHash_);
+      fpIndex_->reference(mapping.fpHash_);
+      if (removedFingerprintHash != ~0ull && removedFingerprintHash != mapping.fpHash_) {
+        fpIndex_->dereference(removedFingerprintHash);
+      }
+      if (isWriteBack && mapping.isDirty_) {
+        DirtyList::getInstance().addLatestUpdate(mapping.lba_, mapping.cachedataLocation_,
+            mapping.nSubchunks_ * Config::getInstance().getSubchunkSize());
+      }
+    }
+
+    double elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - begin).count();
+    double cacheGiB = Config::getInstance().getCacheDeviceSize() / (1024.0 * 1024 * 1024);
+    std::cout << "Recovery: restored " << nRecords << " chunks and "
+              << resolved.size() << " LBAs from "
+              << nBytesScanned / 1024 / 1024 << " MiB of metadata in "
+              << elapsed << " ms (" << elapsed / cacheGiB << " ms per GiB of cache)" << std::endl;
+    return maxVersion;
+  }
+}
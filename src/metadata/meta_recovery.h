@@ -0,0 +1,64 @@
+/* File: metadata/meta_recovery.h
+ * Description:
+ *   MetaRecovery rebuilds the in-memory FPIndex, LBAIndex, and reference
+ *   counts after an (unclean) restart by scanning the on-ssd metadata region.
+ *
+ *   1. Each FP bucket owns a contiguous range of metadata slots, so the region
+ *      is split into bucket ranges scanned by several threads with large
+ *      sequential reads.
+ *   2. A slot holds a valid record if its checksum matches and its fingerprint
+ *      hashes into the bucket. When records of one bucket claim overlapping
+ *      slots, the one with the newest version wins.
+ *   3. Each LBA of a record carries the version at which it was mapped to
+ *      the chunk, as a record keeps listing an LBA remapped elsewhere since.
+ *      An LBA listed by several records is resolved to the newest of them;
+ *      records of evicted chunks still found on the device take part, and an
+ *      LBA whose newest mapping is such a record is not cached again.
+ *   4. In write-back mode each LBA of a record also carries whether it is
+ *      dirty; only the dirty ones are handed to the DirtyList to be flushed
+ *      again, the others come back clean.
+ */
+#ifndef __METARECOVERY_H__
+#define __METARECOVERY_H__
+
+#include "common/common.h"
+#include "index.h"
+#include <vector>
+
+namespace cache {
+
+class MetaRecovery {
+ public:
+  MetaRecovery(std::shared_ptr<LBAIndex> lbaIndex, std::shared_ptr<FPIndex> fpIndex);
+  // Return the largest metadata version found on the cache device
+  uint64_t recover();
+
+ private:
+  struct LBAMapping {
+    uint64_t lba_;
+    uint64_t version_;
+    uint64_t fpHash_;
+    uint64_t cachedataLocation_;
+    uint32_t nSubchunks_;
+    bool isDirty_;
+  };
+
+  struct ScanResult {
+    std::vector<LBAMapping> mappings_;
+    uint64_t maxVersion_ = 0;
+    uint64_t nRecords_ = 0;
+    uint64_t nBytesScanned_ = 0;
+  };
+
+  void scan(uint32_t beginBucketId, uint32_t endBucketId, ScanResult &result);
+  void recoverBucket(uint32_t bucketId, Metadata *records, ScanResult &result);
+  bool validate(uint32_t bucketId, uint32_t slotId, const Metadata &metadata,
+                uint64_t &fpHash, uint32_t &nSubchunks);
+
+  std::shared_ptr<LBAIndex> lbaIndex_;
+  std::shared_ptr<FPIndex> fpIndex_;
+};
+
+}
+
+#endif //__METARECOVERY_H__
@@ -1,9 +1,24 @@
 #include "meta_verification.h"
 #include "manage/dirtylist.h"
+#include "utils/xxhash.h"
 #include <cstring>
 
 namespace cache {
-  MetaVerification::MetaVerification() {}
+  MetaVerification::MetaVerification() : nextVersion_(1) {}
+
+  uint32_t MetaVerification::computeChecksum(const Metadata &metadata)
+  {
+    Metadata copy = metadata;
+    copy.checksum_ = 0;
+    return XXH32(&copy, sizeof(Metadata), 0);
+  }
+
+  void MetaVerification::persist(Metadata &metadata, uint64_t metadataLocation, uint64_t version)
+  {
+    metadata.version_ = version;
+    metadata.checksum_ = computeChecksum(metadata);
+    IOModule::getInstance().write(CACHE_DEVICE, metadataLocation, &metadata, 512);
+  }
 
   VerificationResult MetaVerification::verify(Chunk &chunk)
   {
@@ -44,41 +59,95 @@ namespace cache {
       return BOTH_LBA_AND_FP_NOT_VALID;
   }
 
-  void MetaVerification::update(Chunk &chunk)
+  uint64_t MetaVerification::update(Chunk &chunk)
   {
-    uint64_t &lba = chunk.addr_;
-    auto &ca = chunk.fingerprint_;
     uint64_t &metadataLocation = chunk.metadataLocation_;
     Metadata &metadata = chunk.metadata_;
+    // Updates of an lba are serialized by its LBA bucket lock,
+    // so its versions follow the order it is mapped to chunks.
+    uint32_t i = 0;
 
     if (chunk.dedupResult_ == DUP_CONTENT) {
       // The chunk is duplicate
       // We update the chunk metadata
-      if (metadata.numLBAs_ == MAX_NUM_LBAS_PER_CACHED_CHUNK) {
+      while (i < metadata.numLBAs_ && metadata.LBAs_[i] != chunk.addr_) {
+        ++i;
+      }
+      if (i < metadata.numLBAs_) {
+        // The lba is listed already, but another record may have mapped it
+        // since (unless the LBA index still maps it here)
+        bool isDirty = (metadata.dirtyLbas_ >> i) & 1u;
+        if (chunk.hitLBAIndex_ && isDirty == chunk.isDirty_) {
+          return 0;
+        }
+      } else if (metadata.numLBAs_ == MAX_NUM_LBAS_PER_CACHED_CHUNK) {
+        i = metadata.nextEvict_;
         if (Config::getInstance().getCacheMode() == tWriteBack) {
-          DirtyList::getInstance().flushOneLba(metadata.LBAs_[metadata.nextEvict_], 
+          DirtyList::getInstance().flushOneLba(metadata.LBAs_[i], 
               chunk.cachedataLocation_, metadata);
         }
-        metadata.LBAs_[metadata.nextEvict_++] = chunk.addr_;
+        metadata.nextEvict_++;
         if (metadata.nextEvict_ == MAX_NUM_LBAS_PER_CACHED_CHUNK) {
           metadata.nextEvict_ = 0;
         }
       } else {
-        metadata.LBAs_[metadata.numLBAs_] = chunk.addr_;
+        i = metadata.numLBAs_;
         metadata.numLBAs_++;
       }
-
-      IOModule::getInstance().write(CACHE_DEVICE, metadataLocation, &chunk.metadata_, 512);
     } else if (chunk.dedupResult_ == NOT_DUP) {
       // The data is not duplicate
       // We need to create a new chunk metadata
       memset(&metadata, 0, sizeof(metadata));
       memcpy(metadata.fingerprint_, chunk.fingerprint_, Config::getInstance().getFingerprintLength());
-      metadata.LBAs_[0] = chunk.addr_;
       metadata.numLBAs_ = 1;
       metadata.nextEvict_ = 0;
       metadata.compressedLen_ = chunk.compressedLen_;
-      IOModule::getInstance().write(CACHE_DEVICE, metadataLocation, &chunk.metadata_, 512);
+    } else {
+      return 0;
+    }
+
+    uint64_t version = nextVersion_.fetch_add(1, std::memory_order_relaxed);
+    metadata.LBAs_[i] = chunk.addr_;
+    metadata.lbaVersions_[i] = version;
+    if (chunk.isDirty_) {
+      metadata.dirtyLbas_ |= 1ull << i;
+    } else {
+      metadata.dirtyLbas_ &= ~(1ull << i);
+    }
+    persist(metadata, metadataLocation, version);
+    return version;
+  }
+
+  void MetaVerification::clean(uint64_t lba, uint64_t metadataLocation, Metadata &metadata)
+  {
+    IOModule::getInstance().read(CACHE_DEVICE, metadataLocation, &metadata, 512);
+    for (uint32_t i = 0; i < metadata.numLBAs_; ++i) {
+      if (metadata.LBAs_[i] == lba && ((metadata.dirtyLbas_ >> i) & 1u)) {
+        metadata.dirtyLbas_ &= ~(1ull << i);
+        persist(metadata, metadataLocation, nextVersion_.fetch_add(1, std::memory_order_relaxed));
+        return;
+      }
+    }
+  }
+
+  void MetaVerification::drop(uint64_t lba, uint64_t version, uint64_t metadataLocation, Metadata &metadata)
+  {
+    IOModule::getInstance().read(CACHE_DEVICE, metadataLocation, &metadata, 512);
+    for (uint32_t i = 0; i < metadata.numLBAs_; ++i) {
+      if (metadata.LBAs_[i] == lba && metadata.lbaVersions_[i] < version) {
+        // Fill the hole with the last lba, the list is not full any more
+        uint32_t last = metadata.numLBAs_ - 1;
+        metadata.LBAs_[i] = metadata.LBAs_[last];
+        metadata.lbaVersions_[i] = metadata.lbaVersions_[last];
+        metadata.dirtyLbas_ &= ~(1ull << i);
+        metadata.dirtyLbas_ |= ((metadata.dirtyLbas_ >> last) & 1u) << i;
+        metadata.dirtyLbas_ &= ~(1ull << last);
+        metadata.LBAs_[last] = 0;
+        metadata.lbaVersions_[last] = 0;
+        metadata.numLBAs_ = last;
+        persist(metadata, metadataLocation, nextVersion_.fetch_add(1, std::memory_order_relaxed));
+        return;
+      }
     }
   }
 }
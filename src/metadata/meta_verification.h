@@ -11,8 +11,22 @@ namespace cache {
    public:
     MetaVerification();
     VerificationResult verify(Chunk &chunk);
-    void clean(Chunk &chunk);
-    void update(Chunk &chunk);
+    // (Write-back) record that the lba has been written back, the caller
+    // holds the lock of the fingerprint bucket of the metadata
+    void clean(uint64_t lba, uint64_t metadataLocation, Metadata &metadata);
+    // Drop the lba from the metadata if it was mapped there before the given
+    // version, the caller holds the lock of the fingerprint bucket
+    void drop(uint64_t lba, uint64_t version, uint64_t metadataLocation, Metadata &metadata);
+    // Return the version of the lba persisted, 0 if the metadata is unchanged
+    uint64_t update(Chunk &chunk);
+
+    // Every persisted metadata carries a version and a checksum
+    // so that a scan of the metadata region can rebuild the indexes.
+    static uint32_t computeChecksum(const Metadata &metadata);
+    void setNextVersion(uint64_t version) { nextVersion_ = version; }
+   private:
+    void persist(Metadata &metadata, uint64_t metadataLocation, uint64_t version);
+    std::atomic<uint64_t> nextVersion_;
   };
 }
 #endif
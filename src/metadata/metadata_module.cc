@@ -2,6 +2,8 @@
 #include "metadata_module.h"
 #include "meta_verification.h"
 #include "meta_journal.h"
+#include "meta_recovery.h"
+#include "tenant_manager.h"
 
 #include "common/config.h"
 #include "common/stats.h"
@@ -15,7 +17,7 @@ namespace cache {
     return instance;
   }
 
-  MetadataModule::MetadataModule() {
+  MetadataModule::MetadataModule() : hasStaleLbas_(false) {
     fpIndex_ = std::make_shared<FPIndex>();
     lbaIndex_ = std::make_shared<LBAIndex>(fpIndex_);
     metaVerification_ = std::make_unique<MetaVerification>();
@@ -28,6 +30,12 @@ namespace cache {
     dumpStats();
   }
 
+  void MetadataModule::recover() {
+    uint64_t maxVersion = MetaRecovery(lbaIndex_, fpIndex_).recover();
+    // New records must be newer than anything left on the device
+    metaVerification_->setNextVersion(maxVersion + 1);
+  }
+
   void MetadataModule::dumpStats() {
     std::set<uint64_t> fpSetLbaIndex;
     std::set<uint64_t> fpSetFpIndex;
@@ -54,6 +62,7 @@ namespace cache {
   {
     uint64_t fpHash = ~0ull;
     if (chunk.lbaBucketLock_ == nullptr) {
+      dropStaleLbas();
       chunk.lbaBucketLock_ = std::move(lbaIndex_->lock(chunk.lbaHash_));
     }
     chunk.hitLBAIndex_ = lbaIndex_->lookup(chunk.lbaHash_, fpHash) && (fpHash == chunk.fingerprintHash_);
@@ -80,6 +89,7 @@ namespace cache {
 
   void MetadataModule::lookup(Chunk &chunk)
   {
+    dropStaleLbas();
     // Obtain LBA bucket lock
     chunk.lbaBucketLock_ = std::move(lbaIndex_->lock(chunk.lbaHash_));
     chunk.hitLBAIndex_ = lbaIndex_->lookup(chunk.lbaHash_, chunk.fingerprintHash_);
@@ -121,7 +131,8 @@ namespace cache {
       if (chunk.dedupResult_ == DUP_CONTENT) {
         fpIndex_->promote(chunk.fingerprintHash_);
       } else {
-        fpIndex_->update(chunk.fingerprintHash_, chunk.nSubchunks_, chunk.cachedataLocation_, chunk.metadataLocation_);
+        fpIndex_->update(chunk.fingerprintHash_, chunk.nSubchunks_, chunk.cachedataLocation_, chunk.metadataLocation_,
+            TenantManager::getInstance().getTenantId(chunk.addr_));
       }
     }
 
@@ -130,23 +141,71 @@ namespace cache {
     END_TIMER(update_index);
 
     // Cases when an on-ssd metadata update is needed
-    // 1. DUP_CONTENT (update lba lists in the on-ssd metadata if the lba is not in the list)
+    // 1. DUP_CONTENT (update lba lists in the on-ssd metadata if the lba is not in the list,
+    //    or is mapped to the chunk again, or its dirty state changes)
     // 2. NOT_DUP (write a new metadata and a new cached data)
-    if ((chunk.dedupResult_ == DUP_CONTENT && chunk.verficationResult_ != BOTH_LBA_AND_FP_VALID) ||
-        chunk.dedupResult_ == NOT_DUP) {
-      metaVerification_->update(chunk);
+    uint64_t version = 0;
+    if (chunk.dedupResult_ == DUP_CONTENT || chunk.dedupResult_ == NOT_DUP) {
+      version = metaVerification_->update(chunk);
     }
-
-#ifdef ACDC
-    if (Config::getInstance().getCacheMode() == tWriteBack) {
-      DirtyList::getInstance().addLatestUpdate(chunk.addr_,
-          chunk.cachedataLocation_,
-          (chunk.nSubchunks_) *
-          Config::getInstance().getSubchunkSize());
+    if (version != 0 && removedFingerprintHash != ~0ull && removedFingerprintHash != chunk.fingerprintHash_) {
+      std::lock_guard<std::mutex> l(staleLbasMutex_);
+      staleLbas_.push_back({chunk.addr_, removedFingerprintHash, version});
+      hasStaleLbas_ = true;
     }
-#endif
+
     if (removedFingerprintHash != ~0ull && removedFingerprintHash != chunk.fingerprintHash_) {
       fpIndex_->dereference(removedFingerprintHash);
     }
   }
+
+  void MetadataModule::dropStaleLbas()
+  {
+    if (!hasStaleLbas_) {
+      return;
+    }
+    std::vector<StaleLba> staleLbas;
+    {
+      std::lock_guard<std::mutex> l(staleLbasMutex_);
+      staleLbas.swap(staleLbas_);
+      hasStaleLbas_ = false;
+    }
+
+    alignas(512) Metadata metadata{};
+    for (auto &staleLba : staleLbas) {
+      auto fpBucketLock = fpIndex_->lock(staleLba.fpHash_);
+      uint32_t nSubchunks;
+      uint64_t cachedataLocation, metadataLocation;
+      // An evicted chunk has its slots, and so its metadata, reused
+      if (fpIndex_->lookup(staleLba.fpHash_, nSubchunks, cachedataLocation, metadataLocation)) {
+        metaVerification_->drop(staleLba.lba_, staleLba.version_, metadataLocation, metadata);
+      }
+    }
+  }
+
+  void MetadataModule::markClean(uint64_t lba, uint64_t cachedataLocation)
+  {
+    alignas(512) Metadata metadata{};
+    uint64_t metadataLocation = FPIndex::cachedataLocationToMetadataLocation(cachedataLocation);
+    if (metadataLocation == ~0ull) {
+      // The log segment has been cleaned, the record is gone with it
+      return;
+    }
+    IOModule::getInstance().read(CACHE_DEVICE, metadataLocation, &metadata, 512);
+    uint64_t fpHash = Chunk::computeFingerprintHash(metadata.fingerprint_);
+
+    auto fpBucketLock = fpIndex_->lock(fpHash);
+    uint32_t nSubchunks;
+    uint64_t latestCachedataLocation;
+    // The chunk may have been evicted and its slots reused
+    if (!fpIndex_->lookup(fpHash, nSubchunks, latestCachedataLocation, metadataLocation)
+        || latestCachedataLocation != cachedataLocation) {
+      return;
+    }
+    // A write of the lba holds the lock until the lba is in the dirty list
+    if (DirtyList::getInstance().isDirty(lba)) {
+      return;
+    }
+    metaVerification_->clean(lba, metadataLocation, metadata);
+  }
 }
@@ -6,6 +6,8 @@
 #include "meta_verification.h"
 #include "meta_journal.h"
 
+#include <vector>
+
 namespace cache {
 
 class MetadataModule {
@@ -15,6 +17,10 @@ class MetadataModule {
   void dedup(Chunk &chunk);
   void lookup(Chunk &chunk);
   void update(Chunk &chunk);
+  // Rebuild the indexes from the on-ssd metadata (ACDC only)
+  void recover();
+  // (Write-back) persist that the lba cached at the location is written back
+  void markClean(uint64_t lba, uint64_t cachedataLocation);
   void dumpStats();
 
   std::shared_ptr<LBAIndex> lbaIndex_;
@@ -23,6 +29,22 @@ class MetadataModule {
   std::unique_ptr<MetaJournal> metaJournal_;
  private:
   MetadataModule();
+  // Drop remapped lbas from the metadata of the chunks they were mapped to,
+  // requires no bucket lock to be held
+  void dropStaleLbas();
+
+  // An lba remapped to another chunk is dropped from the old metadata only
+  // after the new one is persisted, so that a crash in between loses nothing.
+  // Recovery then never falls back to the old chunk, even if the new one is
+  // evicted later.
+  struct StaleLba {
+    uint64_t lba_;
+    uint64_t fpHash_;
+    uint64_t version_;
+  };
+  std::mutex staleLbasMutex_;
+  std::vector<StaleLba> staleLbas_;
+  std::atomic<bool> hasStaleLbas_;
 };
 
 }
@@ -39,8 +39,7 @@ namespace cache {
   SketchReferenceCounter::SketchReferenceCounter() {
     height_ = 4;
     width_ = Config::getInstance().getnLbaBuckets() * Config::getInstance().getnLBASlotsPerBucket();
-    sketch_ = new uint8_t[4 * 4 * width_ / 8];
-    memset(sketch_, 0, 4 * 4 * width_ / 8);
+    sketch_ = IndexMemory::allocate(4 * 4 * width_ / 8);
   }
 
   void SketchReferenceCounter::clear() {}
@@ -52,7 +51,7 @@ namespace cache {
       hashVal = XXH32(&key, 8, i * 1003 + 7);
       uint32_t bucketId = i * width_ + hashVal % width_;
       uint32_t overflowValue = 0;
-      uint32_t countValue = Bitmap::Manipulator(sketch_).getBits(bucketId * 4, bucketId * 4 + 4);
+      uint32_t countValue = Bitmap::Manipulator(sketch_.get()).getBits(bucketId * 4, bucketId * 4 + 4);
       if (mp_.find(bucketId) != mp_.end()) {
         overflowValue = mp_[bucketId];
       }
@@ -68,7 +67,7 @@ namespace cache {
     for (int i = 0; i < height_; ++i) {
       hashVal = XXH32(&key, 8, i * 1003 + 7);
       uint32_t bucketId = i * width_ + hashVal % width_;
-      uint32_t countValue = Bitmap::Manipulator(sketch_).getBits(bucketId * 4, bucketId * 4 + 4);
+      uint32_t countValue = Bitmap::Manipulator(sketch_.get()).getBits(bucketId * 4, bucketId * 4 + 4);
       if (countValue == 15) {
         if (mp_.find(bucketId) == mp_.end()) {
           mp_[bucketId] = 1;
@@ -76,7 +75,7 @@ namespace cache {
           mp_[bucketId] += 1;
         }
       } else {
-        Bitmap::Manipulator(sketch_).storeBits(bucketId * 4, bucketId * 4 + 4, countValue + 1);
+        Bitmap::Manipulator(sketch_.get()).storeBits(bucketId * 4, bucketId * 4 + 4, countValue + 1);
       }
     }
   }
@@ -95,8 +94,8 @@ namespace cache {
           mp_.erase(bucketId);
         }
       } else {
-        uint32_t countValue = Bitmap::Manipulator(sketch_).getBits(bucketId * 4, bucketId * 4 + 4);
-        Bitmap::Manipulator(sketch_).storeBits(bucketId * 4, bucketId * 4 + 4, countValue - 1);
+        uint32_t countValue = Bitmap::Manipulator(sketch_.get()).getBits(bucketId * 4, bucketId * 4 + 4);
+        Bitmap::Manipulator(sketch_.get()).storeBits(bucketId * 4, bucketId * 4 + 4, countValue - 1);
       }
     }
   }
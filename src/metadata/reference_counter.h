@@ -6,6 +6,7 @@
 #include <common/config.h>
 #include <cstring>
 #include <mutex>
+#include "index_memory.h"
 
 namespace cache {
 
@@ -26,7 +27,7 @@ namespace cache {
   };
 
   class SketchReferenceCounter {
-    uint8_t *sketch_;
+    IndexMemory::Array sketch_;
     uint32_t width_, height_;
     std::map<uint32_t, uint16_t> mp_;
 
@@ -0,0 +1,220 @@
+#include "segment_log.h"
+#include "index.h"
+#include "reference_counter.h"
+#include "common/config.h"
+#include "common/stats.h"
+#include "io/io_module.h"
+#include "io/buffer_pool.h"
+#include "manage/dirtylist.h"
+
+#include <algorithm>
+
+namespace cache {
+
+  SegmentLog& SegmentLog::getInstance() {
+    static SegmentLog instance;
+    return instance;
+  }
+
+  SegmentLog::SegmentLog() :
+    headSegmentId_(0), headOffset_(0)
+  {
+    nSubchunksPerSegment_ = Config::getInstance().getSegmentSize() / Config::getInstance().getSubchunkSize();
+    if (nSubchunksPerSegment_ < Config::getInstance().getMaxSubchunks()) {
+      std::cout << "Segment size must hold at least one chunk!" << std::endl;
+      exit(-1);
+    }
+    segments_.resize(Config::getInstance().getnLogSegments());
+    for (uint32_t segmentId = 1; segmentId < segments_.size(); ++segmentId) {
+      freeSegments_.push_back(segmentId);
+    }
+    segments_[headSegmentId_].isFree_ = false;
+    std::cout << "Log-structured layout: " << segments_.size() << " segments of "
+              << Config::getInstance().getSegmentSize() / 1024 << " KiB" << std::endl;
+  }
+
+  uint64_t SegmentLog::pointerToLocation(uint64_t pointer)
+  {
+    // The log starts where the fixed layout places its cache data
+    return FPIndex::computeCachedataLocation(0, 0) + pointer * Config::getInstance().getSubchunkSize();
+  }
+
+  uint64_t SegmentLog::locationToPointer(uint64_t cachedataLocation)
+  {
+    return (cachedataLocation - FPIndex::computeCachedataLocation(0, 0)) / Config::getInstance().getSubchunkSize();
+  }
+
+  uint32_t SegmentLog::getnBitsPerPointer()
+  {
+    uint64_t nPointers = 1ull * Config::getInstance().getnLogSegments() *
+      (Config::getInstance().getSegmentSize() / Config::getInstance().getSubchunkSize());
+    return std::max(1, 64 - __builtin_clzll(nPointers - 1));
+  }
+
+  uint64_t SegmentLog::reserve(uint32_t nSubchunks)
+  {
+    if (headOffset_ + nSubchunks > nSubchunksPerSegment_) {
+      // The rest of the head segment is left unused
+      if (freeSegments_.empty()) {
+        std::cout << "SegmentLog: no free segment left!" << std::endl;
+        exit(-1);
+      }
+      headSegmentId_ = freeSegments_.front();
+      freeSegments_.pop_front();
+      segments_[headSegmentId_].isFree_ = false;
+      headOffset_ = 0;
+    }
+    uint64_t pointer = 1ull * headSegmentId_ * nSubchunksPerSegment_ + headOffset_;
+    headOffset_ += nSubchunks;
+    return pointerToLocation(pointer);
+  }
+
+  void SegmentLog::appendSummary(uint64_t cachedataLocation, uint64_t fpHash,
+      uint32_t nSubchunks, uint64_t metadataLocation)
+  {
+    uint64_t pointer = locationToPointer(cachedataLocation);
+    Segment &segment = segments_[pointer / nSubchunksPerSegment_];
+    segment.summary_.push_back({fpHash, metadataLocation,
+        (uint32_t)(pointer % nSubchunksPerSegment_), nSubchunks});
+    segment.nLiveBytes_ += 1ull * nSubchunks * Config::getInstance().getSubchunkSize();
+  }
+
+  uint64_t SegmentLog::allocate(FPIndex &fpIndex, uint32_t nSubchunks)
+  {
+    std::lock_guard<std::recursive_mutex> l(mutex_);
+    while (freeSegments_.size() < kMinFreeSegments && clean(fpIndex)) {
+    }
+    return reserve(nSubchunks);
+  }
+
+  void SegmentLog::append(uint64_t cachedataLocation, uint64_t fpHash,
+      uint32_t nSubchunks, uint64_t metadataLocation)
+  {
+    std::lock_guard<std::recursive_mutex> l(mutex_);
+    appendSummary(cachedataLocation, fpHash, nSubchunks, metadataLocation);
+    Stats::getInstance().add_bytes_appended_to_log(1ull * nSubchunks * Config::getInstance().getSubchunkSize());
+  }
+
+  void SegmentLog::invalidate(uint64_t cachedataLocation, uint32_t nSubchunks)
+  {
+    std::lock_guard<std::recursive_mutex> l(mutex_);
+    Segment &segment = segments_[locationToPointer(cachedataLocation) / nSubchunksPerSegment_];
+    segment.nLiveBytes_ -= std::min(segment.nLiveBytes_,
+        (uint64_t)nSubchunks * Config::getInstance().getSubchunkSize());
+  }
+
+  uint64_t SegmentLog::getMetadataLocation(uint64_t cachedataLocation)
+  {
+    std::lock_guard<std::recursive_mutex> l(mutex_);
+    uint64_t pointer = locationToPointer(cachedataLocation);
+    Segment &segment = segments_[pointer / nSubchunksPerSegment_];
+    uint32_t offset = pointer % nSubchunksPerSegment_;
+    // Entries are appended with increasing offsets
+    auto it = std::lower_bound(segment.summary_.begin(), segment.summary_.end(), offset,
+        [](const SummaryEntry &entry, uint32_t offset) { return entry.offset_ < offset; });
+    if (it == segment.summary_.end() || it->offset_ != offset) {
+      return ~0ull;
+    }
+    return it->metadataLocation_;
+  }
+
+  bool SegmentLog::isLive(FPIndex &fpIndex, uint32_t segmentId, const SummaryEntry &entry)
+  {
+    uint32_t nSubchunks;
+    uint64_t cachedataLocation, metadataLocation;
+    return fpIndex.lookup(entry.fpHash_, nSubchunks, cachedataLocation, metadataLocation)
+      && cachedataLocation == pointerToLocation(1ull * segmentId * nSubchunksPerSegment_ + entry.offset_);
+  }
+
+  bool SegmentLog::clean(FPIndex &fpIndex)
+  {
+    uint32_t subchunkSize = Config::getInstance().getSubchunkSize();
+    uint64_t nBytesPerSegment = 1ull * nSubchunksPerSegment_ * subchunkSize;
+
+    // 1. Candidates are the sealed segments with the fewest live bytes
+    std::vector<uint32_t> candidates;
+    for (uint32_t segmentId = 0; segmentId < segments_.size(); ++segmentId) {
+      if (!segments_[segmentId].isFree_ && segmentId != headSegmentId_) {
+        candidates.push_back(segmentId);
+      }
+    }
+    uint32_t nCandidates = std::min((uint32_t)candidates.size(), (uint32_t)kNumCleaningCandidates);
+    std::partial_sort(candidates.begin(), candidates.begin() + nCandidates, candidates.end(),
+        [this](uint32_t left, uint32_t right) {
+          return segments_[left].nLiveBytes_ < segments_[right].nLiveBytes_;
+        });
+
+    // 2. Refresh their live bytes against the FP index and pick the segment
+    //    whose live chunks are cheapest to keep, weighting every live chunk by
+    //    its reference count: popular chunks are costly to lose or to move.
+    uint32_t victim = ~0u;
+    uint64_t minCost = ~0ull;
+    for (uint32_t i = 0; i < nCandidates; ++i) {
+      Segment &segment = segments_[candidates[i]];
+      uint64_t nLiveBytes = 0, cost = 0;
+      for (auto &entry : segment.summary_) {
+        if (isLive(fpIndex, candidates[i], entry)) {
+          uint64_t nBytes = 1ull * entry.nSubchunks_ * subchunkSize;
+          nLiveBytes += nBytes;
+          cost += nBytes * ReferenceCounter::getInstance().query(entry.fpHash_);
+        }
+      }
+      segment.nLiveBytes_ = nLiveBytes;
+      if (cost < minCost) {
+        minCost = cost;
+        victim = candidates[i];
+      }
+    }
+    if (victim == ~0u) {
+      return false;
+    }
+
+    // 3. Relocate the most referenced live chunks to the log head, within a
+    //    budget of a fraction of the segment so that cleaning always gains
+    //    space, and evict the others from the FP index.
+    std::vector<std::pair<uint32_t, const SummaryEntry *>> liveEntries;
+    for (auto &entry : segments_[victim].summary_) {
+      if (isLive(fpIndex, victim, entry)) {
+        liveEntries.emplace_back(ReferenceCounter::getInstance().query(entry.fpHash_), &entry);
+      }
+    }
+    std::stable_sort(liveEntries.begin(), liveEntries.end(),
+        [](const std::pair<uint32_t, const SummaryEntry *> &left,
+           const std::pair<uint32_t, const SummaryEntry *> &right) {
+          return left.first > right.first;
+        });
+
+    // The summary stays in place until the end since evicting a dirty chunk
+    // reads its metadata location from it.
+    BufferPool::Buffer buffer = BufferPool::getInstance().acquire();
+    uint8_t *data = buffer.get();
+    uint64_t relocationBudget = nBytesPerSegment * kRelocationBudgetPercent / 100;
+    for (auto &liveEntry : liveEntries) {
+      const SummaryEntry &entry = *liveEntry.second;
+      uint64_t cachedataLocation = pointerToLocation(1ull * victim * nSubchunksPerSegment_ + entry.offset_);
+      uint32_t len = entry.nSubchunks_ * subchunkSize;
+      if (liveEntry.first == 0 || len > relocationBudget) {
+        fpIndex.evict(entry.fpHash_, cachedataLocation);
+        Stats::getInstance().add_chunk_evicted_by_cleaner();
+        continue;
+      }
+      relocationBudget -= len;
+      uint64_t newCachedataLocation = reserve(entry.nSubchunks_);
+      IOModule::getInstance().read(CACHE_DEVICE, cachedataLocation, data, len);
+      IOModule::getInstance().write(CACHE_DEVICE, newCachedataLocation, data, len);
+      fpIndex.relocate(entry.fpHash_, cachedataLocation, newCachedataLocation);
+      appendSummary(newCachedataLocation, entry.fpHash_, entry.nSubchunks_, entry.metadataLocation_);
+      if (Config::getInstance().getCacheMode() == tWriteBack) {
+        DirtyList::getInstance().relocate(cachedataLocation, newCachedataLocation, len);
+      }
+      Stats::getInstance().add_chunk_relocated(len);
+    }
+    segments_[victim].summary_.clear();
+
+    segments_[victim].nLiveBytes_ = 0;
+    segments_[victim].isFree_ = true;
+    freeSegments_.push_back(victim);
+    Stats::getInstance().add_segments_cleaned(1);
+    return true;
+  }
+}
@@ -0,0 +1,92 @@
+/* File: metadata/segment_log.h
+ * Description:
+ *   This file contains the declaration of SegmentLog, the optional
+ *   log-structured layout of the cache data area (ACDC only).
+ *
+ *   1. The cache data area, plus a few over-provisioned segments, is split into
+ *      fixed-size segments. New cached data is appended at the log head, so the
+ *      cache device sees sequential writes instead of writes scattered by the
+ *      fingerprint hash. The FP slots of a chunk store its position in the log
+ *      (in subchunks) as their value; the on-ssd metadata stays at the fixed
+ *      position of the slots.
+ *   2. Each segment keeps an in-memory summary of the chunks appended to it and
+ *      a count of live bytes, decreased when the FP index evicts a chunk.
+ *   3. When free segments run low, the cleaner takes the segments with the
+ *      fewest live bytes as candidates, checks their summaries against the FP
+ *      index (stale entries are found lazily here), and reclaims the one whose
+ *      live chunks are cheapest to keep, weighting each chunk by its reference
+ *      count. The most referenced chunks are relocated to the log head, up to
+ *      half a segment so that the cleaner always gains space; the others are
+ *      evicted from the FP index (and flushed in write-back mode).
+ *   4. The summaries are not persisted, hence recovery is not supported with
+ *      this layout. The cleaner updates FP buckets other than the one of the
+ *      request, so the layout requires single-threaded mode.
+ */
+#ifndef __SEGMENT_LOG_H__
+#define __SEGMENT_LOG_H__
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace cache {
+
+class FPIndex;
+class SegmentLog {
+ public:
+  static SegmentLog& getInstance();
+
+  // Reserve space for a chunk at the log head, cleaning segments if needed
+  uint64_t allocate(FPIndex &fpIndex, uint32_t nSubchunks);
+  // Record the chunk written at the reserved location
+  void append(uint64_t cachedataLocation, uint64_t fpHash, uint32_t nSubchunks, uint64_t metadataLocation);
+  // The FP index does not refer to the chunk any more
+  void invalidate(uint64_t cachedataLocation, uint32_t nSubchunks);
+  // Metadata location of the chunk at the given location, ~0 if unknown
+  uint64_t getMetadataLocation(uint64_t cachedataLocation);
+
+  // Conversion between a cache data location and the pointer kept in FP slots
+  static uint64_t pointerToLocation(uint64_t pointer);
+  static uint64_t locationToPointer(uint64_t cachedataLocation);
+  static uint32_t getnBitsPerPointer();
+
+ private:
+  SegmentLog();
+
+  struct SummaryEntry {
+    uint64_t fpHash_;
+    uint64_t metadataLocation_;
+    uint32_t offset_; // in subchunks, from the start of the segment
+    uint32_t nSubchunks_;
+  };
+  struct Segment {
+    std::vector<SummaryEntry> summary_;
+    uint64_t nLiveBytes_ = 0;
+    bool isFree_ = true;
+  };
+
+  // Reserve space at the head, opening a new segment when the head is full
+  uint64_t reserve(uint32_t nSubchunks);
+  void appendSummary(uint64_t cachedataLocation, uint64_t fpHash, uint32_t nSubchunks, uint64_t metadataLocation);
+  bool isLive(FPIndex &fpIndex, uint32_t segmentId, const SummaryEntry &entry);
+  // Reclaim one segment, return false if no segment can be reclaimed
+  bool clean(FPIndex &fpIndex);
+
+  static const uint32_t kMinFreeSegments = 2;
+  static const uint32_t kNumCleaningCandidates = 4;
+  // Share of a cleaned segment that may be relocated, the rest is evicted
+  static const uint32_t kRelocationBudgetPercent = 50;
+
+  std::vector<Segment> segments_;
+  std::deque<uint32_t> freeSegments_;
+  uint32_t nSubchunksPerSegment_;
+  uint32_t headSegmentId_;
+  uint32_t headOffset_;
+  // Recursive: evicting a dirty chunk while cleaning looks up its metadata
+  std::recursive_mutex mutex_;
+};
+
+}
+
+#endif //__SEGMENT_LOG_H__
@@ -0,0 +1,69 @@
+#include "tenant_manager.h"
+#include "common/common.h"
+#include "common/config.h"
+#include "common/stats.h"
+
+namespace cache {
+
+  TenantManager& TenantManager::getInstance() {
+    static TenantManager instance;
+    return instance;
+  }
+
+  TenantManager::TenantManager()
+  {
+    nTenants_ = Config::getInstance().getnTenants();
+    if (nTenants_ > Stats::kMaxVolumes) {
+      std::cout << "At most " << Stats::kMaxVolumes << " tenants are supported!" << std::endl;
+      exit(-1);
+    }
+    uint64_t nSlots = 1ull * Config::getInstance().getnFpBuckets() * Config::getInstance().getnFPSlotsPerBucket();
+    nSlotsOccupied_ = std::make_unique<std::atomic<uint64_t>[]>(nTenants_);
+    for (uint32_t tenantId = 0; tenantId < nTenants_; ++tenantId) {
+      nSlotsShare_.push_back(nSlots * Config::getInstance().getTenantShare(tenantId) / 100);
+      nSlotsReserved_.push_back(nSlots * Config::getInstance().getTenantReservation(tenantId) / 100);
+      nSlotsOccupied_[tenantId] = 0;
+    }
+  }
+
+  uint32_t TenantManager::getTenantId(uint64_t lba)
+  {
+    return Config::getInstance().getTenantOfVolume(getVolumeId(lba));
+  }
+
+  void TenantManager::addOccupancy(uint32_t tenantId, uint32_t nSlots)
+  {
+    Stats::getInstance().set_tenant_occupied_bytes(tenantId,
+        (nSlotsOccupied_[tenantId] += nSlots) * Config::getInstance().getSubchunkSize());
+  }
+
+  void TenantManager::removeOccupancy(uint32_t tenantId, uint32_t nSlots)
+  {
+    Stats::getInstance().set_tenant_occupied_bytes(tenantId,
+        (nSlotsOccupied_[tenantId] -= nSlots) * Config::getInstance().getSubchunkSize());
+  }
+
+  bool TenantManager::isOverShare(uint32_t tenantId)
+  {
+    return nSlotsOccupied_[tenantId] >= nSlotsShare_[tenantId];
+  }
+
+  bool TenantManager::isWithinReservation(uint32_t tenantId)
+  {
+    return nSlotsOccupied_[tenantId] <= nSlotsReserved_[tenantId];
+  }
+
+  uint32_t TenantManager::getEvictionRank(uint32_t ownerId, uint32_t tenantId)
+  {
+    if (ownerId >= nTenants_) {
+      return 2;
+    }
+    if (ownerId == tenantId) {
+      return isOverShare(tenantId) ? 0 : 2;
+    }
+    if (isOverShare(ownerId)) {
+      return 1;
+    }
+    return isWithinReservation(ownerId) ? 3 : 2;
+  }
+}
@@ -0,0 +1,67 @@
+/* File: metadata/tenant_manager.h
+ * Description:
+ *   This file contains the declaration of TenantManager, which partitions the
+ *   cache space of the FP index (ACDC) among tenants.
+ *
+ *   1. Each volume belongs to a tenant (by default, tenant = volume id). A
+ *      cached chunk is owned by the tenant whose request brought it into the
+ *      cache; chunks deduplicated across tenants stay with their first owner.
+ *   2. A tenant has a share and a reservation, both in percent of all FP
+ *      slots. A tenant at or over its share is the first to lose chunks; a
+ *      tenant within its reservation is the last to lose them to others.
+ *   3. The eviction policy of the FP index (LeastReferenceCount) ranks
+ *      victims with getEvictionRank before their reference counts. The
+ *      LRU policies, and the CacheDedup builds, ignore tenants.
+ *
+ *   Shares and reservations are soft: they order the victims within the one
+ *   bucket an insert hashes to, and nothing else. An insert always takes the
+ *   slots it needs, so a chunk of a tenant within its reservation is still
+ *   evicted if its bucket holds nothing else to evict, and occupancy is only
+ *   compared against the whole-cache targets, not balanced across buckets.
+ */
+#ifndef __TENANT_MANAGER_H__
+#define __TENANT_MANAGER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace cache {
+
+class TenantManager {
+ public:
+  static TenantManager& getInstance();
+
+  // Ownership is only tracked with more than one tenant
+  inline bool isEnabled() { return nTenants_ > 1; }
+  inline uint32_t getnTenants() { return nTenants_; }
+  uint32_t getTenantId(uint64_t lba);
+
+  void addOccupancy(uint32_t tenantId, uint32_t nSlots);
+  void removeOccupancy(uint32_t tenantId, uint32_t nSlots);
+  bool isOverShare(uint32_t tenantId);
+  bool isWithinReservation(uint32_t tenantId);
+
+  // Eviction preference of a chunk owned by ownerId when tenantId allocates,
+  // lower ranks are evicted first (a priority within a bucket, not a bound):
+  //   0 - chunks of the allocating tenant when it is over its share
+  //   1 - chunks of other tenants over their share
+  //   2 - other chunks
+  //   3 - chunks of other tenants within their reservation
+  uint32_t getEvictionRank(uint32_t ownerId, uint32_t tenantId);
+
+  static const uint8_t kNoTenant = 0xff;
+
+ private:
+  TenantManager();
+
+  uint32_t nTenants_;
+  std::vector<uint64_t> nSlotsShare_;
+  std::vector<uint64_t> nSlotsReserved_;
+  std::unique_ptr<std::atomic<uint64_t>[]> nSlotsOccupied_;
+};
+
+}
+
+#endif //__TENANT_MANAGER_H__
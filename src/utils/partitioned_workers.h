@@ -0,0 +1,187 @@
+#ifndef __PARTITIONED_WORKERS_H__
+#define __PARTITIONED_WORKERS_H__
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "spsc_ring.h"
+
+namespace cache {
+// Worker threads that each own a partition of the work. Unlike AThreadPool,
+// there is no shared job queue: the dispatcher thread hands every item to the
+// worker owning it through a SpscRing of that worker, so that items of a
+// partition are handled in order by one thread and no lock is taken on the
+// way. An item of several partitions is left to the dispatcher, which can
+// drain their workers before handing it elsewhere. Worker w is pinned to a CPU of NUMA node w * nNodes / nWorkers, the
+// node holding its share of an index partitioned over the nodes.
+template <typename T>
+class PartitionedWorkers
+{
+  public:
+
+  PartitionedWorkers (uint32_t nWorkers, std::function <void (T &)> handler,
+      uint32_t ringSize = 1024) :
+    shutdown_ (false), handler_ (std::move (handler))
+  {
+    std::vector<int> cpus = getCpus (nWorkers);
+    for (uint32_t i = 0; i < nWorkers; ++i) {
+      rings_.emplace_back (std::make_unique<SpscRing<T>> (ringSize));
+      progress_.emplace_back (std::make_unique<Progress> ());
+    }
+    nSubmitted_.assign (nWorkers, 0);
+    threads_.reserve (nWorkers);
+    for (uint32_t i = 0; i < nWorkers; ++i) {
+      threads_.emplace_back (&PartitionedWorkers::threadEntry, this, i);
+      if (cpus[i] >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO (&cpuSet);
+        CPU_SET (cpus[i], &cpuSet);
+        pthread_setaffinity_np (threads_.back ().native_handle (), sizeof (cpuSet), &cpuSet);
+      }
+    }
+  }
+
+  // Handle the items submitted so far and stop the workers
+  ~PartitionedWorkers ()
+  {
+    shutdown_.store (true, std::memory_order_release);
+    for (auto& thread : threads_)
+      thread.join ();
+  }
+
+  // Dispatcher only; waits while the ring of the worker is full
+  void submit (uint32_t workerId, const T &item)
+  {
+    while (! rings_[workerId]->tryPush (item))
+      std::this_thread::yield ();
+    ++nSubmitted_[workerId];
+  }
+
+  // Dispatcher only; waits until the worker has handled the items submitted
+  // to it so far
+  void drain (uint32_t workerId)
+  {
+    while (progress_[workerId]->nHandled_.load (std::memory_order_acquire) != nSubmitted_[workerId])
+      std::this_thread::yield ();
+  }
+
+  uint32_t getnWorkers () { return threads_.size (); }
+
+  protected:
+
+  void threadEntry (uint32_t workerId)
+  {
+    SpscRing<T> &ring = *rings_[workerId];
+    std::atomic<uint64_t> &nHandled = progress_[workerId]->nHandled_;
+    T item;
+    uint32_t nIdleRounds = 0;
+
+    while (1)
+    {
+      if (ring.tryPop (item)) {
+        handler_ (item);
+        nHandled.store (nHandled.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+        nIdleRounds = 0;
+        continue;
+      }
+      // Items pushed before the shutdown are visible once it is seen
+      if (shutdown_.load (std::memory_order_acquire)) {
+        if (! ring.tryPop (item))
+          return;
+        handler_ (item);
+        nHandled.store (nHandled.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+        continue;
+      }
+      // Spin shortly for the next item, then back off
+      if (++nIdleRounds < kNumSpinRounds)
+        std::this_thread::yield ();
+      else
+        std::this_thread::sleep_for (std::chrono::microseconds (50));
+    }
+  }
+
+  // CPUs of a NUMA node, -1 if the node is unknown
+  static std::vector<int> getNodeCpus (uint32_t nodeId)
+  {
+    std::vector<int> cpus;
+    char fileName[64];
+    snprintf (fileName, sizeof (fileName), "/sys/devices/system/node/node%u/cpulist", nodeId);
+    FILE *f = fopen (fileName, "r");
+    if (f == nullptr)
+      return cpus;
+    // A list of ranges like "0-3,8-11"
+    int first, last;
+    while (fscanf (f, "%d", &first) == 1) {
+      last = first;
+      int c = fgetc (f);
+      if (c == '-') {
+        if (fscanf (f, "%d", &last) != 1)
+          break;
+        c = fgetc (f);
+      }
+      for (int cpu = first; cpu <= last; ++cpu)
+        cpus.push_back (cpu);
+      if (c != ',')
+        break;
+    }
+    fclose (f);
+    return cpus;
+  }
+
+  static std::vector<int> getCpus (uint32_t nWorkers)
+  {
+    cpu_set_t allowed;
+    CPU_ZERO (&allowed);
+    sched_getaffinity (0, sizeof (allowed), &allowed);
+
+    std::vector<std::vector<int>> nodeCpus;
+    for (uint32_t nodeId = 0; ; ++nodeId) {
+      std::vector<int> cpus;
+      for (int cpu : getNodeCpus (nodeId))
+        if (CPU_ISSET (cpu, &allowed))
+          cpus.push_back (cpu);
+      if (cpus.empty () && nodeId > 0)
+        break;
+      nodeCpus.push_back (cpus);
+    }
+
+    // Workers of a node take its CPUs in turn; unpinned without sysfs
+    std::vector<int> cpus (nWorkers, -1);
+    std::vector<uint32_t> nWorkersOfNode (nodeCpus.size (), 0);
+    for (uint32_t i = 0; i < nWorkers; ++i) {
+      uint32_t nodeId = (uint64_t) i * nodeCpus.size () / nWorkers;
+      if (! nodeCpus[nodeId].empty ())
+        cpus[i] = nodeCpus[nodeId][nWorkersOfNode[nodeId]++ % nodeCpus[nodeId].size ()];
+    }
+    return cpus;
+  }
+
+  static const uint32_t kNumSpinRounds = 1024;
+
+  // Items a worker has handled, alone on its cache line
+  struct Progress
+  {
+    Progress () : nHandled_ (0) {}
+    std::atomic<uint64_t> nHandled_;
+    char padding_[64 - sizeof (std::atomic<uint64_t>)];
+  };
+
+  std::atomic<bool> shutdown_;
+  std::function <void (T &)> handler_;
+  std::vector <std::unique_ptr <SpscRing <T>>> rings_;
+  std::vector <std::unique_ptr <Progress>> progress_;
+  // Items submitted to each worker, by the dispatcher only
+  std::vector <uint64_t> nSubmitted_;
+  std::vector <std::thread> threads_;
+};
+}
+
+
+#endif
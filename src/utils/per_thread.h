@@ -0,0 +1,112 @@
+/* File: utils/per_thread.h
+ * Description:
+ *   PerThread<Block> gives each thread a Block of its own, padded to whole
+ *   cache lines, and lets a reader visit the blocks of all threads to merge
+ *   them. It is meant for statistics updated on the data path: a thread
+ *   updates its block without atomic read-modify-writes and without sharing
+ *   cache lines, and the totals are only summed when they are read.
+ *
+ *   1. A thread is given a block on first use. When it exits, its block is
+ *      kept with what it counted and handed to the next new thread, so
+ *      that the totals stay exact and the number of blocks is bounded by
+ *      the number of threads alive at once.
+ *   2. Fields of a block are std::atomic so that readers may run alongside
+ *      the owner; the owner updates them with relaxed loads and stores
+ *      (see PerThread::add).
+ *   3. Blocks are never freed, so that they outlive the threads and the
+ *      statics that may still read them at exit.
+ */
+#ifndef __PER_THREAD_H__
+#define __PER_THREAD_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace cache {
+
+template <typename Block>
+class PerThread {
+ public:
+  static const uint32_t kCacheLineSize = 64;
+
+  // The block of the calling thread
+  static inline Block &local()
+  {
+    static thread_local Handle handle;
+    return handle.slot_->block_;
+  }
+
+  // Visit the blocks of all threads, alive or exited
+  template <typename F>
+  static void forEach(F func)
+  {
+    Registry &registry = getRegistry();
+    std::lock_guard<std::mutex> l(registry.mutex_);
+    for (Slot *slot : registry.slots_) {
+      func(slot->block_);
+    }
+  }
+
+  // Add to a counter of the block of the calling thread, which no other
+  // thread writes
+  template <typename T>
+  static inline void add(std::atomic<T> &counter, T v)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+
+ private:
+  struct alignas(kCacheLineSize) Slot {
+    Block block_;
+  };
+
+  struct Registry {
+    std::mutex mutex_;
+    std::vector<Slot *> slots_;
+    // Blocks of exited threads
+    std::vector<Slot *> freeSlots_;
+  };
+
+  struct Handle {
+    Handle()
+    {
+      Registry &registry = getRegistry();
+      std::lock_guard<std::mutex> l(registry.mutex_);
+      if (!registry.freeSlots_.empty()) {
+        slot_ = registry.freeSlots_.back();
+        registry.freeSlots_.pop_back();
+        return;
+      }
+      // new does not honour the alignment of Slot before C++17
+      void *p = nullptr;
+      if (posix_memalign(&p, kCacheLineSize, sizeof(Slot)) != 0) {
+        throw std::bad_alloc();
+      }
+      slot_ = new (p) Slot();
+      registry.slots_.push_back(slot_);
+    }
+
+    ~Handle()
+    {
+      Registry &registry = getRegistry();
+      std::lock_guard<std::mutex> l(registry.mutex_);
+      registry.freeSlots_.push_back(slot_);
+    }
+
+    Slot *slot_;
+  };
+
+  static Registry &getRegistry()
+  {
+    static Registry *registry = new Registry();
+    return *registry;
+  }
+};
+
+}
+
+#endif //__PER_THREAD_H__
@@ -0,0 +1,69 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace cache {
+// A bounded lock-free queue between one producer thread and one consumer
+// thread. The two ends keep their indexes on separate cache lines, and each
+// end caches the index of the other so that it only reads the shared one
+// when the ring looks full (or empty).
+template <typename T>
+class SpscRing
+{
+  public:
+
+  // capacity is rounded up to a power of two
+  explicit SpscRing (uint32_t capacity) :
+    head_ (0), cachedTail_ (0), tail_ (0), cachedHead_ (0)
+  {
+    capacity_ = 1;
+    while (capacity_ < capacity)
+      capacity_ <<= 1;
+    slots_ = std::make_unique<T[]> (capacity_);
+  }
+
+  // Producer only
+  bool tryPush (const T &item)
+  {
+    uint64_t tail = tail_.load (std::memory_order_relaxed);
+    if (tail - cachedHead_ == capacity_) {
+      cachedHead_ = head_.load (std::memory_order_acquire);
+      if (tail - cachedHead_ == capacity_)
+        return false;
+    }
+    slots_[tail & (capacity_ - 1)] = item;
+    tail_.store (tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only
+  bool tryPop (T &item)
+  {
+    uint64_t head = head_.load (std::memory_order_relaxed);
+    if (head == cachedTail_) {
+      cachedTail_ = tail_.load (std::memory_order_acquire);
+      if (head == cachedTail_)
+        return false;
+    }
+    item = slots_[head & (capacity_ - 1)];
+    head_.store (head + 1, std::memory_order_release);
+    return true;
+  }
+
+  protected:
+
+  // Written by the consumer
+  alignas (64) std::atomic<uint64_t> head_;
+  uint64_t cachedTail_;
+  // Written by the producer
+  alignas (64) std::atomic<uint64_t> tail_;
+  uint64_t cachedHead_;
+
+  alignas (64) uint64_t capacity_;
+  std::unique_ptr<T[]> slots_;
+};
+}
+
+#endif
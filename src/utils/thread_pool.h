@@ -1,98 +1,288 @@
 #ifndef __THREAD_POOL_H__
 #define __THREAD_POOL_H__
+#include <cstddef>
 #include <vector>
+#include <deque>
+#include <algorithm>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include <condition_variable>
-#include <queue>
 #include <functional>
 #include <chrono>
 
 namespace cache {
-// A "nice and neat" threadpool that reuses thread objects from StackOverflow
-// https://stackoverflow.com/a/29742586
+// A work-stealing thread pool. Each thread has its own deque of jobs, jobs
+// submitted are spread over the deques, and a thread without jobs steals the
+// oldest job of another thread. Jobs run roughly in the order they are
+// submitted. Submitting blocks while the pool holds maxJobsPerThread jobs
+// per thread, so that a replay does not queue the whole trace.
 class AThreadPool
 {
   public:
 
-  AThreadPool (int threads) : shutdown_ (false)
+  // A callable stored inline when it is small enough, so that submitting it
+  // does not allocate
+  class Job
+  {
+    public:
+
+    Job () : ops_ (nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<
+      ! std::is_same<typename std::decay<F>::type, Job>::value>::type>
+    Job (F &&func)
+    {
+      using D = typename std::decay<F>::type;
+      construct<D> (std::forward<F> (func), std::integral_constant<bool,
+          sizeof (D) <= kInlineSize && alignof (D) <= alignof (std::max_align_t)
+          && std::is_nothrow_move_constructible<D>::value> ());
+    }
+
+    Job (Job &&job) noexcept : ops_ (job.ops_)
+    {
+      if (ops_ != nullptr)
+        ops_->move (storage_, job.storage_);
+      job.ops_ = nullptr;
+    }
+
+    Job &operator= (Job &&job) noexcept
+    {
+      if (this != &job) {
+        reset ();
+        ops_ = job.ops_;
+        if (ops_ != nullptr)
+          ops_->move (storage_, job.storage_);
+        job.ops_ = nullptr;
+      }
+      return *this;
+    }
+
+    Job (const Job &) = delete;
+    Job &operator= (const Job &) = delete;
+    ~Job () { reset (); }
+
+    void operator() () { ops_->invoke (storage_); }
+
+    private:
+
+    static const size_t kInlineSize = 64;
+
+    struct Ops
+    {
+      void (*invoke) (void *);
+      // Move-construct dst from src and destroy src
+      void (*move) (void *dst, void *src);
+      void (*destroy) (void *);
+    };
+
+    template <typename D>
+    void construct (D func, std::true_type)
+    {
+      static const Ops ops = {
+        [] (void *p) { (*static_cast<D *> (p)) (); },
+        [] (void *dst, void *src) {
+          new (dst) D (std::move (*static_cast<D *> (src)));
+          static_cast<D *> (src)->~D ();
+        },
+        [] (void *p) { static_cast<D *> (p)->~D (); }
+      };
+      new (storage_) D (std::move (func));
+      ops_ = &ops;
+    }
+
+    template <typename D>
+    void construct (D func, std::false_type)
+    {
+      static const Ops ops = {
+        [] (void *p) { (**static_cast<D **> (p)) (); },
+        [] (void *dst, void *src) { *static_cast<D **> (dst) = *static_cast<D **> (src); },
+        [] (void *p) { delete *static_cast<D **> (p); }
+      };
+      *reinterpret_cast<D **> (storage_) = new D (std::move (func));
+      ops_ = &ops;
+    }
+
+    void reset ()
+    {
+      if (ops_ != nullptr)
+        ops_->destroy (storage_);
+      ops_ = nullptr;
+    }
+
+    alignas (std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops *ops_;
+  };
+
+  AThreadPool (int threads, int64_t maxJobsPerThread = 64) :
+    shutdown_ (false), nextWorker_ (0), nJobs_ (0), nSleeping_ (0), nWaitingSubmitters_ (0),
+    maxJobs_ (std::max<int64_t> (maxJobsPerThread * threads, 1)), workers_ (threads)
   {
     // Create the specified number of threads
     threads_.reserve (threads);
     for (int i = 0; i < threads; ++i)
-      threads_.emplace_back (std::bind (&AThreadPool::threadEntry, this, i));
+      threads_.emplace_back (&AThreadPool::threadEntry, this, i);
   }
 
   ~AThreadPool ()
   {
     {
-      // Unblock any threads and tell them to stop
-      std::unique_lock <std::mutex> l (lock_);
+      // Unblock any threads and tell them to stop once the jobs are done
+      std::unique_lock <std::mutex> l (sleepMutex_);
 
       shutdown_ = true;
-      condVar_.notify_all();
+      condVar_.notify_all ();
     }
 
     // Wait for all threads to stop
-    //std::cerr << "Joining threads" << std::endl;
     for (auto& thread : threads_)
-      thread.join();
+      thread.join ();
   }
 
-  void doJob (std::function <void (void)> func)
+  void doJob (Job job)
   {
-    // Place a job on the queue and unblock a thread
+    waitForRoom ();
+    Worker &worker = workers_[nextWorker_.fetch_add (1, std::memory_order_relaxed) % workers_.size ()];
     {
-      std::unique_lock <std::mutex> l (lock_);
-
-      jobs_.emplace (std::move (func));
-      condVar_.notify_one();
-      while (jobs_.size() >= 2 * threads_.size()) {
-        condVarMaster_.wait(l);
-      }
+      std::lock_guard <std::mutex> l (worker.mutex_);
+      worker.jobs_.emplace_back (std::move (job));
     }
+    nJobs_.fetch_add (1);
+    wake (false);
+  }
+
+  // Submit func (i) for i in [0, nJobs), taking the lock of each deque once.
+  // Jobs are dealt to the threads in turn as doJob does, and the deques are
+  // all locked while the batch is added, so that no job is taken before an
+  // earlier one of the batch can be. A job may then wait for an earlier one.
+  template <typename F>
+  void doJobs (uint64_t nJobs, F func)
+  {
+    waitForRoom ();
+    // Deques are always locked in the same order
+    for (auto &worker : workers_)
+      worker.mutex_.lock ();
+    uint32_t first = nextWorker_.fetch_add (nJobs, std::memory_order_relaxed);
+    for (uint64_t i = 0; i < nJobs; ++i)
+      workers_[(first + i) % workers_.size ()].jobs_.emplace_back ([func, i] () mutable { func (i); });
+    for (auto &worker : workers_)
+      worker.mutex_.unlock ();
+    nJobs_.fetch_add (nJobs);
+    wake (true);
   }
 
   protected:
 
+  struct alignas (64) Worker
+  {
+    std::mutex mutex_;
+    std::deque <Job> jobs_;
+  };
+
+  static const uint32_t kNumSpinRounds = 64;
+
+  void waitForRoom ()
+  {
+    if (nJobs_.load () < maxJobs_)
+      return;
+    // Wait until the threads have worked through half of the jobs
+    std::unique_lock <std::mutex> l (submitMutex_);
+    ++nWaitingSubmitters_;
+    submitCondVar_.wait (l, [this] () { return nJobs_.load () <= maxJobs_ / 2; });
+    --nWaitingSubmitters_;
+  }
+
+  void wake (bool all)
+  {
+    // nSleeping_ is raised before a thread checks nJobs_ for the last time
+    if (nSleeping_.load () == 0)
+      return;
+    std::lock_guard <std::mutex> l (sleepMutex_);
+    if (all)
+      condVar_.notify_all ();
+    else
+      condVar_.notify_one ();
+  }
+
+  bool tryPop (Worker &worker, Job &job, bool wait)
+  {
+    std::unique_lock <std::mutex> l (worker.mutex_, std::defer_lock);
+    if (wait)
+      l.lock ();
+    else if (! l.try_lock ())
+      return false;
+    if (worker.jobs_.empty ())
+      return false;
+    job = std::move (worker.jobs_.front ());
+    worker.jobs_.pop_front ();
+    return true;
+  }
+
+  bool findJob (int i, Job &job)
+  {
+    if (tryPop (workers_[i], job, true))
+      return true;
+    // Steal the oldest job of the next threads
+    for (size_t k = 1; k < workers_.size (); ++k)
+      if (tryPop (workers_[(i + k) % workers_.size ()], job, false))
+        return true;
+    return false;
+  }
+
   void threadEntry (int i)
   {
-    std::function <void (void)> job;
+    Job job;
+    uint32_t nIdleRounds = 0;
 
     while (1)
     {
-      {
-        std::unique_lock <std::mutex> l (lock_);
-
-        while (! shutdown_ && jobs_.empty()) {
-          condVar_.wait (l);
-        }
-
-        if (jobs_.empty ())
-        {
-          // No jobs to do and we are shutting down
-          //std::cerr << "Thread " << i << " terminates" << std::endl;
-          return;
+      if (findJob (i, job)) {
+        int64_t nJobs = nJobs_.fetch_sub (1) - 1;
+        if (nWaitingSubmitters_.load () > 0
+            && nJobs <= maxJobs_ / 2) {
+          std::lock_guard <std::mutex> l (submitMutex_);
+          submitCondVar_.notify_all ();
         }
-
-        job = std::move (jobs_.front ());
-        jobs_.pop();
+        // Do the job without holding any locks
+        job ();
+        job = Job ();
+        nIdleRounds = 0;
+        continue;
+      }
+      // Jobs in deques that were busy are found in the next round
+      if (nJobs_.load () > 0 || ++nIdleRounds < kNumSpinRounds) {
+        std::this_thread::yield ();
+        continue;
       }
 
-      // Do the job without holding any locks
-      job ();
-      if (jobs_.size() < threads_.size()) {
-        condVarMaster_.notify_one();
+      std::unique_lock <std::mutex> l (sleepMutex_);
+      ++nSleeping_;
+      while (! shutdown_ && nJobs_.load () == 0)
+        condVar_.wait (l);
+      --nSleeping_;
+      if (shutdown_ && nJobs_.load () == 0)
+      {
+        // No jobs to do and we are shutting down
+        return;
       }
+      nIdleRounds = 0;
     }
-
   }
 
-  std::mutex lock_;
-  std::condition_variable condVar_, condVarMaster_;
+  std::mutex sleepMutex_, submitMutex_;
+  std::condition_variable condVar_, submitCondVar_;
   bool shutdown_;
-  std::queue <std::function <void (void)>> jobs_;
+  std::atomic <uint32_t> nextWorker_;
+  // Jobs submitted and not yet taken by a thread
+  std::atomic <int64_t> nJobs_;
+  std::atomic <uint32_t> nSleeping_, nWaitingSubmitters_;
+  const int64_t maxJobs_;
+  std::vector <Worker> workers_;
   std::vector <std::thread> threads_;
 };
 }
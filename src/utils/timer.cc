@@ -0,0 +1,48 @@
+#include "timer.h"
+
+#include <chrono>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace cache {
+
+namespace {
+  // Shortest interval the rate of the TSC is measured over
+  const uint64_t kMinCalibrationNs = 10000000;
+}
+
+const bool Timer::useTsc_ = Timer::hasInvariantTsc();
+const uint64_t Timer::baseTicks_ = Timer::now();
+const uint64_t Timer::baseNs_ = Timer::nowNs();
+
+bool Timer::hasInvariantTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t eax, ebx, ecx, edx;
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  // The TSC ticks at a constant rate in all power states
+  return (edx & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+double Timer::toNs(uint64_t ticks)
+{
+  if (!useTsc_) {
+    return ticks;
+  }
+  uint64_t ns = nowNs();
+  if (ns - baseNs_ < kMinCalibrationNs) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(kMinCalibrationNs - (ns - baseNs_)));
+    ns = nowNs();
+  }
+  uint64_t elapsedTicks = now() - baseTicks_;
+  return elapsedTicks == 0 ? 0 : ticks * (double)(ns - baseNs_) / elapsedTicks;
+}
+
+}
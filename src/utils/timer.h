@@ -0,0 +1,58 @@
+/* File: utils/timer.h
+ * Description:
+ *   Timer reads a clock cheap enough to time every stage of every chunk.
+ *
+ *   1. On x86 with an invariant TSC, a tick is a TSC cycle, read with rdtsc
+ *      without a system call. Otherwise a tick is a nanosecond of
+ *      CLOCK_MONOTONIC_RAW.
+ *   2. Ticks are converted to nanoseconds by the rate of the TSC measured
+ *      against CLOCK_MONOTONIC_RAW between the start of the process and the
+ *      conversion, so that the longer the run the finer the calibration.
+ *
+ *   Durations are summed in ticks and converted once when they are read.
+ */
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace cache {
+
+class Timer {
+ public:
+  static inline uint64_t now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    if (useTsc_) {
+      return __rdtsc();
+    }
+#endif
+    return nowNs();
+  }
+
+  static inline uint64_t nowNs()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  static double toNs(uint64_t ticks);
+  static inline uint64_t toUs(uint64_t ticks) { return (uint64_t)(toNs(ticks) / 1000); }
+  static bool isTscUsed() { return useTsc_; }
+
+ private:
+  static bool hasInvariantTsc();
+
+  static const bool useTsc_;
+  // Ticks and nanoseconds at the start of the process
+  static const uint64_t baseTicks_, baseNs_;
+};
+
+}
+
+#endif //__TIMER_H__
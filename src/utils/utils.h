@@ -2,20 +2,19 @@
 #include <openssl/sha.h>
 #include <cstdio>
 #include <cstring>
+#include "utils/timer.h"
 
 #define DEBUG(str) \
   std::cout << str << std::endl;
 
+// Time a stage of the data path in Timer ticks, added to the counters of
+// the calling thread
 #define BEGIN_TIMER() \
   { \
-    struct timeval ts_begin_{0}, ts_end_{0};\
-    gettimeofday(&ts_begin_, NULL);
+    uint64_t timer_begin_ = Timer::now();
 
 #define END_TIMER(phase_name) \
-    gettimeofday(&ts_end_, NULL); \
-    Stats::getInstance().add_time_elapsed_##phase_name(\
-        (ts_end_.tv_sec-ts_begin_.tv_sec)*1000000 + ts_end_.tv_usec-ts_begin_.tv_usec\
-        ); \
+    Stats::getInstance().add_time_elapsed_##phase_name(Timer::now() - timer_begin_); \
   }
 
 //#define DEBUG(str) 
@@ -0,0 +1,126 @@
+/* File: test/chunk_ordering_test.cc
+ * Description:
+ *   Requests spanning one to four chunks are issued in one order and run by
+ *   several threads. Their chunks overlap each other, sit on two volumes,
+ *   and include chunks that share a stripe of ChunkOrdering. On every
+ *   chunk, the requests must run one at a time and in the order they were
+ *   issued.
+ */
+#include "common/common.h"
+#include "common/config.h"
+#include "manage/chunk_ordering.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumThreads = 8;
+  const uint32_t kNumRequests = 100000;
+  // Runs of chunks the requests start in; chunks 1024 apart share a stripe
+  // as long as ChunkOrdering has 1024 stripes
+  const uint64_t kFirstChunks[] = {0, 1022, 2046};
+  const uint32_t kNumChunksPerRun = 4;
+
+  uint32_t nFailures = 0;
+
+  void check(bool condition, const char *what)
+  {
+    if (!condition) {
+      printf("FAILED: %s\n", what);
+      ++nFailures;
+    }
+  }
+
+  // What ran on a chunk, in the order it ran
+  struct ChunkLog {
+    std::mutex mutex_;
+    std::vector<uint32_t> requestIds_;
+    std::atomic<uint32_t> nRunning_{0};
+    bool isOverlapped_ = false;
+  };
+}
+
+int main()
+{
+  Config::getInstance().enableMultiThreading(true);
+  uint32_t chunkSize = Config::getInstance().getChunkSize();
+  ChunkOrdering ordering;
+
+  std::mt19937_64 rng(1);
+  std::vector<ChunkOrdering::Ticket> tickets;
+  std::map<uint64_t, std::vector<uint32_t>> expectedOrders;
+  for (uint32_t requestId = 0; requestId < kNumRequests; ++requestId) {
+    uint32_t volumeId = rng() % 2;
+    uint64_t firstChunk = kFirstChunks[rng() % 3] + rng() % kNumChunksPerRun;
+    uint64_t addr = firstChunk * chunkSize + rng() % chunkSize;
+    uint32_t len = 1 + rng() % (3 * chunkSize);
+    tickets.push_back(ordering.issue(toLba(volumeId, addr), len));
+    for (uint64_t chunkLba = toLba(volumeId, addr) / chunkSize * chunkSize;
+         chunkLba < toLba(volumeId, addr) + len; chunkLba += chunkSize) {
+      expectedOrders[chunkLba].push_back(requestId);
+    }
+  }
+
+  std::map<uint64_t, ChunkLog> logs;
+  for (auto &expectedOrder : expectedOrders) {
+    logs[expectedOrder.first];
+  }
+  // Requests are taken in the order they were issued, and run in whatever
+  // order the threads get to them
+  std::atomic<uint32_t> nextRequestId(0);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&]() {
+      for (uint32_t requestId = nextRequestId++; requestId < kNumRequests; requestId = nextRequestId++) {
+        ChunkOrdering::Ticket &ticket = tickets[requestId];
+        ordering.wait(ticket);
+        // Give later requests a chance to overtake this one
+        if (requestId % 3 == 0) {
+          std::this_thread::yield();
+        }
+        for (uint64_t chunkLba = ticket.getLba() / chunkSize * chunkSize;
+             chunkLba < ticket.getLba() + ticket.getLen(); chunkLba += chunkSize) {
+          ChunkLog &log = logs[chunkLba];
+          if (log.nRunning_++ != 0) {
+            log.isOverlapped_ = true;
+          }
+          std::lock_guard<std::mutex> l(log.mutex_);
+          log.requestIds_.push_back(requestId);
+        }
+        std::this_thread::yield();
+        for (uint64_t chunkLba = ticket.getLba() / chunkSize * chunkSize;
+             chunkLba < ticket.getLba() + ticket.getLen(); chunkLba += chunkSize) {
+          --logs[chunkLba].nRunning_;
+        }
+        ordering.release(ticket);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  bool isOverlapped = false, isInOrder = true;
+  for (auto &expectedOrder : expectedOrders) {
+    ChunkLog &log = logs[expectedOrder.first];
+    isOverlapped |= log.isOverlapped_;
+    isInOrder &= log.requestIds_ == expectedOrder.second;
+  }
+  check(!isOverlapped, "requests to a chunk run one at a time");
+  check(isInOrder, "requests to a chunk run in the order they were issued");
+  if (nFailures != 0) {
+    printf("%u checks failed\n", nFailures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* File: test/thread_pool_test.cc
+ * Description:
+ *   Several producers submit to one AThreadPool at the same time, with
+ *   doJob and with batches of doJobs, while the pool is kept small enough
+ *   that submitters block for room. Every job must run exactly once, and
+ *   the pool must drain them all before its destructor returns.
+ */
+#include "utils/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumThreads = 4;
+  const uint32_t kNumProducers = 8;
+  const uint32_t kNumJobsPerProducer = 100000;
+  const uint32_t kMaxJobsPerThread = 16;
+
+  uint32_t nFailures = 0;
+
+  void check(bool condition, const char *what)
+  {
+    if (!condition) {
+      printf("FAILED: %s\n", what);
+      ++nFailures;
+    }
+  }
+}
+
+int main()
+{
+  std::unique_ptr<std::atomic<uint32_t>[]> nRuns(
+      new std::atomic<uint32_t>[kNumProducers * kNumJobsPerProducer]);
+  for (uint32_t i = 0; i < kNumProducers * kNumJobsPerProducer; ++i) {
+    nRuns[i] = 0;
+  }
+
+  {
+    AThreadPool threadPool(kNumThreads, kMaxJobsPerThread);
+    std::vector<std::thread> producers;
+    for (uint32_t producerId = 0; producerId < kNumProducers; ++producerId) {
+      producers.emplace_back([&, producerId]() {
+        uint64_t first = 1ull * producerId * kNumJobsPerProducer;
+        uint64_t end = first + kNumJobsPerProducer;
+        // Batches of varying sizes, some over the room left in the pool,
+        // mixed with single jobs
+        for (uint64_t next = first, batchSize = 1; next < end; batchSize = batchSize % 97 + 1) {
+          uint64_t nJobs = std::min(batchSize, end - next);
+          if (nJobs == 1) {
+            threadPool.doJob([&nRuns, next]() { nRuns[next].fetch_add(1); });
+          } else {
+            threadPool.doJobs(nJobs, [&nRuns, next](uint64_t i) { nRuns[next + i].fetch_add(1); });
+          }
+          next += nJobs;
+        }
+      });
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+  }
+
+  uint32_t nMissed = 0, nRepeated = 0;
+  for (uint32_t i = 0; i < kNumProducers * kNumJobsPerProducer; ++i) {
+    nMissed += nRuns[i] == 0;
+    nRepeated += nRuns[i] > 1;
+  }
+  check(nMissed == 0, "every job runs");
+  check(nRepeated == 0, "no job runs twice");
+  if (nFailures != 0) {
+    printf("%u checks failed (%u jobs missed, %u jobs repeated)\n", nFailures, nMissed, nRepeated);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
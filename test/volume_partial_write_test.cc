@@ -0,0 +1,163 @@
+/* File: test/volume_partial_write_test.cc
+ * Description:
+ *   Partial and unaligned writes to a volume other than volume 0.
+ *
+ *   The volume id is in the high bits of an lba (see toLba), so a chunk
+ *   boundary has to be computed on the 64-bit lba. Two volumes are written
+ *   with whole chunks, then volume 1 gets writes that start and end inside
+ *   a chunk, inside a sector, and across a chunk boundary. Every byte read
+ *   back must match a model of both volumes, through the cache and on the
+ *   primary devices once the cache is gone.
+ *
+ *   Usage: volume_partial_write_test [directory for the device files]
+ */
+#include "austere_cache/austere_cache.h"
+#include "chunking/chunk_module.h"
+#include "common/common.h"
+#include "common/config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace cache;
+
+namespace {
+  const uint32_t kNumVolumes = 2;
+  const uint32_t kNumChunks = 8;
+
+  uint32_t nFailures = 0;
+
+  void check(bool condition, const char *what)
+  {
+    if (!condition) {
+      printf("FAILED: %s\n", what);
+      ++nFailures;
+    }
+  }
+
+  // Bytes that differ between volumes and positions, so that data written
+  // to the wrong place is noticed
+  void fill(std::vector<uint8_t> &buf, uint32_t seed)
+  {
+    for (uint32_t i = 0; i < buf.size(); ++i) {
+      buf[i] = (uint8_t)((i * 131 + seed * 7919) >> 3);
+    }
+  }
+
+  void checkChunker(uint32_t chunkSize)
+  {
+    // A request to volume 1 that starts inside a chunk and ends in the next
+    uint64_t lba = toLba(1, chunkSize + 100);
+    std::vector<uint8_t> buf(chunkSize + 200);
+    Chunker chunker(lba, buf.data(), buf.size());
+    uint64_t addr;
+    uint8_t *data;
+    uint32_t len;
+    check(chunker.next(addr, data, len) && addr == lba && len == chunkSize - 100,
+        "the first piece ends at the chunk boundary of volume 1");
+    check(chunker.next(addr, data, len) && addr == toLba(1, 2 * chunkSize) && len == 300,
+        "the second piece starts at the chunk boundary of volume 1");
+    check(!chunker.next(addr, data, len), "the request is cut in two pieces");
+  }
+
+  void checkVolumes(AustereCache &cache, std::vector<std::vector<uint8_t>> &model, const char *what)
+  {
+    uint32_t chunkSize = Config::getInstance().getChunkSize();
+    std::vector<uint8_t> buf(kNumChunks * chunkSize);
+    for (uint32_t volumeId = 0; volumeId < kNumVolumes; ++volumeId) {
+      for (uint32_t i = 0; i < kNumChunks; ++i) {
+        cache.read(volumeId, 1ull * i * chunkSize, buf.data() + 1ull * i * chunkSize, chunkSize);
+      }
+      check(memcmp(buf.data(), model[volumeId].data(), buf.size()) == 0, what);
+    }
+    // An unaligned read over a chunk boundary of volume 1
+    uint64_t addr = 3ull * chunkSize - 777;
+    cache.read(1, addr, buf.data(), 2000);
+    check(memcmp(buf.data(), model[1].data() + addr, 2000) == 0, what);
+  }
+
+  void checkPrimaryDevices(std::vector<std::string> &primaryDeviceNames,
+      std::vector<std::vector<uint8_t>> &model)
+  {
+    for (uint32_t volumeId = 0; volumeId < kNumVolumes; ++volumeId) {
+      std::vector<uint8_t> buf(model[volumeId].size());
+      int fd = open(primaryDeviceNames[volumeId].c_str(), O_RDONLY);
+      check(fd >= 0 && pread(fd, buf.data(), buf.size(), 0) == (ssize_t)buf.size(),
+          "read the primary device");
+      check(memcmp(buf.data(), model[volumeId].data(), buf.size()) == 0,
+          "the primary devices hold the data written");
+      close(fd);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string directory = argc > 1 ? argv[1] : ".";
+  uint32_t chunkSize = Config::getInstance().getChunkSize();
+
+  std::vector<std::string> primaryDeviceNames;
+  for (uint32_t volumeId = 0; volumeId < kNumVolumes; ++volumeId) {
+    primaryDeviceNames.push_back(directory + "/volume_partial_write_test.primary" + std::to_string(volumeId));
+  }
+  std::string cacheDeviceName = directory + "/volume_partial_write_test.cache";
+  for (auto &name : primaryDeviceNames) {
+    unlink(name.c_str());
+    Config::getInstance().addPrimaryDeviceName((char *)name.c_str());
+  }
+  unlink(cacheDeviceName.c_str());
+  Config::getInstance().setCacheDeviceName((char *)cacheDeviceName.c_str());
+  Config::getInstance().setPrimaryDeviceSize(64 * 1024 * 1024ull);
+  Config::getInstance().setCacheDeviceSize(16 * 1024 * 1024ull);
+  Config::getInstance().setWorkingSetSize(64 * 1024 * 1024ull);
+  Config::getInstance().setWeuSize(2 * 1024 * 1024);
+  Config::getInstance().enableFakeIO(false);
+
+  checkChunker(chunkSize);
+
+  std::vector<std::vector<uint8_t>> model(kNumVolumes, std::vector<uint8_t>(kNumChunks * chunkSize));
+  {
+    AustereCache cache;
+    for (uint32_t volumeId = 0; volumeId < kNumVolumes; ++volumeId) {
+      fill(model[volumeId], volumeId + 1);
+      for (uint32_t i = 0; i < kNumChunks; ++i) {
+        cache.write(volumeId, 1ull * i * chunkSize, model[volumeId].data() + 1ull * i * chunkSize, chunkSize);
+      }
+    }
+    checkVolumes(cache, model, "whole chunks read back");
+
+    // Inside a chunk, inside a sector, over a chunk boundary, and over
+    // several chunks, all unaligned
+    struct { uint64_t addr_; uint32_t len_; } writes[] = {
+      {1000, 3000},
+      {1ull * chunkSize + 8192 + 17, 100},
+      {2ull * chunkSize - 700, 1400},
+      {4ull * chunkSize + 4095, 2 * chunkSize + 3},
+    };
+    std::vector<uint8_t> data(3 * chunkSize);
+    uint32_t seed = 100;
+    for (auto &write : writes) {
+      fill(data, seed++);
+      cache.write(1, write.addr_, data.data(), write.len_);
+      memcpy(model[1].data() + write.addr_, data.data(), write.len_);
+    }
+    checkVolumes(cache, model, "partial writes to volume 1 read back");
+  }
+  checkPrimaryDevices(primaryDeviceNames, model);
+
+  for (auto &name : primaryDeviceNames) {
+    unlink(name.c_str());
+  }
+  unlink(cacheDeviceName.c_str());
+  if (nFailures != 0) {
+    printf("%u checks failed\n", nFailures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}